@@ -22,6 +22,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include <sqlite3.h>
 
@@ -45,6 +48,107 @@ typedef struct item_list_s {
   const char *name;
 } item_list_t;
 
+/*
+ * Cache of the ids for the names which are often repeated. The groups and
+ * the languages are already known with groups_id and langs_id.
+ */
+#define DATABASE_CACHE_SIZE  1024  /* entries by table, power of two */
+
+typedef enum database_cache_type {
+  DATABASE_CACHE_META = 0,
+  DATABASE_CACHE_DATA,
+  DATABASE_CACHE_GRABBER,
+  DATABASE_CACHE_NB
+} database_cache_type_t;
+
+typedef struct database_cache_s {
+  unsigned int hash;
+  int64_t      id;
+  char        *name;
+} database_cache_t;
+
+/*
+ * State of the files loaded at once, in order to handle the files of the
+ * scanner without queries. The on-demand files out of the paths are loaded
+ * too, else they would be seen as new files. An entry is used only one
+ * time, the next requests for the same file are read in the database.
+ */
+#define DATABASE_CHECKED_NB  16 /* see UPDATE_FILE_CHECKED_IDS */
+
+typedef struct database_preload_entry_s {
+  unsigned int hash;
+  unsigned int next;     /* index + 1 of the next entry in the bucket */
+  size_t       path;     /* offset in the strings */
+  int64_t      id;
+  int64_t      mtime;
+  int          interrup;
+  int          used;
+} database_preload_entry_t;
+
+typedef struct database_preload_s {
+  unsigned int  size;    /* number of buckets, power of two */
+  unsigned int *bucket;  /* index + 1 of the first entry */
+
+  database_preload_entry_t *entry;
+  unsigned int  entry_nb;
+  unsigned int  entry_max;
+
+  char         *str;
+  size_t        str_len;
+  size_t        str_max;
+} database_preload_t;
+
+/*
+ * Prepared statements of the public selections, by query shape. The values
+ * are bound with numbered parameters (?NNN), then the same shape is neither
+ * parsed nor planned again. A statement is lent to one vhstmt at a time.
+ */
+#define DATABASE_SELECT_NB  16
+
+typedef struct database_select_s {
+  unsigned int  hash;
+  char         *sql;
+  sqlite3_stmt *stmt;
+  uint64_t      lru;     /* tick of the last use */
+  int           busy;
+} database_select_t;
+
+/*
+ * Read-only connections leased to the statements of the public selections.
+ * The first connection is the main one (shared with the dbmanager); the
+ * others are opened on demand and used only with the WAL journal, then the
+ * selections never wait on the transactions of the dbmanager.
+ */
+#define DATABASE_READERS_MAX  16
+#define DATABASE_READERS_DEF  4
+
+typedef struct database_conn_s {
+  sqlite3      *db;
+  int           busy;    /* leased to a vhstmt (not for the main one) */
+  unsigned int  pragma_rev; /* conn_pragma applied on this reader */
+
+  database_select_t select[DATABASE_SELECT_NB];
+  uint64_t      select_tick;
+} database_conn_t;
+
+typedef struct database_param_s {
+  int         type;      /* SQLITE_INTEGER or SQLITE_TEXT */
+  int64_t     val;
+  const char *text;
+} database_param_t;
+
+typedef struct database_params_s {
+  database_param_t *p;
+  unsigned int      nb;
+  unsigned int      max;
+} database_params_t;
+
+/* Index in the list (enum) by id, -1 for the unknown ids. */
+typedef struct database_rev_s {
+  int          *idx;
+  unsigned int  nb;
+} database_rev_t;
+
 struct database_s {
   sqlite3      *db;
   char         *path;
@@ -52,23 +156,50 @@ struct database_s {
   item_list_t  *file_type;
   int64_t      *groups_id;
   int64_t      *langs_id;
-};
 
-#define VHSTMT_MAXCOLS  8
+  database_rev_t file_type_rev;
+  database_rev_t groups_rev;
+  database_rev_t langs_rev;
+
+  database_cache_t *cache[DATABASE_CACHE_NB];
+
+  database_conn_t conn[DATABASE_READERS_MAX + 1];
+  unsigned int  readers;
+  int           wal;
+  pthread_mutex_t pool_mutex;
+
+  /* Per-connection pragmas (by database_pragma_t) replayed on the readers. */
+  char          conn_pragma[DATABASE_PRAGMA_TEMP_STORE + 1][64];
+  unsigned int  pragma_rev;
+
+  int           fts;        /* full-text index available */
+
+  database_preload_t *preload;
+  int64_t       generation; /* checked__ of the files seen with this loop */
+  int64_t       checked[DATABASE_CHECKED_NB];
+  unsigned int  checked_nb;
+};
 
 struct valhalla_db_stmt_s {
   char         *sql;
   sqlite3_stmt *stmt;
+  database_t   *database;
+  database_conn_t   *conn;   /* connection leased for the statement */
+  database_select_t *select; /* NULL if the statement is not cached */
 
   unsigned int  cnt;
-  const char   *cols[VHSTMT_MAXCOLS];
 
   union {
-    valhalla_db_metares_t metares;
-    valhalla_db_fileres_t fileres;
+    valhalla_db_metares_t  metares;
+    valhalla_db_fileres_t  fileres;
+    valhalla_db_countres_t countres;
   } u;
 };
 
+#define VHSTMT_INT64(v, i) sqlite3_column_int64 ((v)->stmt, i)
+#define VHSTMT_INT(v, i)   sqlite3_column_int   ((v)->stmt, i)
+#define VHSTMT_TEXT(v, i)  ((const char *) sqlite3_column_text ((v)->stmt, i))
+
 static const item_list_t g_file_type[] = {
   [VALHALLA_FILE_TYPE_NULL]     = { 0, "null"     },
   [VALHALLA_FILE_TYPE_AUDIO]    = { 0, "audio"    },
@@ -112,15 +243,29 @@ typedef enum database_stmt {
   STMT_DELETE_ASSOC_FILE_METADATA2,
   STMT_DELETE_ASSOC_FILE_GRABBER,
   STMT_DELETE_DLCONTEXT,
+  STMT_SELECT_DIR_MTIME,
+  STMT_SELECT_DIR_CHILDREN,
+  STMT_INSERT_DIR,
+  STMT_SELECT_PROBE,
+  STMT_INSERT_PROBE,
+  STMT_UPDATE_PROBE_PATH,
+  STMT_UPDATE_DIR_MTIME,
+  STMT_UPDATE_DIR_PARENT,
+  STMT_UPDATE_FILE_CHECKED_DIR,
+  STMT_UPDATE_FILE_CHECKED_IDS,
+  STMT_SELECT_FILE_PRELOAD,
+  STMT_DELETE_DIR,
+  STMT_DELETE_DIR_TREE,
 
-  STMT_CLEANUP_ASSOC_FILE_METADATA,
-  STMT_CLEANUP_ASSOC_FILE_GRABBER,
   STMT_CLEANUP_META,
+  STMT_CLEANUP_META_DONE,
   STMT_CLEANUP_DATA,
+  STMT_CLEANUP_DATA_DONE,
   STMT_CLEANUP_GRABBER,
+  STMT_CLEANUP_GRABBER_DONE,
 
-  STMT_UPDATE_FILE_CHECKED_CLEAR,
   STMT_SELECT_FILE_CHECKED_CLEAR,
+  STMT_SELECT_FILE_CHECKED_MAX,
   STMT_UPDATE_FILE_INTERRUP_CLEAR,
   STMT_UPDATE_FILE_INTERRUP_FIX,
   STMT_SELECT_FILE_OUTOFPATH_SET,
@@ -163,15 +308,29 @@ static const stmt_list_t g_stmts[] = {
   [STMT_DELETE_ASSOC_FILE_METADATA2] = { DELETE_ASSOC_FILE_METADATA2, NULL },
   [STMT_DELETE_ASSOC_FILE_GRABBER]   = { DELETE_ASSOC_FILE_GRABBER,   NULL },
   [STMT_DELETE_DLCONTEXT]            = { DELETE_DLCONTEXT,            NULL },
+  [STMT_SELECT_DIR_MTIME]            = { SELECT_DIR_MTIME,            NULL },
+  [STMT_SELECT_DIR_CHILDREN]         = { SELECT_DIR_CHILDREN,         NULL },
+  [STMT_INSERT_DIR]                  = { INSERT_DIR,                  NULL },
+  [STMT_SELECT_PROBE]                = { SELECT_PROBE,                NULL },
+  [STMT_INSERT_PROBE]                = { INSERT_PROBE,                NULL },
+  [STMT_UPDATE_PROBE_PATH]           = { UPDATE_PROBE_PATH,           NULL },
+  [STMT_UPDATE_DIR_MTIME]            = { UPDATE_DIR_MTIME,            NULL },
+  [STMT_UPDATE_DIR_PARENT]           = { UPDATE_DIR_PARENT,           NULL },
+  [STMT_UPDATE_FILE_CHECKED_DIR]     = { UPDATE_FILE_CHECKED_DIR,     NULL },
+  [STMT_UPDATE_FILE_CHECKED_IDS]     = { UPDATE_FILE_CHECKED_IDS,     NULL },
+  [STMT_SELECT_FILE_PRELOAD]         = { SELECT_FILE_PRELOAD,         NULL },
+  [STMT_DELETE_DIR]                  = { DELETE_DIR,                  NULL },
+  [STMT_DELETE_DIR_TREE]             = { DELETE_DIR_TREE,             NULL },
 
-  [STMT_CLEANUP_ASSOC_FILE_METADATA] = { CLEANUP_ASSOC_FILE_METADATA, NULL },
-  [STMT_CLEANUP_ASSOC_FILE_GRABBER]  = { CLEANUP_ASSOC_FILE_GRABBER,  NULL },
   [STMT_CLEANUP_META]                = { CLEANUP_META,                NULL },
+  [STMT_CLEANUP_META_DONE]           = { CLEANUP_META_DONE,           NULL },
   [STMT_CLEANUP_DATA]                = { CLEANUP_DATA,                NULL },
+  [STMT_CLEANUP_DATA_DONE]           = { CLEANUP_DATA_DONE,           NULL },
   [STMT_CLEANUP_GRABBER]             = { CLEANUP_GRABBER,             NULL },
+  [STMT_CLEANUP_GRABBER_DONE]        = { CLEANUP_GRABBER_DONE,        NULL },
 
-  [STMT_UPDATE_FILE_CHECKED_CLEAR]   = { UPDATE_FILE_CHECKED_CLEAR,   NULL },
   [STMT_SELECT_FILE_CHECKED_CLEAR]   = { SELECT_FILE_CHECKED_CLEAR,   NULL },
+  [STMT_SELECT_FILE_CHECKED_MAX]     = { SELECT_FILE_CHECKED_MAX,     NULL },
   [STMT_UPDATE_FILE_INTERRUP_CLEAR]  = { UPDATE_FILE_INTERRUP_CLEAR,  NULL },
   [STMT_UPDATE_FILE_INTERRUP_FIX]    = { UPDATE_FILE_INTERRUP_FIX,    NULL },
   [STMT_SELECT_FILE_OUTOFPATH_SET]   = { SELECT_FILE_OUTOFPATH_SET,   NULL },
@@ -218,6 +377,27 @@ database_vhstmt_free (valhalla_db_stmt_t *vhstmt)
   if (!vhstmt)
     return;
 
+  if (vhstmt->database)
+    pthread_mutex_lock (&vhstmt->database->pool_mutex);
+
+  if (vhstmt->select)
+  {
+    /* The statement is given back to the cache of the selections. */
+    sqlite3_reset (vhstmt->stmt);
+    sqlite3_clear_bindings (vhstmt->stmt);
+    vhstmt->select->busy = 0;
+  }
+  else if (vhstmt->stmt)
+    sqlite3_finalize (vhstmt->stmt);
+
+  if (vhstmt->database)
+  {
+    /* The connection is given back to the pool. */
+    if (vhstmt->conn)
+      vhstmt->conn->busy = 0;
+    pthread_mutex_unlock (&vhstmt->database->pool_mutex);
+  }
+
   if (vhstmt->sql)
     free (vhstmt->sql);
   free (vhstmt);
@@ -248,13 +428,9 @@ database_sql_exec (sqlite3 *db, const char *sql,
   res = sqlite3_step (stmt);
   if (res == SQLITE_ROW && vhstmt)
   {
-    unsigned int i;
-
+    /* The columns are read with their type by the caller. */
     vhstmt->stmt = stmt;
     vhstmt->cnt  = sqlite3_column_count (stmt);
-    for (i = 0; i < vhstmt->cnt && i < VHSTMT_MAXCOLS; i++)
-      vhstmt->cols[i] = (const char *) sqlite3_column_text (stmt, i);
-
     return 0;
   }
 
@@ -266,8 +442,13 @@ database_sql_exec (sqlite3 *db, const char *sql,
       *errmsg = strdup (err);
   }
 
-  database_vhstmt_free (vhstmt);
-  sqlite3_finalize (stmt);
+  if (vhstmt)
+  {
+    vhstmt->stmt = stmt;
+    database_vhstmt_free (vhstmt);
+  }
+  else
+    sqlite3_finalize (stmt);
   return 1;
 }
 
@@ -279,6 +460,10 @@ database_group_get (database_t *database, int64_t id)
   if (!database)
     return VALHALLA_META_GRP_NIL;
 
+  if (id > 0 && id < database->groups_rev.nb)
+    return database->groups_rev.idx[id] < 0
+           ? VALHALLA_META_GRP_NIL : database->groups_rev.idx[id];
+
   for (i = 0; i < vh_metadata_group_size; i++)
     if (database->groups_id[i] == id)
       return i;
@@ -306,6 +491,10 @@ database_lang_get (database_t *database, int64_t id)
   if (!database)
     return VALHALLA_LANG_UNDEF;
 
+  if (id > 0 && id < database->langs_rev.nb)
+    return database->langs_rev.idx[id] < 0
+           ? VALHALLA_LANG_UNDEF : database->langs_rev.idx[id];
+
   for (i = 0; i < vh_metadata_lang_size; i++)
     if (database->langs_id[i] == id)
       return i;
@@ -333,6 +522,10 @@ database_file_type_get (database_t *database, int64_t id)
   if (!database)
     return VALHALLA_FILE_TYPE_NULL;
 
+  if (id > 0 && id < database->file_type_rev.nb)
+    return database->file_type_rev.idx[id] < 0
+           ? VALHALLA_FILE_TYPE_NULL : database->file_type_rev.idx[id];
+
   for (i = 0; i < ARRAY_NB_ELEMENTS (g_file_type); i++)
     if (database->file_type[i].id == id)
       return i;
@@ -392,7 +585,8 @@ database_query_plan (database_t *database, const char *sql)
     }
 
     vh_log (VALHALLA_MSG_VERBOSE, "| %s | %s | %s",
-            vhstmt->cols[0], vhstmt->cols[1], vhstmt->cols[2]);
+            VHSTMT_TEXT (vhstmt, 0), VHSTMT_TEXT (vhstmt, 1),
+            VHSTMT_TEXT (vhstmt, 2));
   }
 
   if (row)
@@ -541,6 +735,76 @@ database_insert_lang (database_t *database,
   return val;
 }
 
+static unsigned int
+database_cache_hash (const char *str)
+{
+  unsigned int hash = 5381;
+
+  while (*str)
+    hash = (hash << 5) + hash + (unsigned char) *str++;
+  return hash;
+}
+
+static int64_t
+database_cache_get (database_t *database,
+                    database_cache_type_t type, const char *name)
+{
+  unsigned int hash;
+  database_cache_t *entry;
+
+  if (!database->cache[type] || !name)
+    return 0;
+
+  hash  = database_cache_hash (name);
+  entry = &database->cache[type][hash & (DATABASE_CACHE_SIZE - 1)];
+
+  if (entry->name && entry->hash == hash && !strcmp (entry->name, name))
+    return entry->id;
+
+  return 0;
+}
+
+/* A collision replaces the previous entry, then the cache stays bounded. */
+static void
+database_cache_set (database_t *database,
+                    database_cache_type_t type, const char *name, int64_t id)
+{
+  unsigned int hash;
+  database_cache_t *entry;
+
+  if (!database->cache[type] || !name || !id)
+    return;
+
+  hash  = database_cache_hash (name);
+  entry = &database->cache[type][hash & (DATABASE_CACHE_SIZE - 1)];
+
+  if (entry->name)
+    free (entry->name);
+
+  entry->hash = hash;
+  entry->id   = id;
+  entry->name = strdup (name);
+}
+
+static void
+database_cache_flush (database_t *database)
+{
+  unsigned int i, j;
+
+  for (i = 0; i < DATABASE_CACHE_NB; i++)
+  {
+    if (!database->cache[i])
+      continue;
+
+    for (j = 0; j < DATABASE_CACHE_SIZE; j++)
+      if (database->cache[i][j].name)
+      {
+        free (database->cache[i][j].name);
+        database->cache[i][j].name = NULL;
+      }
+  }
+}
+
 static inline int64_t
 database_type_insert (database_t *database, const char *name)
 {
@@ -559,13 +823,19 @@ static inline int64_t
 database_meta_insert (database_t *database, const char *name)
 {
   int64_t val;
+
+  val = database_cache_get (database, DATABASE_CACHE_META, name);
+  if (val)
+    return val;
+
   val = database_insert_name (database, STMT_GET (STMT_INSERT_META), name);
 
   /* retrieve ID if aborted */
   if (!val)
-    return
+    val =
       database_table_get_id (database, STMT_GET (STMT_SELECT_META_ID), name);
 
+  database_cache_set (database, DATABASE_CACHE_META, name, val);
   return val;
 }
 
@@ -573,14 +843,20 @@ static inline int64_t
 database_data_insert (database_t *database, const char *value, int64_t langid)
 {
   int64_t val;
+
+  val = database_cache_get (database, DATABASE_CACHE_DATA, value);
+  if (val)
+    return val;
+
   val =
     database_insert_data (database, STMT_GET (STMT_INSERT_DATA), value, langid);
 
   /* retrieve ID if aborted */
   if (!val)
-    return
+    val =
       database_table_get_id (database, STMT_GET (STMT_SELECT_DATA_ID), value);
 
+  database_cache_set (database, DATABASE_CACHE_DATA, value, val);
   return val;
 }
 
@@ -618,13 +894,19 @@ static inline int64_t
 database_grabber_insert (database_t *database, const char *name)
 {
   int64_t val;
+
+  val = database_cache_get (database, DATABASE_CACHE_GRABBER, name);
+  if (val)
+    return val;
+
   val = database_insert_name (database, STMT_GET (STMT_INSERT_GRABBER), name);
 
   /* retrieve ID if aborted */
   if (!val)
-    return
+    val =
       database_table_get_id (database, STMT_GET (STMT_SELECT_GRABBER_ID), name);
 
+  database_cache_set (database, DATABASE_CACHE_GRABBER, name, val);
   return val;
 }
 
@@ -836,9 +1118,10 @@ database_file_insert (database_t *database, file_data_t *data)
   int res, err = -1;
   sqlite3_stmt *stmt = STMT_GET (STMT_INSERT_FILE);
 
-  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, data->file.path,  out);
-  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, data->file.mtime, out_clear);
-  VH_DB_BIND_INT_OR_GOTO   (stmt, 3, data->outofpath,  out_clear);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, data->file.path,     out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, data->file.mtime,    out_clear);
+  VH_DB_BIND_INT_OR_GOTO   (stmt, 3, data->outofpath,     out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, database->generation, out_clear);
 
   res = sqlite3_step (stmt);
   if (res == SQLITE_DONE)
@@ -864,7 +1147,8 @@ database_file_update (database_t *database, file_data_t *data, int64_t type_id)
   if (type_id)
     VH_DB_BIND_INT64_OR_GOTO (stmt, 3, type_id, out_clear);
 
-  VH_DB_BIND_TEXT_OR_GOTO (stmt, 4, data->file.path, out_clear);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 4, data->file.path,      out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 5, database->generation, out_clear);
 
   res = sqlite3_step (stmt);
   if (res == SQLITE_DONE)
@@ -956,16 +1240,20 @@ database_file_grab (database_t *database, file_data_t *data)
   database_assoc_filegrab_insert (database, file_id, grabber_id);
 }
 
+static void database_preload_forget (database_t *database, const char *file);
+
 void
 vh_database_file_insert (database_t *database, file_data_t *data)
 {
   database_file_data (database, data, 1);
+  database_preload_forget (database, data->file.path);
 }
 
 void
 vh_database_file_data_update (database_t *database, file_data_t *data)
 {
   database_file_data (database, data, 0);
+  database_preload_forget (database, data->file.path);
 }
 
 void
@@ -980,6 +1268,44 @@ vh_database_file_grab_update (database_t *database, file_data_t *data)
   database_file_grab (database, data);
 }
 
+static void
+database_dir_delete (database_t *database,
+                     database_stmt_t id, const char *dir, int len)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (id);
+
+  res = sqlite3_bind_text (stmt, 1, dir, len, SQLITE_STATIC);
+  if (res != SQLITE_OK)
+    goto out;
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+/*
+ * When a file is removed from the database, its directory must be listed
+ * again with the next scanning (the files are maybe only unreachable).
+ */
+static void
+database_dir_forget (database_t *database, const char *file)
+{
+  const char *it = strrchr (file, '/');
+
+  if (!it)
+    return;
+
+  database_dir_delete (database, STMT_DELETE_DIR,
+                       file, it == file ? 1 : (int) (it - file));
+}
+
 void
 vh_database_file_delete (database_t *database, const char *file)
 {
@@ -997,6 +1323,11 @@ vh_database_file_delete (database_t *database, const char *file)
  out:
   if (err < 0)
     vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  else
+  {
+    database_dir_forget (database, file);
+    database_preload_forget (database, file);
+  }
 }
 
 void
@@ -1105,17 +1436,35 @@ vh_database_file_get_grabber (database_t *database,
 /*                          Checked files handling                            */
 /******************************************************************************/
 
+/*
+ * checked__ is the generation (loop) where the file was seen for the last
+ * time. A new loop only increases the generation; the files not seen are
+ * found with checked__ lower than the generation.
+ */
 void
-vh_database_file_checked_clear (database_t *database)
+vh_database_file_checked_next (database_t *database)
 {
   int res;
-  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_CHECKED_CLEAR);
+  sqlite3_stmt *stmt;
+
+  if (database->generation)
+  {
+    database->generation++;
+    return;
+  }
+
+  stmt = STMT_GET (STMT_SELECT_FILE_CHECKED_MAX);
 
   res = sqlite3_step (stmt);
+  if (res == SQLITE_ROW)
+    database->generation = sqlite3_column_int64 (stmt, 0) + 1;
 
   sqlite3_reset (stmt);
-  if (res != SQLITE_DONE)
+  if (res != SQLITE_ROW)
+  {
     vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+    database->generation = 1;
+  }
 }
 
 const char *
@@ -1126,6 +1475,9 @@ vh_database_file_get_checked_clear (database_t *database, int rst)
 
   if (!rst)
   {
+    if (!sqlite3_stmt_busy (stmt))
+      sqlite3_bind_int64 (stmt, 1, database->generation);
+
     res = sqlite3_step (stmt);
     if (res == SQLITE_ROW)
       return (const char *) sqlite3_column_text (stmt, 0);
@@ -1138,146 +1490,403 @@ vh_database_file_get_checked_clear (database_t *database, int rst)
   return NULL;
 }
 
-/******************************************************************************/
-/*                        Interrupted files handling                          */
-/******************************************************************************/
+void
+vh_database_file_checked (database_t *database, int64_t id)
+{
+  if (!id)
+    return;
+
+  database->checked[database->checked_nb++] = id;
+  if (database->checked_nb == DATABASE_CHECKED_NB)
+    vh_database_file_checked_flush (database);
+}
 
 void
-vh_database_file_interrupted_clear (database_t *database, const char *file)
+vh_database_file_checked_flush (database_t *database)
 {
   int res, err = -1;
-  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_INTERRUP_CLEAR);
+  unsigned int i;
+  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_CHECKED_IDS);
 
-  if (!file)
+  if (!database->checked_nb)
     return;
 
-  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, file, out);
+  for (i = 0; i < DATABASE_CHECKED_NB; i++)
+    VH_DB_BIND_INT64_OR_GOTO (stmt, i + 1, i < database->checked_nb
+                                           ? database->checked[i] : 0, out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 17, database->generation, out);
 
   res = sqlite3_step (stmt);
   if (res == SQLITE_DONE)
     err = 0;
 
   sqlite3_reset (stmt);
-  sqlite3_clear_bindings (stmt);
  out:
+  sqlite3_clear_bindings (stmt);
+  database->checked_nb = 0;
   if (err < 0)
     vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
 }
 
-void
-vh_database_file_interrupted_fix (database_t *database)
-{
-  int res, err = -1;
-  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_INTERRUP_FIX);
+/******************************************************************************/
+/*                          Preloaded files handling                          */
+/******************************************************************************/
 
-  res = sqlite3_step (stmt);
-  if (res == SQLITE_DONE)
-    err = 0;
+static unsigned int
+database_preload_hash (const char *str)
+{
+  unsigned int hash = 5381;
 
-  sqlite3_reset (stmt);
-  if (err < 0)
-    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  while (*str)
+    hash = (hash << 5) + hash + (unsigned char) *str++;
+  return hash;
 }
 
-int
-vh_database_file_get_interrupted (database_t *database, const char *file)
+static database_preload_entry_t *
+database_preload_find (database_preload_t *preload,
+                       const char *file, unsigned int hash)
 {
-  int res, err = -1, val = -1;
-  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_INTERRUP);
+  unsigned int it;
 
-  if (!file)
-    return -1;
+  for (it = preload->bucket[hash & (preload->size - 1)]; it;
+       it = preload->entry[it - 1].next)
+  {
+    database_preload_entry_t *entry = &preload->entry[it - 1];
+    if (entry->hash == hash && !strcmp (preload->str + entry->path, file))
+      return entry;
+  }
 
-  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, file, out);
+  return NULL;
+}
 
-  res = sqlite3_step (stmt);
-  if (res == SQLITE_ROW)
-    val = sqlite3_column_int (stmt, 0);
+static database_preload_entry_t *
+database_preload_add (database_preload_t *preload,
+                      const char *file, unsigned int hash)
+{
+  size_t len = strlen (file) + 1;
+  database_preload_entry_t *entry;
+  unsigned int h;
 
-  sqlite3_reset (stmt);
-  sqlite3_clear_bindings (stmt);
-  err = 0;
- out:
-  if (err < 0)
-    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
-  return val;
-}
+  if (preload->entry_nb == preload->entry_max)
+  {
+    unsigned int max = preload->entry_max ? 2 * preload->entry_max : 1024;
+    void *tmp = realloc (preload->entry, max * sizeof (*preload->entry));
+    if (!tmp)
+      return NULL;
+    preload->entry     = tmp;
+    preload->entry_max = max;
+  }
 
-/******************************************************************************/
-/*                         Outofpath file handling                            */
-/******************************************************************************/
+  if (preload->str_len + len > preload->str_max)
+  {
+    size_t max = preload->str_max ? 2 * preload->str_max : 65536;
+    void *tmp;
 
-const char *
-vh_database_file_get_outofpath_set (database_t *database, int rst)
-{
-  int res = SQLITE_DONE;
-  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_OUTOFPATH_SET);
+    while (max < preload->str_len + len)
+      max *= 2;
+    tmp = realloc (preload->str, max);
+    if (!tmp)
+      return NULL;
+    preload->str     = tmp;
+    preload->str_max = max;
+  }
 
-  if (!rst)
+  /* Keep about one entry by bucket. */
+  if (preload->entry_nb >= preload->size)
   {
-    res = sqlite3_step (stmt);
-    if (res == SQLITE_ROW)
-      return (const char *) sqlite3_column_text (stmt, 0);
+    unsigned int i, size = preload->size ? 2 * preload->size : 1024;
+    unsigned int *bucket = calloc (size, sizeof (*bucket));
+    if (!bucket)
+      return NULL;
+
+    for (i = 0; i < preload->entry_nb; i++)
+    {
+      h = preload->entry[i].hash & (size - 1);
+      preload->entry[i].next = bucket[h];
+      bucket[h] = i + 1;
+    }
+
+    free (preload->bucket);
+    preload->bucket = bucket;
+    preload->size   = size;
   }
 
-  sqlite3_reset (stmt);
-  if (res != SQLITE_DONE && res != SQLITE_ROW)
-    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  memcpy (preload->str + preload->str_len, file, len);
 
-  return NULL;
-}
+  entry = &preload->entry[preload->entry_nb++];
+  memset (entry, 0, sizeof (*entry));
+  entry->hash = hash;
+  entry->path = preload->str_len;
+  preload->str_len += len;
 
-/******************************************************************************/
-/*                       Downloader Contexts handling                         */
-/******************************************************************************/
+  h = hash & (preload->size - 1);
+  entry->next = preload->bucket[h];
+  preload->bucket[h] = preload->entry_nb;
 
+  return entry;
+}
+
+/*
+ * The file is inserted or deleted, then the next requests must read the
+ * database.
+ */
 static void
-database_insert_dlcontext (database_t *database, file_dl_t *dl, int64_t file_id)
+database_preload_forget (database_t *database, const char *file)
 {
-  int res, err = -1;
-  sqlite3_stmt *stmt = STMT_GET (STMT_INSERT_DLCONTEXT);
+  unsigned int hash;
+  database_preload_entry_t *entry;
 
-  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, dl->url,  out);
-  VH_DB_BIND_INT_OR_GOTO   (stmt, 2, dl->dst,  out_clear);
-  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 3, dl->name, out_clear);
-  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, file_id,  out_clear);
+  if (!database->preload || !file)
+    return;
 
-  res = sqlite3_step (stmt);
-  if (res == SQLITE_DONE)
-    err = 0;
+  hash  = database_preload_hash (file);
+  entry = database_preload_find (database->preload, file, hash);
+  if (!entry)
+    entry = database_preload_add (database->preload, file, hash);
 
-  sqlite3_reset (stmt);
- out_clear:
-  sqlite3_clear_bindings (stmt);
- out:
-  if (err < 0)
-    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  if (entry)
+    entry->used = 1;
+  else /* no memory, the preload can not be trusted */
+    vh_database_file_preload_free (database);
 }
 
 void
-vh_database_file_insert_dlcontext (database_t *database, file_data_t *data)
+vh_database_file_preload_free (database_t *database)
 {
-  file_dl_t *it;
-  int64_t file_id;
+  database_preload_t *preload = database->preload;
 
-  file_id = database_table_get_id (database,
-                                   STMT_GET (STMT_SELECT_FILE_ID),
-                                   data->file.path);
-  if (!file_id)
+  if (!preload)
     return;
 
-  for (it = data->list_downloader; it; it = it->next)
-    database_insert_dlcontext (database, it, file_id);
+  free (preload->bucket);
+  free (preload->entry);
+  free (preload->str);
+  free (preload);
+  database->preload = NULL;
 }
 
-void
-vh_database_file_get_dlcontext (database_t *database,
-                                const char *file, file_dl_t **dl)
+int
+vh_database_file_preload (database_t *database)
 {
   int res, err = -1;
-  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_DLCONTEXT);
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_PRELOAD);
 
-  if (!file || !dl)
+  vh_database_file_preload_free (database);
+
+  database->preload = calloc (1, sizeof (database_preload_t));
+  if (!database->preload)
+    return -1;
+
+  while ((res = sqlite3_step (stmt)) == SQLITE_ROW)
+  {
+    database_preload_entry_t *entry;
+    const char *file = (const char *) sqlite3_column_text (stmt, 1);
+
+    if (!file)
+      continue;
+
+    entry = database_preload_add (database->preload,
+                                  file, database_preload_hash (file));
+    if (!entry)
+      break;
+
+    entry->id       = sqlite3_column_int64 (stmt, 0);
+    entry->mtime    = sqlite3_column_int64 (stmt, 2);
+    entry->interrup = sqlite3_column_int   (stmt, 3);
+  }
+
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+  if (err < 0)
+  {
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+    vh_database_file_preload_free (database);
+    return -1;
+  }
+
+  vh_log (VALHALLA_MSG_VERBOSE,
+          "[%s] %u files", __FUNCTION__, database->preload->entry_nb);
+  return 0;
+}
+
+/*
+ * Return 0 if the state of the file is known without query. The mtime is
+ * -1 if the file is not in the database.
+ */
+int
+vh_database_file_preload_get (database_t *database, const char *file,
+                              int64_t *id, int64_t *mtime, int *interrup)
+{
+  unsigned int hash;
+  database_preload_entry_t *entry;
+
+  if (!database->preload || !file)
+    return -1;
+
+  hash  = database_preload_hash (file);
+  entry = database_preload_find (database->preload, file, hash);
+  if (entry && entry->used)
+    return -1;
+
+  if (entry)
+  {
+    *id       = entry->id;
+    *mtime    = entry->mtime;
+    *interrup = entry->interrup;
+    entry->used = 1;
+  }
+  else
+  {
+    *id       = 0;
+    *mtime    = -1;
+    *interrup = 0;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+/*                        Interrupted files handling                          */
+/******************************************************************************/
+
+void
+vh_database_file_interrupted_clear (database_t *database, const char *file)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_INTERRUP_CLEAR);
+
+  if (!file)
+    return;
+
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, file, out);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+void
+vh_database_file_interrupted_fix (database_t *database)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_INTERRUP_FIX);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+int
+vh_database_file_get_interrupted (database_t *database, const char *file)
+{
+  int res, err = -1, val = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_INTERRUP);
+
+  if (!file)
+    return -1;
+
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, file, out);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_ROW)
+    val = sqlite3_column_int (stmt, 0);
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+  err = 0;
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return val;
+}
+
+/******************************************************************************/
+/*                         Outofpath file handling                            */
+/******************************************************************************/
+
+const char *
+vh_database_file_get_outofpath_set (database_t *database, int rst)
+{
+  int res = SQLITE_DONE;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_OUTOFPATH_SET);
+
+  if (!rst)
+  {
+    res = sqlite3_step (stmt);
+    if (res == SQLITE_ROW)
+      return (const char *) sqlite3_column_text (stmt, 0);
+  }
+
+  sqlite3_reset (stmt);
+  if (res != SQLITE_DONE && res != SQLITE_ROW)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+
+  return NULL;
+}
+
+/******************************************************************************/
+/*                       Downloader Contexts handling                         */
+/******************************************************************************/
+
+static void
+database_insert_dlcontext (database_t *database, file_dl_t *dl, int64_t file_id)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_INSERT_DLCONTEXT);
+
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, dl->url,  out);
+  VH_DB_BIND_INT_OR_GOTO   (stmt, 2, dl->dst,  out_clear);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 3, dl->name, out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, file_id,  out_clear);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+void
+vh_database_file_insert_dlcontext (database_t *database, file_data_t *data)
+{
+  file_dl_t *it;
+  int64_t file_id;
+
+  file_id = database_table_get_id (database,
+                                   STMT_GET (STMT_SELECT_FILE_ID),
+                                   data->file.path);
+  if (!file_id)
+    return;
+
+  for (it = data->list_downloader; it; it = it->next)
+    database_insert_dlcontext (database, it, file_id);
+}
+
+void
+vh_database_file_get_dlcontext (database_t *database,
+                                const char *file, file_dl_t **dl)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_DLCONTEXT);
+
+  if (!file || !dl)
     return;
 
   VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, file, out);
@@ -1314,6 +1923,194 @@ vh_database_delete_dlcontext (database_t *database)
     vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
 }
 
+/******************************************************************************/
+/*                           Directories handling                             */
+/******************************************************************************/
+
+/*
+ * These functions are used by the scanner and its walkers, then the SQLite
+ * mutex is held in order to use the statements concurrently with the
+ * dbmanager.
+ */
+int64_t
+vh_database_dir_get_mtime (database_t *database, const char *dir)
+{
+  int res, err = -1;
+  int64_t val = -1;
+  sqlite3_mutex *mutex = sqlite3_db_mutex (database->db);
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_DIR_MTIME);
+
+  if (!dir)
+    return -1;
+
+  sqlite3_mutex_enter (mutex);
+
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, dir, out);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_ROW)
+    val = sqlite3_column_int64 (stmt, 0);
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+  err = 0;
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  sqlite3_mutex_leave (mutex);
+  return val;
+}
+
+char **
+vh_database_dir_get_children (database_t *database, const char *dir)
+{
+  int res, err = -1;
+  unsigned int nb = 0;
+  char **list = NULL;
+  sqlite3_mutex *mutex = sqlite3_db_mutex (database->db);
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_DIR_CHILDREN);
+
+  if (!dir)
+    return NULL;
+
+  sqlite3_mutex_enter (mutex);
+
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, dir, out);
+
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+  {
+    char **tmp;
+    const char *path = (const char *) sqlite3_column_text (stmt, 0);
+
+    if (!path)
+      continue;
+
+    tmp = realloc (list, (nb + 2) * sizeof (*list));
+    if (!tmp)
+      break;
+
+    list = tmp;
+    list[nb] = strdup (path);
+    if (list[nb])
+      nb++;
+    list[nb] = NULL;
+  }
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+  err = 0;
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  sqlite3_mutex_leave (mutex);
+  return list;
+}
+
+void
+vh_database_dir_checked (database_t *database, const char *dir)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_CHECKED_DIR);
+
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, dir,                  out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, database->generation, out_clear);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+static int
+database_dir_cmp (const void *a, const void *b)
+{
+  return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+void
+vh_database_dir_update (database_t *database,
+                        const char *dir, int64_t mtime, char **subdirs)
+{
+  int res, err = -1;
+  unsigned int nb;
+  char **children, **it;
+  sqlite3_stmt *stmt;
+
+  stmt = STMT_GET (STMT_INSERT_DIR);
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, dir, out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, mtime, out_reset);
+  res = sqlite3_step (stmt);
+ out_reset:
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+  if (res != SQLITE_DONE)
+    goto out;
+
+  stmt = STMT_GET (STMT_UPDATE_DIR_MTIME);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 1, mtime, out);
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 2, dir, out_reset2);
+  res = sqlite3_step (stmt);
+ out_reset2:
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+  if (res != SQLITE_DONE)
+    goto out;
+
+  nb = vh_get_list_length (subdirs);
+  if (nb)
+    qsort (subdirs, nb, sizeof (*subdirs), database_dir_cmp);
+
+  /* Forget the sub-directories (and their trees) which have disappeared. */
+  children = vh_database_dir_get_children (database, dir);
+  for (it = children; it && *it; it++)
+  {
+    if (!nb || !bsearch (it, subdirs, nb, sizeof (*subdirs), database_dir_cmp))
+      database_dir_delete (database, STMT_DELETE_DIR_TREE, *it, -1);
+    free (*it);
+  }
+  if (children)
+    free (children);
+
+  /*
+   * The sub-directories are inserted with an unknown mtime (then these are
+   * listed until that their own mtime is saved).
+   */
+  for (it = subdirs; it && *it; it++)
+  {
+    stmt = STMT_GET (STMT_INSERT_DIR);
+    VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, *it, out);
+    VH_DB_BIND_INT64_OR_GOTO (stmt, 2, -1, out_reset3);
+    VH_DB_BIND_TEXT_OR_GOTO (stmt, 3, dir, out_reset3);
+    res = sqlite3_step (stmt);
+   out_reset3:
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+    if (res != SQLITE_DONE)
+      goto out;
+
+    stmt = STMT_GET (STMT_UPDATE_DIR_PARENT);
+    VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, dir, out);
+    VH_DB_BIND_TEXT_OR_GOTO (stmt, 2, *it, out_reset4);
+    res = sqlite3_step (stmt);
+   out_reset4:
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+    if (res != SQLITE_DONE)
+      goto out;
+  }
+
+  err = 0;
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
 /******************************************************************************/
 /*                            INFO table handling                             */
 /******************************************************************************/
@@ -1374,47 +2171,250 @@ database_info_set (database_t *database, const char *name, const char *value)
     vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
 }
 
+#define VH_INFO_DIR_SIGNATURE "vh_dir_signature" /* scanner configuration */
+
+/*
+ * The directories cache is valid only with the same scanner configuration
+ * (paths, recursiveness and suffixes). It is dropped otherwise.
+ */
+void
+vh_database_dir_validate (database_t *database, const char *signature)
+{
+  char *val, *m = NULL;
+
+  if (!signature)
+    return;
+
+  val = database_info_get (database, VH_INFO_DIR_SIGNATURE);
+  if (val && !strcmp (val, signature))
+  {
+    free (val);
+    return;
+  }
+
+  if (val)
+    free (val);
+
+  database_sql_exec (database->db, DELETE_DIR_ALL, NULL, &m);
+  if (m)
+  {
+    vh_log (VALHALLA_MSG_ERROR, "%s", m);
+    free (m);
+    return;
+  }
+
+  database_info_set (database, VH_INFO_DIR_SIGNATURE, signature);
+}
+
+/******************************************************************************/
+/*                                Probe cache                                 */
+/******************************************************************************/
+
+static unsigned int database_param_add (database_params_t *params,
+                                        int type, int64_t val,
+                                        const char *text);
+static int database_select_prepare (database_t *database, const char *sql,
+                                    database_params_t *params,
+                                    valhalla_db_stmt_t *vhstmt);
+
+/*
+ * The lookup is done by the parsers with a reader of the pool (or a cached
+ * statement of the main connection without the WAL journal). The writes are
+ * done only by the dbmanager with vh_database_probe_set().
+ */
+int
+vh_database_probe_get (database_t *database,
+                       const char *file, database_probe_t *probe)
+{
+  int rc, hit = -1;
+  const char *path;
+  const void *tags;
+  valhalla_db_stmt_t *vhstmt;
+  database_params_t params = { NULL, 0, 0 };
+
+  if (!file || !probe)
+    return -1;
+
+  vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
+  if (!vhstmt)
+    return -1;
+
+  database_param_add (&params, SQLITE_INTEGER, probe->dev, NULL);
+  database_param_add (&params, SQLITE_INTEGER, probe->ino, NULL);
+  database_param_add (&params, SQLITE_INTEGER, probe->size, NULL);
+  database_param_add (&params, SQLITE_INTEGER, probe->fp, NULL);
+
+  rc = database_select_prepare (database, SELECT_PROBE, &params, vhstmt);
+  if (params.p)
+    free (params.p);
+  if (rc)
+    goto out;
+
+  if (sqlite3_step (vhstmt->stmt) != SQLITE_ROW)
+    goto out;
+
+  probe->type     = VHSTMT_INT (vhstmt, 0);
+  tags            = sqlite3_column_blob (vhstmt->stmt, 1);
+  probe->tags_len = sqlite3_column_bytes (vhstmt->stmt, 1);
+  probe->tags     = NULL;
+  if (tags && probe->tags_len)
+  {
+    probe->tags = malloc (probe->tags_len);
+    if (probe->tags)
+      memcpy (probe->tags, tags, probe->tags_len);
+    else
+      probe->tags_len = 0;
+  }
+  if (!tags || probe->tags)
+    hit = 0;
+
+  path = VHSTMT_TEXT (vhstmt, 2);
+  probe->moved = path && strcmp (path, file);
+
+ out:
+  database_vhstmt_free (vhstmt);
+  return hit;
+}
+
+/*
+ * Called by the dbmanager with the parsed data. The path is only updated
+ * when a file has been moved or renamed, it is used in order to forget the
+ * entry with the file.
+ */
+void
+vh_database_probe_set (database_t *database,
+                       const char *file, const database_probe_t *probe)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt;
+
+  if (!file || !probe)
+    return;
+
+  if (probe->moved)
+  {
+    stmt = STMT_GET (STMT_UPDATE_PROBE_PATH);
+    VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, file,       out);
+    VH_DB_BIND_INT64_OR_GOTO (stmt, 2, probe->dev, out_clear);
+    VH_DB_BIND_INT64_OR_GOTO (stmt, 3, probe->ino, out_clear);
+  }
+  else
+  {
+    stmt = STMT_GET (STMT_INSERT_PROBE);
+    VH_DB_BIND_INT64_OR_GOTO (stmt, 1, probe->dev,  out);
+    VH_DB_BIND_INT64_OR_GOTO (stmt, 2, probe->ino,  out_clear);
+    VH_DB_BIND_INT64_OR_GOTO (stmt, 3, probe->size, out_clear);
+    VH_DB_BIND_INT64_OR_GOTO (stmt, 4, probe->fp,   out_clear);
+    VH_DB_BIND_INT_OR_GOTO   (stmt, 5, probe->type, out_clear);
+    if (probe->tags && probe->tags_len)
+    {
+      res = sqlite3_bind_blob (stmt, 6, probe->tags,
+                               (int) probe->tags_len, SQLITE_STATIC);
+      if (res != SQLITE_OK)
+        goto out_clear;
+    }
+    VH_DB_BIND_TEXT_OR_GOTO  (stmt, 7, file,        out_clear);
+  }
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
 /******************************************************************************/
 /*                               Main Functions                               */
 /******************************************************************************/
 
-int
-vh_database_cleanup (database_t *database)
+#define DATABASE_CLEANUP_CHUNK  256
+
+/*
+ * Remove a chunk of the orphans. It returns the number of ids checked
+ * (0 when all ids are handled) or -1 on error.
+ */
+static int
+database_cleanup_chunk (database_t *database,
+                        database_stmt_t orphan, database_stmt_t done, int *nb)
 {
-  int res, val, val_tmp, err = -1;
+  int res, err = -1, val = 0;
+  sqlite3_stmt *stmt_o = STMT_GET (orphan);
+  sqlite3_stmt *stmt_d = STMT_GET (done);
 
-  val_tmp = sqlite3_total_changes (database->db);
+  VH_DB_BIND_INT_OR_GOTO (stmt_o, 1, DATABASE_CLEANUP_CHUNK, out);
+  VH_DB_BIND_INT_OR_GOTO (stmt_d, 1, DATABASE_CLEANUP_CHUNK, out);
 
-  res = sqlite3_step (STMT_GET (STMT_CLEANUP_ASSOC_FILE_METADATA));
+  res = sqlite3_step (stmt_o);
   if (res != SQLITE_DONE)
     goto out;
+  *nb += sqlite3_changes (database->db);
 
-  res = sqlite3_step (STMT_GET (STMT_CLEANUP_ASSOC_FILE_GRABBER));
+  res = sqlite3_step (stmt_d);
   if (res != SQLITE_DONE)
     goto out;
+  val = sqlite3_changes (database->db);
 
-  res = sqlite3_step (STMT_GET (STMT_CLEANUP_META));
-  if (res != SQLITE_DONE)
-    goto out;
+  err = 0;
+ out:
+  sqlite3_reset (stmt_o);
+  sqlite3_reset (stmt_d);
+  sqlite3_clear_bindings (stmt_o);
+  sqlite3_clear_bindings (stmt_d);
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return err < 0 ? -1 : val;
+}
 
-  res = sqlite3_step (STMT_GET (STMT_CLEANUP_DATA));
-  if (res != SQLITE_DONE)
-    goto out;
+/*
+ * The ids of meta, data and grabber no longer referenced by the deleted
+ * associations are saved by the triggers. Only these ids are checked, by
+ * chunks and with a commit between the chunks. When the time (in ms) is
+ * elapsed, the next ids are handled with the next call. The function
+ * returns the number of rows removed.
+ */
+int
+vh_database_cleanup (database_t *database, unsigned int timebox)
+{
+  int nb = 0;
+  unsigned int i;
+  uint64_t start, now;
 
-  res = sqlite3_step (STMT_GET (STMT_CLEANUP_GRABBER));
-  if (res == SQLITE_DONE)
-    err = 0;
+  static const database_stmt_t cleanup[][2] = {
+    { STMT_CLEANUP_META,    STMT_CLEANUP_META_DONE    },
+    { STMT_CLEANUP_DATA,    STMT_CLEANUP_DATA_DONE    },
+    { STMT_CLEANUP_GRABBER, STMT_CLEANUP_GRABBER_DONE },
+  };
+
+  VH_TIMERNOW (&start);
+
+  for (i = 0; i < ARRAY_NB_ELEMENTS (cleanup); i++)
+    for (;;)
+    {
+      int res =
+        database_cleanup_chunk (database, cleanup[i][0], cleanup[i][1], &nb);
+      if (res <= 0)
+        break;
+
+      /* Let the readers and the next writes go between the chunks. */
+      vh_database_end_transaction (database);
+      vh_database_begin_transaction (database);
+
+      VH_TIMERNOW (&now);
+      if (timebox && now - start >= (uint64_t) timebox * 1000000)
+        goto out;
+    }
 
  out:
-  val = sqlite3_total_changes (database->db);
-  sqlite3_reset (STMT_GET (STMT_CLEANUP_ASSOC_FILE_METADATA));
-  sqlite3_reset (STMT_GET (STMT_CLEANUP_ASSOC_FILE_GRABBER));
-  sqlite3_reset (STMT_GET (STMT_CLEANUP_META));
-  sqlite3_reset (STMT_GET (STMT_CLEANUP_DATA));
-  sqlite3_reset (STMT_GET (STMT_CLEANUP_GRABBER));
-  if (err < 0)
-    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
-  return val - val_tmp;
+  /* The names removed must not be found in the cache. */
+  if (nb)
+    database_cache_flush (database);
+
+  return nb;
 }
 
 void
@@ -1466,6 +2466,11 @@ database_create_table (database_t *database)
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_DLCONTEXT,           m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_ASSOC_FILE_METADATA, m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_ASSOC_FILE_GRABBER,  m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_DIR,                 m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_CLEANUP_META,        m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_CLEANUP_DATA,        m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_CLEANUP_GRABBER,     m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_PROBE,               m, err);
 
   /* Create indexes */
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_CHECKED,             m, err);
@@ -1474,8 +2479,54 @@ database_create_table (database_t *database)
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_ASSOC,               m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_FK_FILE,             m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_FK_ASSOC,            m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_DIR_PARENT,          m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_ASSOC_DATA,          m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_ASSOC_GRABBER,       m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_FILE_TYPE,           m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_PROBE_PATH,          m, err);
+
+  /* Create triggers */
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TRIGGER_FILE_DELETE,       m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db,
+                       CREATE_TRIGGER_ASSOC_FILE_METADATA_DELETE,      m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db,
+                       CREATE_TRIGGER_ASSOC_FILE_GRABBER_DELETE,       m, err);
+
+  DB_SQL_EXEC_OR_GOTO (database->db, END_TRANSACTION,                  m, err);
+  return;
+
+ err:
+  vh_log (VALHALLA_MSG_ERROR, "%s", m);
+  free (m);
+}
+
+#define VH_INFO_CLEANUP     "vh_cleanup"      /* cleanup tables are filled  */
+
+/*
+ * The cleanup tables are only filled by the triggers. With a database
+ * created before the triggers, all ids must be checked one time.
+ */
+static void
+database_cleanup_seed (database_t *database)
+{
+  char *m = NULL, *val;
+
+  val = database_info_get (database, VH_INFO_CLEANUP);
+  if (val)
+  {
+    free (val);
+    return;
+  }
 
+  DB_SQL_EXEC_OR_GOTO (database->db, BEGIN_TRANSACTION,                m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CLEANUP_ASSOC_FILE_METADATA,      m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CLEANUP_ASSOC_FILE_GRABBER,       m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CLEANUP_SEED_META,                m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CLEANUP_SEED_DATA,                m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CLEANUP_SEED_GRABBER,             m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, END_TRANSACTION,                  m, err);
+
+  database_info_set (database, VH_INFO_CLEANUP, "1");
   return;
 
  err:
@@ -1483,6 +2534,47 @@ database_create_table (database_t *database)
   free (m);
 }
 
+#define VH_INFO_FTS         "vh_fts"          /* full-text index is filled  */
+
+/*
+ * The full-text index is optional because SQLite is not always built with
+ * FTS5. The existing values are indexed one time, then the triggers keep
+ * the index in sync with the table data when the dbmanager writes.
+ */
+static void
+database_fts_init (database_t *database)
+{
+  char *m = NULL, *val;
+
+  DB_SQL_EXEC_OR_GOTO (database->db, BEGIN_TRANSACTION,                m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_DATA_FTS,            m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TRIGGER_DATA_FTS_INSERT,   m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TRIGGER_DATA_FTS_DELETE,   m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TRIGGER_DATA_FTS_UPDATE,   m, err);
+
+  val = database_info_get (database, VH_INFO_FTS);
+  if (val)
+    free (val);
+  else
+  {
+    DB_SQL_EXEC_OR_GOTO (database->db, FTS_REBUILD_DATA,               m, err);
+    database_info_set (database, VH_INFO_FTS, "1");
+  }
+
+  DB_SQL_EXEC_OR_GOTO (database->db, END_TRANSACTION,                  m, err);
+
+  database->fts = 1;
+  return;
+
+ err:
+  vh_log (VALHALLA_MSG_WARNING, "full-text search disabled: %s", m);
+  free (m);
+  m = NULL;
+  database_sql_exec (database->db, ROLLBACK_TRANSACTION, NULL, &m);
+  if (m)
+    free (m);
+}
+
 #define VH_INFO_DB_VERSION  "vh_db_version"   /* LIBVALHALLA_DB_VERSION     */
 
 static int
@@ -1552,6 +2644,211 @@ database_info (database_t *database)
   return 0;
 }
 
+static int
+database_pragma_exec (sqlite3 *db, const char *sql)
+{
+  int res;
+  sqlite3_stmt *stmt = NULL;
+
+  res = sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL);
+  if (res == SQLITE_OK)
+  {
+    /* Some pragmas return the new value. */
+    do
+      res = sqlite3_step (stmt);
+    while (res == SQLITE_ROW);
+  }
+
+  if (res != SQLITE_DONE)
+    vh_log (VALHALLA_MSG_ERROR, "%s: %s", sql, sqlite3_errmsg (db));
+
+  sqlite3_finalize (stmt);
+  return res == SQLITE_DONE ? 0 : -1;
+}
+
+static int
+database_journal_wal (database_t *database)
+{
+  int wal = 0;
+  sqlite3_stmt *stmt;
+
+  if (sqlite3_prepare_v2 (database->db,
+                          "PRAGMA journal_mode;", -1, &stmt, NULL) != SQLITE_OK)
+    return 0;
+
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+  {
+    const char *mode = (const char *) sqlite3_column_text (stmt, 0);
+    wal = mode && !strcasecmp (mode, "wal");
+  }
+
+  sqlite3_finalize (stmt);
+  return wal;
+}
+
+static int
+database_page_size (database_t *database)
+{
+  int size = -1;
+  sqlite3_stmt *stmt;
+
+  if (sqlite3_prepare_v2 (database->db,
+                          "PRAGMA page_size;", -1, &stmt, NULL) != SQLITE_OK)
+    return -1;
+
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    size = sqlite3_column_int (stmt, 0);
+
+  sqlite3_finalize (stmt);
+  return size;
+}
+
+int
+vh_database_pragma (database_t *database, database_pragma_t pragma, int value)
+{
+  int res;
+  char sql[128];
+
+  if (!database)
+    return -1;
+
+  switch (pragma)
+  {
+  case DATABASE_PRAGMA_CACHE_SIZE:
+    snprintf (sql, sizeof (sql), "PRAGMA cache_size = %i;", value);
+    break;
+
+  /* The readers of the pool are used only with the WAL journal. */
+  case DATABASE_PRAGMA_JOURNAL_WAL:
+    snprintf (sql, sizeof (sql),
+              "PRAGMA journal_mode = %s;", value ? "WAL" : "DELETE");
+    res = database_pragma_exec (database->db, sql);
+    pthread_mutex_lock (&database->pool_mutex);
+    database->wal = database_journal_wal (database);
+    pthread_mutex_unlock (&database->pool_mutex);
+    return res;
+
+  /* The value is in MiB. */
+  case DATABASE_PRAGMA_MMAP_SIZE:
+    snprintf (sql, sizeof (sql),
+              "PRAGMA mmap_size = %"PRIi64";", (int64_t) value << 20);
+    break;
+
+  /*
+   * The page size of an existing database is changed only by a VACUUM, and
+   * this one is not possible with the WAL journal.
+   */
+  case DATABASE_PRAGMA_PAGE_SIZE:
+    if (database_page_size (database) == value)
+      return 0;
+    if (database_journal_wal (database))
+    {
+      vh_log (VALHALLA_MSG_WARNING,
+              "The page size can not be changed with the WAL journal");
+      return -1;
+    }
+    snprintf (sql, sizeof (sql), "PRAGMA page_size = %i;", value);
+    res = database_pragma_exec (database->db, sql);
+    if (res)
+      return res;
+    return database_pragma_exec (database->db, "VACUUM;");
+
+  case DATABASE_PRAGMA_SYNCHRONOUS:
+    snprintf (sql, sizeof (sql), "PRAGMA synchronous = %i;", value);
+    break;
+
+  case DATABASE_PRAGMA_TEMP_STORE:
+    snprintf (sql, sizeof (sql), "PRAGMA temp_store = %i;", value);
+    break;
+
+  default:
+    return -1;
+  }
+
+  res = database_pragma_exec (database->db, sql);
+  if (res || pragma == DATABASE_PRAGMA_SYNCHRONOUS)
+    return res;
+
+  /*
+   * cache_size, mmap_size and temp_store are set by connection, then they
+   * are applied on the readers of the pool with their next lease.
+   */
+  pthread_mutex_lock (&database->pool_mutex);
+  snprintf (database->conn_pragma[pragma],
+            sizeof (database->conn_pragma[pragma]), "%s", sql);
+  database->pragma_rev++;
+  pthread_mutex_unlock (&database->pool_mutex);
+  return 0;
+}
+
+/* Build the list of indexes by id; the ids of these tables are small. */
+static void
+database_rev_build (database_rev_t *rev, const int64_t *id, unsigned int nb)
+{
+  unsigned int i;
+  int64_t max = 0;
+
+  for (i = 0; i < nb; i++)
+    if (id[i] > max)
+      max = id[i];
+
+  if (max <= 0 || max >= 65536) /* the linear search is used */
+    return;
+
+  rev->idx = malloc ((size_t) (max + 1) * sizeof (*rev->idx));
+  if (!rev->idx)
+    return;
+
+  rev->nb = (unsigned int) max + 1;
+  for (i = 0; i < rev->nb; i++)
+    rev->idx[i] = -1;
+  for (i = 0; i < nb; i++)
+    if (id[i] > 0)
+      rev->idx[id[i]] = (int) i;
+}
+
+static void
+database_conn_close (database_conn_t *conn, int reader)
+{
+  unsigned int i;
+
+  for (i = 0; i < DATABASE_SELECT_NB; i++)
+  {
+    if (conn->select[i].stmt)
+      sqlite3_finalize (conn->select[i].stmt);
+    if (conn->select[i].sql)
+      free (conn->select[i].sql);
+  }
+  memset (conn->select, 0, sizeof (conn->select));
+
+  if (reader && conn->db)
+    sqlite3_close (conn->db);
+  conn->db = NULL;
+  conn->pragma_rev = 0;
+}
+
+void
+vh_database_readers_set (database_t *database, unsigned int nb)
+{
+  unsigned int i;
+
+  if (!database)
+    return;
+
+  if (nb > DATABASE_READERS_MAX)
+    nb = DATABASE_READERS_MAX;
+
+  pthread_mutex_lock (&database->pool_mutex);
+
+  /* The readers in use are closed with vh_database_uninit(). */
+  for (i = nb + 1; i <= DATABASE_READERS_MAX; i++)
+    if (!database->conn[i].busy)
+      database_conn_close (&database->conn[i], 1);
+
+  database->readers = nb;
+  pthread_mutex_unlock (&database->pool_mutex);
+}
+
 void
 vh_database_uninit (database_t *database)
 {
@@ -1577,6 +2874,23 @@ vh_database_uninit (database_t *database)
     free (database->groups_id);
   if (database->langs_id)
     free (database->langs_id);
+  if (database->file_type_rev.idx)
+    free (database->file_type_rev.idx);
+  if (database->groups_rev.idx)
+    free (database->groups_rev.idx);
+  if (database->langs_rev.idx)
+    free (database->langs_rev.idx);
+
+  vh_database_file_preload_free (database);
+
+  for (i = 0; i <= DATABASE_READERS_MAX; i++)
+    database_conn_close (&database->conn[i], i > 0);
+  pthread_mutex_destroy (&database->pool_mutex);
+
+  database_cache_flush (database);
+  for (i = 0; i < DATABASE_CACHE_NB; i++)
+    if (database->cache[i])
+      free (database->cache[i]);
 
   if (database->db)
     sqlite3_close (database->db);
@@ -1609,6 +2923,9 @@ vh_database_init (const char *path)
   if (!database)
     return NULL;
 
+  pthread_mutex_init (&database->pool_mutex, NULL);
+  database->readers = DATABASE_READERS_DEF;
+
   res = sqlite3_initialize ();
   if (res != SQLITE_OK)
     return NULL;
@@ -1624,11 +2941,15 @@ vh_database_init (const char *path)
   }
 
   database->path = strdup (path);
+  database->conn[0].db = database->db;
+  database->wal = database_journal_wal (database);
 
   if (exists && database_info (database))
     goto err;
 
   database_create_table (database);
+  database_cleanup_seed (database);
+  database_fts_init (database);
 
   res = database_prepare_stmt (database);
   if (res)
@@ -1644,6 +2965,14 @@ vh_database_init (const char *path)
   if (!database->file_type || !database->groups_id || !database->langs_id)
     goto err;
 
+  for (i = 0; i < DATABASE_CACHE_NB; i++)
+  {
+    database->cache[i] =
+      calloc (DATABASE_CACHE_SIZE, sizeof (database_cache_t));
+    if (!database->cache[i])
+      goto err;
+  }
+
   memcpy (database->file_type, g_file_type, sizeof (g_file_type));
 
   for (i = 0; i < ARRAY_NB_ELEMENTS (g_file_type); i++)
@@ -1663,6 +2992,20 @@ vh_database_init (const char *path)
     database->langs_id[i] = database_lang_insert (database, lshort, llong);
   }
 
+  {
+    int64_t type_id[ARRAY_NB_ELEMENTS (g_file_type)];
+
+    for (i = 0; i < ARRAY_NB_ELEMENTS (g_file_type); i++)
+      type_id[i] = database->file_type[i].id;
+
+    database_rev_build (&database->file_type_rev,
+                        type_id, ARRAY_NB_ELEMENTS (g_file_type));
+  }
+  database_rev_build (&database->groups_rev,
+                      database->groups_id, vh_metadata_group_size);
+  database_rev_build (&database->langs_rev,
+                      database->langs_id, vh_metadata_lang_size);
+
   return database;
 
  err:
@@ -1676,51 +3019,230 @@ vh_database_init (const char *path)
 /*                                                                            */
 /******************************************************************************/
 
-#define SQL_CONCAT(sql, str, args...)                   \
-  do                                                    \
-  {                                                     \
-    char buf[256];                                      \
-    sqlite3_snprintf (sizeof (buf), buf, str, ##args);  \
-    if (strlen (sql) + strlen (buf) < SQL_BUFFER)       \
-      strcat (sql, buf);                                \
-  }                                                     \
-  while (0)
+#define SQL_CONCAT(sql, str, args...)                   \
+  do                                                    \
+  {                                                     \
+    char buf[256];                                      \
+    sqlite3_snprintf (sizeof (buf), buf, str, ##args);  \
+    if (strlen (sql) + strlen (buf) < SQL_BUFFER)       \
+      strcat (sql, buf);                                \
+  }                                                     \
+  while (0)
+
+#define SQL_PARAM_INT64(p, v) database_param_add (p, SQLITE_INTEGER, v, NULL)
+#define SQL_PARAM_TEXT(p, v)  database_param_add (p, SQLITE_TEXT, 0, v)
+
+#define SQL_CONCAT_TYPE(sql, p, item, def)                             \
+  do                                                                   \
+  {                                                                    \
+    switch ((item).type)                                               \
+    {                                                                  \
+    case VALHALLA_DB_TYPE_ID:                                          \
+      SQL_CONCAT (sql, SELECT_LIST_WHERE_##def##_ID,                   \
+                  SQL_PARAM_INT64 (p, (item).id));                     \
+      break;                                                           \
+                                                                       \
+    case VALHALLA_DB_TYPE_TEXT:                                        \
+      SQL_CONCAT (sql, SELECT_LIST_WHERE_##def##_NAME,                 \
+                  SQL_PARAM_TEXT (p, (item).text));                    \
+      break;                                                           \
+                                                                       \
+    default:                                                           \
+      break;                                                           \
+    }                                                                  \
+  }                                                                    \
+  while (0)
+
+#define VH_DB_RETURN_SQL_PREPARE(d, s, a, v)    \
+  {                                             \
+    int rc;                                     \
+    rc = database_select_prepare (d, s, &a, v); \
+    if (a.p)                                    \
+      free (a.p);                               \
+    if (rc)                                     \
+    {                                           \
+      database_vhstmt_free (v);                 \
+      return NULL;                              \
+    }                                           \
+    return v;                                   \
+  }
+
+/* Apply the per-connection pragmas set with vh_database_pragma(). */
+static void
+database_conn_pragma (database_t *database, database_conn_t *conn)
+{
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_NB_ELEMENTS (database->conn_pragma); i++)
+    if (*database->conn_pragma[i])
+      database_pragma_exec (conn->db, database->conn_pragma[i]);
+
+  conn->pragma_rev = database->pragma_rev;
+}
+
+/*
+ * Lease an idle reader of the pool (opened on demand), else the main
+ * connection is used like before. The pool mutex must be held.
+ */
+static database_conn_t *
+database_conn_lease (database_t *database)
+{
+  unsigned int i;
+
+  if (!database->wal)
+    return &database->conn[0];
+
+  for (i = 1; i <= database->readers; i++)
+  {
+    int res;
+    database_conn_t *conn = &database->conn[i];
+
+    if (conn->busy)
+      continue;
+
+    if (!conn->db)
+    {
+      res = sqlite3_open_v2 (database->path, &conn->db,
+                             SQLITE_OPEN_READONLY, NULL);
+      if (res != SQLITE_OK)
+      {
+        vh_log (VALHALLA_MSG_WARNING,
+                "Can't open reader: %s", sqlite3_errmsg (conn->db));
+        sqlite3_close (conn->db);
+        conn->db = NULL;
+        break;
+      }
+
+      sqlite3_busy_timeout (conn->db, 1000);
+    }
+
+    if (conn->pragma_rev != database->pragma_rev)
+      database_conn_pragma (database, conn);
+
+    conn->busy = 1;
+    return conn;
+  }
+
+  return &database->conn[0];
+}
+
+/*
+ * Add a value to bind and return its parameter number. 0 is returned on
+ * error, then the preparation fails because ?0 is refused by SQLite.
+ */
+static unsigned int
+database_param_add (database_params_t *params,
+                    int type, int64_t val, const char *text)
+{
+  database_param_t *param;
+
+  if (params->nb == params->max)
+  {
+    unsigned int max = params->max ? 2 * params->max : 16;
+    database_param_t *tmp = realloc (params->p, max * sizeof (*tmp));
+
+    if (!tmp)
+      return 0;
+
+    params->p   = tmp;
+    params->max = max;
+  }
+
+  param = &params->p[params->nb];
+  param->type = type;
+  param->val  = val;
+  param->text = text;
+  return ++params->nb;
+}
+
+/*
+ * Retrieve a statement for the query shape in the cache (or prepare it in
+ * place of the least recently used one) and bind the values. When every
+ * statement is busy, a statement out of the cache is prepared.
+ */
+static int
+database_select_prepare (database_t *database, const char *sql,
+                         database_params_t *params, valhalla_db_stmt_t *vhstmt)
+{
+  int rc = SQLITE_OK;
+  unsigned int i, hash;
+  database_conn_t *conn;
+  database_select_t *select = NULL, *older = NULL;
+
+  vhstmt->sql = strdup (sql);
+  if (!vhstmt->sql)
+    return -1;
+
+  hash = database_cache_hash (sql);
+
+  pthread_mutex_lock (&database->pool_mutex);
+
+  conn = database_conn_lease (database);
+  vhstmt->database = database;
+  vhstmt->conn     = conn != &database->conn[0] ? conn : NULL;
+
+  for (i = 0; i < DATABASE_SELECT_NB; i++)
+  {
+    database_select_t *it = &conn->select[i];
+
+    if (it->busy)
+      continue;
+
+    if (it->sql && it->hash == hash && !strcmp (it->sql, sql))
+    {
+      select = it;
+      break;
+    }
+
+    if (!older || (older->sql && (!it->sql || it->lru < older->lru)))
+      older = it;
+  }
 
-#define SQL_CONCAT_TYPE(sql, item, def)                              \
-  do                                                                 \
-  {                                                                  \
-    switch ((item).type)                                             \
-    {                                                                \
-    case VALHALLA_DB_TYPE_ID:                                        \
-      SQL_CONCAT (sql, SELECT_LIST_WHERE_##def##_ID, (item).id);     \
-      break;                                                         \
-                                                                     \
-    case VALHALLA_DB_TYPE_TEXT:                                      \
-      SQL_CONCAT (sql, SELECT_LIST_WHERE_##def##_NAME, (item).text); \
-      break;                                                         \
-                                                                     \
-    default:                                                         \
-      break;                                                         \
-    }                                                                \
-  }                                                                  \
-  while (0)
+  if (!select && older)
+  {
+    if (older->stmt)
+      sqlite3_finalize (older->stmt);
+    if (older->sql)
+      free (older->sql);
+    memset (older, 0, sizeof (*older));
+
+    database_query_plan (database, sql);
+    rc = sqlite3_prepare_v2 (conn->db, sql, -1, &older->stmt, NULL);
+    if (rc == SQLITE_OK)
+    {
+      older->hash = hash;
+      older->sql  = strdup (sql);
+      select      = older;
+    }
+  }
 
-#define VH_DB_RETURN_SQL_PREPARE(d, s, v)                         \
-  {                                                               \
-    int rc;                                                       \
-    database_query_plan (d, s);                                   \
-    v->sql = strdup (s);                                          \
-    rc = sqlite3_prepare_v2 (d->db, v->sql, -1, &v->stmt, NULL);  \
-    if (rc != SQLITE_OK)                                          \
-    {                                                             \
-      vh_log (VALHALLA_MSG_ERROR,                                 \
-              "%s - query: %s", sqlite3_errmsg (d->db), s);       \
-      database_vhstmt_free (v);                                   \
-      return NULL;                                                \
-    }                                                             \
-    return v;                                                     \
+  if (select)
+  {
+    select->busy   = 1;
+    select->lru    = ++conn->select_tick;
+    vhstmt->select = select;
+    vhstmt->stmt   = select->stmt;
+  }
+  else if (rc == SQLITE_OK)
+  {
+    database_query_plan (database, sql);
+    rc = sqlite3_prepare_v2 (conn->db, sql, -1, &vhstmt->stmt, NULL);
   }
 
+  for (i = 0; rc == SQLITE_OK && i < params->nb; i++)
+    rc = params->p[i].type == SQLITE_TEXT
+         ? sqlite3_bind_text (vhstmt->stmt, i + 1,
+                              params->p[i].text, -1, SQLITE_TRANSIENT)
+         : sqlite3_bind_int64 (vhstmt->stmt, i + 1, params->p[i].val);
+
+  if (rc != SQLITE_OK)
+    vh_log (VALHALLA_MSG_ERROR,
+            "%s - query: %s", sqlite3_errmsg (conn->db), sql);
+
+  pthread_mutex_unlock (&database->pool_mutex);
+  return rc == SQLITE_OK ? 0 : -1;
+}
+
 static inline int
 database_sql_vhstmt (sqlite3 *db, valhalla_db_stmt_t *vhstmt)
 {
@@ -1730,6 +3252,9 @@ database_sql_vhstmt (sqlite3 *db, valhalla_db_stmt_t *vhstmt)
 
   vh_log (verb, "query: %s", vhstmt->sql);
 
+  if (vhstmt->conn)
+    db = vhstmt->conn->db;
+
   rc = database_sql_exec (db, vhstmt->sql, vhstmt, &msg);
   if (msg)
   {
@@ -1744,13 +3269,13 @@ database_sql_vhstmt (sqlite3 *db, valhalla_db_stmt_t *vhstmt)
 static inline void
 database_list_get_restriction_common (database_t *database,
                                       valhalla_db_restrict_t *restriction,
-                                      char *sql)
+                                      char *sql, database_params_t *params)
 {
-  SQL_CONCAT_TYPE (sql, restriction->meta, META);
+  SQL_CONCAT_TYPE (sql, params, restriction->meta, META);
   if (restriction->data.text || restriction->data.id)
   {
     SQL_CONCAT (sql, SELECT_LIST_AND);
-    SQL_CONCAT_TYPE (sql, restriction->data, DATA);
+    SQL_CONCAT_TYPE (sql, params, restriction->data, DATA);
   }
 
   if (restriction->data.lang >= 0)
@@ -1759,17 +3284,19 @@ database_list_get_restriction_common (database_t *database,
 
     lang_id = database_langid_get (database, restriction->data.lang);
     SQL_CONCAT (sql, SELECT_LIST_AND);
-    SQL_CONCAT (sql, SELECT_LIST_WHERE_LANG_ID, lang_id);
+    SQL_CONCAT (sql, SELECT_LIST_WHERE_LANG_ID,
+                SQL_PARAM_INT64 (params, lang_id));
   }
 
   SQL_CONCAT (sql, SELECT_LIST_AND);
-  SQL_CONCAT (sql, SELECT_LIST_WHERE_PRIORITY, restriction->meta.priority);
+  SQL_CONCAT (sql, SELECT_LIST_WHERE_PRIORITY,
+              SQL_PARAM_INT64 (params, restriction->meta.priority));
 }
 
 static void
 database_list_get_restriction_sub (database_t *database,
                                    valhalla_db_restrict_t *restriction,
-                                   char *sql)
+                                   char *sql, database_params_t *params)
 {
   /* sub-query */
   switch (restriction->op)
@@ -1791,7 +3318,7 @@ database_list_get_restriction_sub (database_t *database,
   /* sub-where */
   SQL_CONCAT (sql, SELECT_LIST_WHERE);
 
-  database_list_get_restriction_common (database, restriction, sql);
+  database_list_get_restriction_common (database, restriction, sql, params);
 
   /* sub-end */
   SQL_CONCAT (sql, SELECT_LIST_WHERE_SUB_END);
@@ -1800,21 +3327,23 @@ database_list_get_restriction_sub (database_t *database,
 static void
 database_list_get_restriction_equal (database_t *database,
                                      valhalla_db_restrict_t *restriction,
-                                     char *sql, int equal)
+                                     char *sql, database_params_t *params,
+                                     int equal)
 {
   if (equal)
     SQL_CONCAT (sql, SELECT_LIST_OR);
 
   SQL_CONCAT (sql, "( ");
 
-  database_list_get_restriction_common (database, restriction, sql);
+  database_list_get_restriction_common (database, restriction, sql, params);
 
   SQL_CONCAT (sql, ") ");
 }
 
 static void
 database_list_get_restriction (database_t *database,
-                               valhalla_db_restrict_t *restriction, char *sql)
+                               valhalla_db_restrict_t *restriction,
+                               char *sql, database_params_t *params)
 {
   int equal = 0, restr = 0;
   char sql_tmp[SQL_BUFFER] = "( ";
@@ -1828,13 +3357,13 @@ database_list_get_restriction (database_t *database,
     {
     case VALHALLA_DB_OPERATOR_IN:
     case VALHALLA_DB_OPERATOR_NOTIN:
-      database_list_get_restriction_sub (database, restriction, sql);
+      database_list_get_restriction_sub (database, restriction, sql, params);
       restr = 1;
       break;
 
     case VALHALLA_DB_OPERATOR_EQUAL:
-      database_list_get_restriction_equal (database,
-                                           restriction, sql_tmp, equal);
+      database_list_get_restriction_equal (database, restriction,
+                                           sql_tmp, params, equal);
       equal = 1;
       break;
 
@@ -1870,50 +3399,30 @@ vh_database_metalist_read (database_t *database, valhalla_db_stmt_t *vhstmt)
   if (vhstmt->cnt != 7)
     goto err;
 
-  metares->meta_id    = (int64_t) strtoimax (vhstmt->cols[0], NULL, 10);
-  metares->meta_name  = vhstmt->cols[2];
-  metares->data_id    = (int64_t) strtoimax (vhstmt->cols[1], NULL, 10);
-  metares->data_value = vhstmt->cols[3];
-  metares->external   = (int)     strtol    (vhstmt->cols[6], NULL, 10);
+  metares->meta_id    = VHSTMT_INT64 (vhstmt, 0);
+  metares->meta_name  = VHSTMT_TEXT  (vhstmt, 2);
+  metares->data_id    = VHSTMT_INT64 (vhstmt, 1);
+  metares->data_value = VHSTMT_TEXT  (vhstmt, 3);
+  metares->external   = VHSTMT_INT   (vhstmt, 6);
   metares->group      =
-    database_group_get (database,
-                        (int64_t) strtoimax (vhstmt->cols[5], NULL, 10));
+    database_group_get (database, VHSTMT_INT64 (vhstmt, 5));
   metares->lang       =
-    database_lang_get  (database,
-                        (int64_t) strtoimax (vhstmt->cols[4], NULL, 10));
+    database_lang_get  (database, VHSTMT_INT64 (vhstmt, 4));
 
   return metares;
 
  err:
-  sqlite3_finalize (vhstmt->stmt);
   database_vhstmt_free (vhstmt);
   return NULL;
 }
 
-valhalla_db_stmt_t *
-vh_database_metalist_get (database_t *database,
-                          valhalla_db_item_t *search,
-                          valhalla_file_type_t filetype,
-                          valhalla_db_restrict_t *restriction)
+static void
+database_metalist_sql (database_t *database,
+                       char *sql, database_params_t *params,
+                       valhalla_db_item_t *search,
+                       valhalla_file_type_t filetype,
+                       valhalla_db_restrict_t *restriction)
 {
-  valhalla_db_stmt_t *vhstmt;
-  /*
-   * SELECT meta.meta_id, data.data_id,
-   *        meta.meta_name, data.data_value,
-   *        data._lang_id,
-   *        assoc._grp_id, assoc.external
-   * FROM (
-   *   data INNER JOIN assoc_file_metadata AS assoc
-   *   ON data.data_id = assoc.data_id
-   * ) INNER JOIN meta
-   * ON assoc.meta_id = meta.meta_id
-   */
-  char sql[SQL_BUFFER] = SELECT_LIST_METADATA_FROM;
-
-  vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
-  if (!vhstmt)
-    return NULL;
-
   /* WHERE */
   SQL_CONCAT (sql, SELECT_LIST_WHERE);
 
@@ -1927,8 +3436,10 @@ vh_database_metalist_get (database_t *database,
    */
   if (filetype)
   {
+    int64_t type_id = database_file_typeid_get (database, filetype);
+
     SQL_CONCAT (sql, SELECT_LIST_METADATA_WHERE_TYPE_ID,
-                database_file_typeid_get (database, filetype));
+                SQL_PARAM_INT64 (params, type_id));
     /* AND */
     if (restriction || search->id || search->text)
       SQL_CONCAT (sql, SELECT_LIST_AND);
@@ -1953,7 +3464,7 @@ vh_database_metalist_get (database_t *database,
    */
   if (restriction)
   {
-    database_list_get_restriction (database, restriction, sql);
+    database_list_get_restriction (database, restriction, sql, params);
     /* AND */
     if (search->id || search->text)
       SQL_CONCAT (sql, SELECT_LIST_AND);
@@ -1963,15 +3474,17 @@ vh_database_metalist_get (database_t *database,
    * -- Metadata and/or group to list in the results.
    * meta.<meta_id|meta_name> = <ID|"TEXT">
    */
-  SQL_CONCAT_TYPE (sql, *search, META);
+  SQL_CONCAT_TYPE (sql, params, *search, META);
   if (search->group)
   {
+    int64_t grp_id = database_groupid_get (database, search->group);
+
     /* AND */
     if (search->id || search->text)
       SQL_CONCAT (sql, SELECT_LIST_AND);
     /* assoc._grp_id = <ID> */
     SQL_CONCAT (sql, SELECT_LIST_WHERE_GROUP_ID,
-                database_groupid_get (database, search->group));
+                SQL_PARAM_INT64 (params, grp_id));
   }
   if (search->lang >= 0)
   {
@@ -1980,22 +3493,73 @@ vh_database_metalist_get (database_t *database,
       SQL_CONCAT (sql, SELECT_LIST_AND);
     /* data._lang_id = <ID> */
     SQL_CONCAT (sql, SELECT_LIST_WHERE_LANG_ID,
-                database_langid_get (database, search->lang));
+                SQL_PARAM_INT64 (params,
+                                 database_langid_get (database, search->lang)));
   }
   /* AND */
   if (search->group || search->id || search->text || restriction
       || search->lang >= 0)
     SQL_CONCAT (sql, SELECT_LIST_AND);
   /* assoc.priority__ <= <PRIORITY> */
-  SQL_CONCAT (sql, SELECT_LIST_WHERE_PRIORITY, search->priority);
+  SQL_CONCAT (sql, SELECT_LIST_WHERE_PRIORITY,
+              SQL_PARAM_INT64 (params, search->priority));
+}
+
+valhalla_db_stmt_t *
+vh_database_metalist_get (database_t *database,
+                          valhalla_db_item_t *search,
+                          valhalla_file_type_t filetype,
+                          valhalla_db_restrict_t *restriction,
+                          const valhalla_db_metares_t *after,
+                          unsigned int limit)
+{
+  valhalla_db_stmt_t *vhstmt;
+  /*
+   * SELECT meta.meta_id, data.data_id,
+   *        meta.meta_name, data.data_value,
+   *        data._lang_id,
+   *        assoc._grp_id, assoc.external
+   * FROM (
+   *   data INNER JOIN assoc_file_metadata AS assoc
+   *   ON data.data_id = assoc.data_id
+   * ) INNER JOIN meta
+   * ON assoc.meta_id = meta.meta_id
+   */
+  char sql[SQL_BUFFER] = SELECT_LIST_METADATA_FROM;
+  database_params_t params = { NULL, 0, 0 };
+
+  vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
+  if (!vhstmt)
+    return NULL;
+
+  database_metalist_sql (database, sql, &params,
+                         search, filetype, restriction);
+
+  /*
+   * -- Next page.
+   * AND (data.data_value > <"TEXT">
+   *      OR (data.data_value = <"TEXT"> AND assoc.meta_id > <ID>))
+   */
+  if (after && after->data_value)
+  {
+    unsigned int value = SQL_PARAM_TEXT (&params, after->data_value);
+
+    SQL_CONCAT (sql, SELECT_LIST_AND);
+    SQL_CONCAT (sql, SELECT_LIST_METADATA_AFTER, value, value,
+                SQL_PARAM_INT64 (&params, after->meta_id));
+  }
 
   /*
    * GROUP BY assoc.meta_id, assoc.data_id
-   * ORDER BY data.data_value;
+   * ORDER BY data.data_value, assoc.meta_id
+   * <LIMIT <LIMIT>>;
    */
   SQL_CONCAT (sql, SELECT_LIST_METADATA_END);
+  if (limit)
+    SQL_CONCAT (sql, SELECT_LIST_LIMIT, SQL_PARAM_INT64 (&params, limit));
+  SQL_CONCAT (sql, ";");
 
-  VH_DB_RETURN_SQL_PREPARE (database, sql, vhstmt)
+  VH_DB_RETURN_SQL_PREPARE (database, sql, params, vhstmt)
 }
 
 const valhalla_db_fileres_t *
@@ -2011,38 +3575,26 @@ vh_database_filelist_read (database_t *database, valhalla_db_stmt_t *vhstmt)
   if (vhstmt->cnt != 3)
     goto err;
 
-  fileres->id   = (int64_t) strtoimax (vhstmt->cols[0], NULL, 10);
-  fileres->path = vhstmt->cols[1];
+  fileres->id   = VHSTMT_INT64 (vhstmt, 0);
+  fileres->path = VHSTMT_TEXT  (vhstmt, 1);
   fileres->type =
-    database_file_type_get (database,
-                            (int64_t) strtoimax (vhstmt->cols[2], NULL, 10));
+    database_file_type_get (database, VHSTMT_INT64 (vhstmt, 2));
 
   return fileres;
 
  err:
-  sqlite3_finalize (vhstmt->stmt);
   database_vhstmt_free (vhstmt);
   return NULL;
 }
 
-valhalla_db_stmt_t *
-vh_database_filelist_get (database_t *database,
-                          valhalla_file_type_t filetype,
-                          valhalla_db_restrict_t *restriction)
+static void
+database_filelist_sql (database_t *database,
+                       char *sql, database_params_t *params,
+                       valhalla_file_type_t filetype,
+                       valhalla_db_restrict_t *restriction, int64_t after)
 {
-  valhalla_db_stmt_t *vhstmt;
-  /*
-   * SELECT file_id, file_path, _type_id
-   * FROM file AS assoc
-   */
-  char sql[SQL_BUFFER] = SELECT_LIST_FILE_FROM;
-
-  vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
-  if (!vhstmt)
-    return NULL;
-
   /* WHERE */
-  if (restriction || filetype)
+  if (restriction || filetype || after)
     SQL_CONCAT (sql, SELECT_LIST_WHERE);
 
   /*
@@ -2063,22 +3615,59 @@ vh_database_filelist_get (database_t *database,
    * <AND>
    */
   if (restriction)
-    database_list_get_restriction (database, restriction, sql);
+    database_list_get_restriction (database, restriction, sql, params);
 
   if (filetype)
   {
+    int64_t type_id = database_file_typeid_get (database, filetype);
+
     /* AND */
     if (restriction)
       SQL_CONCAT (sql, SELECT_LIST_AND);
     /* _type_id = <ID> */
     SQL_CONCAT (sql, SELECT_LIST_WHERE_TYPE_ID,
-                database_file_typeid_get (database, filetype));
+                SQL_PARAM_INT64 (params, type_id));
+  }
+
+  /* -- Next page. */
+  if (after)
+  {
+    /* AND */
+    if (restriction || filetype)
+      SQL_CONCAT (sql, SELECT_LIST_AND);
+    /* file_id > <ID> */
+    SQL_CONCAT (sql, SELECT_LIST_FILE_AFTER, SQL_PARAM_INT64 (params, after));
   }
+}
+
+valhalla_db_stmt_t *
+vh_database_filelist_get (database_t *database,
+                          valhalla_file_type_t filetype,
+                          valhalla_db_restrict_t *restriction,
+                          int64_t after, unsigned int limit)
+{
+  valhalla_db_stmt_t *vhstmt;
+  /*
+   * SELECT file_id, file_path, _type_id
+   * FROM file AS assoc
+   */
+  char sql[SQL_BUFFER] = SELECT_LIST_FILE_FROM;
+  database_params_t params = { NULL, 0, 0 };
+
+  vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
+  if (!vhstmt)
+    return NULL;
 
-  /* ORDER BY file_id; */
+  database_filelist_sql (database, sql, &params,
+                         filetype, restriction, after);
+
+  /* ORDER BY file_id <LIMIT <LIMIT>>; */
   SQL_CONCAT (sql, SELECT_LIST_FILE_END);
+  if (limit)
+    SQL_CONCAT (sql, SELECT_LIST_LIMIT, SQL_PARAM_INT64 (&params, limit));
+  SQL_CONCAT (sql, ";");
 
-  VH_DB_RETURN_SQL_PREPARE (database, sql, vhstmt)
+  VH_DB_RETURN_SQL_PREPARE (database, sql, params, vhstmt)
 }
 
 const valhalla_db_metares_t *
@@ -2094,22 +3683,19 @@ vh_database_file_read (database_t *database, valhalla_db_stmt_t *vhstmt)
   if (vhstmt->cnt != 8)
     goto err;
 
-  metares->meta_id    = (int64_t) strtoimax (vhstmt->cols[2], NULL, 10);
-  metares->meta_name  = vhstmt->cols[4];
-  metares->data_id    = (int64_t) strtoimax (vhstmt->cols[3], NULL, 10);
-  metares->data_value = vhstmt->cols[5];
-  metares->external   = (int)     strtol    (vhstmt->cols[7], NULL, 10);
+  metares->meta_id    = VHSTMT_INT64 (vhstmt, 2);
+  metares->meta_name  = VHSTMT_TEXT  (vhstmt, 4);
+  metares->data_id    = VHSTMT_INT64 (vhstmt, 3);
+  metares->data_value = VHSTMT_TEXT  (vhstmt, 5);
+  metares->external   = VHSTMT_INT   (vhstmt, 7);
   metares->group      =
-    database_group_get (database,
-                        (int64_t) strtoimax (vhstmt->cols[1], NULL, 10));
+    database_group_get (database, VHSTMT_INT64 (vhstmt, 1));
   metares->lang       =
-    database_lang_get  (database,
-                        (int64_t) strtoimax (vhstmt->cols[6], NULL, 10));
+    database_lang_get  (database, VHSTMT_INT64 (vhstmt, 6));
 
   return metares;
 
  err:
-  sqlite3_finalize (vhstmt->stmt);
   database_vhstmt_free (vhstmt);
   return NULL;
 }
@@ -2134,6 +3720,7 @@ vh_database_file_get (database_t *database,
    * ON assoc.meta_id = meta.meta_id
    */
   char sql[SQL_BUFFER] = SELECT_FILE_FROM;
+  database_params_t params = { NULL, 0, 0 };
 
   vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
   if (!vhstmt)
@@ -2157,18 +3744,21 @@ vh_database_file_get (database_t *database,
    */
   if (restriction)
   {
-    database_list_get_restriction (database, restriction, sql);
+    database_list_get_restriction (database, restriction, sql, &params);
     /* AND */
     SQL_CONCAT (sql, SELECT_LIST_AND);
   }
 
   /* file.<file_id|file_path> = <ID|"PATH"> */
   if (id)
-    SQL_CONCAT (sql, SELECT_FILE_WHERE_FILE_ID, id);
+    SQL_CONCAT (sql, SELECT_FILE_WHERE_FILE_ID, SQL_PARAM_INT64 (&params, id));
   else if (path)
-    SQL_CONCAT (sql, SELECT_FILE_WHERE_FILE_PATH, path);
+    SQL_CONCAT (sql, SELECT_FILE_WHERE_FILE_PATH,
+                SQL_PARAM_TEXT (&params, path));
   else
   {
+    if (params.p)
+      free (params.p);
     database_vhstmt_free (vhstmt);
     return NULL;
   }
@@ -2176,7 +3766,272 @@ vh_database_file_get (database_t *database,
   /* ORDER BY assoc.priority__; */
   SQL_CONCAT (sql, SELECT_FILE_END);
 
-  VH_DB_RETURN_SQL_PREPARE (database, sql, vhstmt)
+  VH_DB_RETURN_SQL_PREPARE (database, sql, params, vhstmt)
+}
+
+int64_t
+vh_database_count (database_t *database,
+                   valhalla_file_type_t filetype,
+                   valhalla_db_restrict_t *restriction)
+{
+  int rc;
+  int64_t count;
+  valhalla_db_stmt_t *vhstmt;
+  /*
+   * SELECT COUNT(*)
+   * FROM file AS assoc
+   */
+  char sql[SQL_BUFFER] = SELECT_COUNT_FILE_FROM;
+  database_params_t params = { NULL, 0, 0 };
+
+  vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
+  if (!vhstmt)
+    return -1;
+
+  /* Same conditions as vh_database_filelist_get(). */
+  database_filelist_sql (database, sql, &params, filetype, restriction, 0);
+  SQL_CONCAT (sql, ";");
+
+  rc = database_select_prepare (database, sql, &params, vhstmt);
+  if (params.p)
+    free (params.p);
+  if (rc)
+  {
+    database_vhstmt_free (vhstmt);
+    return -1;
+  }
+
+  rc = database_sql_vhstmt (database->db, vhstmt);
+  if (rc) /* the statement is already freed */
+    return -1;
+
+  count = VHSTMT_INT64 (vhstmt, 0);
+  database_vhstmt_free (vhstmt);
+  return count;
+}
+
+const valhalla_db_countres_t *
+vh_database_count_read (database_t *database, valhalla_db_stmt_t *vhstmt)
+{
+  int rc;
+  valhalla_db_countres_t *countres = &vhstmt->u.countres;
+
+  rc = database_sql_vhstmt (database->db, vhstmt);
+  if (rc) /* no more row */
+    return NULL;
+
+  memset (countres, 0, sizeof (*countres));
+
+  switch (vhstmt->cnt)
+  {
+  case 2: /* by file type */
+    countres->type  =
+      database_file_type_get (database, VHSTMT_INT64 (vhstmt, 0));
+    countres->count = VHSTMT_INT64 (vhstmt, 1);
+    break;
+
+  case 5: /* by metadata */
+    countres->meta_id    = VHSTMT_INT64 (vhstmt, 0);
+    countres->data_id    = VHSTMT_INT64 (vhstmt, 1);
+    countres->meta_name  = VHSTMT_TEXT  (vhstmt, 2);
+    countres->data_value = VHSTMT_TEXT  (vhstmt, 3);
+    countres->count      = VHSTMT_INT64 (vhstmt, 4);
+    break;
+
+  default:
+    goto err;
+  }
+
+  return countres;
+
+ err:
+  database_vhstmt_free (vhstmt);
+  return NULL;
+}
+
+valhalla_db_stmt_t *
+vh_database_count_get (database_t *database,
+                       valhalla_db_item_t *search,
+                       valhalla_file_type_t filetype,
+                       valhalla_db_restrict_t *restriction)
+{
+  valhalla_db_stmt_t *vhstmt;
+  char sql[SQL_BUFFER];
+  database_params_t params = { NULL, 0, 0 };
+
+  vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
+  if (!vhstmt)
+    return NULL;
+
+  if (!search)
+  {
+    /*
+     * SELECT _type_id, COUNT(*)
+     * FROM file AS assoc
+     * WHERE ...
+     * GROUP BY _type_id
+     * ORDER BY _type_id;
+     */
+    strcpy (sql, SELECT_COUNT_TYPE_FROM);
+    database_filelist_sql (database, sql, &params, filetype, restriction, 0);
+    SQL_CONCAT (sql, SELECT_COUNT_TYPE_END);
+  }
+  else
+  {
+    /*
+     * SELECT meta.meta_id, data.data_id,
+     *        meta.meta_name, data.data_value,
+     *        COUNT(DISTINCT assoc.file_id)
+     * FROM (
+     *   data INNER JOIN assoc_file_metadata AS assoc
+     *   ON data.data_id = assoc.data_id
+     * ) INNER JOIN meta
+     * ON assoc.meta_id = meta.meta_id
+     * WHERE ...
+     * GROUP BY assoc.meta_id, assoc.data_id
+     * ORDER BY data.data_value, assoc.meta_id;
+     */
+    strcpy (sql, SELECT_COUNT_METADATA_FROM);
+    database_metalist_sql (database, sql, &params,
+                           search, filetype, restriction);
+    SQL_CONCAT (sql, SELECT_LIST_METADATA_END);
+    SQL_CONCAT (sql, ";");
+  }
+
+  VH_DB_RETURN_SQL_PREPARE (database, sql, params, vhstmt)
+}
+
+/*
+ * Convert the text typed by the user in a FTS5 query. Every word is quoted
+ * (no FTS5 syntax from the user) and used as a prefix: "the be" becomes
+ * "the"* "be"* where all words must be found.
+ */
+static char *
+database_search_query (const char *text)
+{
+  char *query, *it;
+  int word = 0;
+
+  query = malloc (4 * strlen (text) + 8);
+  if (!query)
+    return NULL;
+
+  for (it = query; *text; text++)
+  {
+    if (isspace ((unsigned char) *text))
+    {
+      if (word)
+      {
+        strcpy (it, "\"* ");
+        it += 3;
+        word = 0;
+      }
+      continue;
+    }
+
+    if (!word)
+    {
+      *it++ = '"';
+      word = 1;
+    }
+
+    if (*text == '"')
+      *it++ = '"';
+    *it++ = *text;
+  }
+
+  if (word)
+  {
+    strcpy (it, "\"*");
+    it += 2;
+  }
+  *it = '\0';
+
+  if (it == query) /* only spaces */
+  {
+    free (query);
+    return NULL;
+  }
+
+  return query;
+}
+
+valhalla_db_stmt_t *
+vh_database_search (database_t *database, const char *text, const char *meta,
+                    valhalla_file_type_t filetype, unsigned int limit)
+{
+  int rc;
+  char *query;
+  valhalla_db_stmt_t *vhstmt;
+  char sql[SQL_BUFFER] = "";
+  database_params_t params = { NULL, 0, 0 };
+
+  if (!database->fts || !text)
+    return NULL;
+
+  query = database_search_query (text);
+  if (!query)
+    return NULL;
+
+  vhstmt = calloc (1, sizeof (valhalla_db_stmt_t));
+  if (!vhstmt)
+  {
+    free (query);
+    return NULL;
+  }
+
+  /*
+   * SELECT file.file_id, file.file_path, file._type_id
+   * FROM (
+   *   SELECT assoc.file_id AS file_id, MIN(data_fts.rank) AS rank
+   *   FROM data_fts INNER JOIN assoc_file_metadata AS assoc
+   *   ON assoc.data_id = data_fts.rowid
+   *   WHERE data_fts MATCH <"QUERY">
+   */
+  SQL_CONCAT (sql, SELECT_SEARCH_FROM, SQL_PARAM_TEXT (&params, query));
+
+  /*
+   *     AND assoc.meta_id IN (
+   *       SELECT meta_id FROM meta WHERE meta_name = <"TEXT">
+   *     )
+   */
+  if (meta)
+    SQL_CONCAT (sql, SELECT_SEARCH_WHERE_META, SQL_PARAM_TEXT (&params, meta));
+
+  /*
+   *   GROUP BY assoc.file_id
+   * ) AS res INNER JOIN file
+   * ON file.file_id = res.file_id
+   */
+  SQL_CONCAT (sql, SELECT_SEARCH_GROUP);
+
+  /* WHERE file._type_id = <ID> */
+  if (filetype)
+  {
+    int64_t type_id = database_file_typeid_get (database, filetype);
+
+    SQL_CONCAT (sql, SELECT_SEARCH_WHERE_TYPE_ID,
+                SQL_PARAM_INT64 (&params, type_id));
+  }
+
+  /* ORDER BY res.rank, file.file_id <LIMIT <LIMIT>>; */
+  SQL_CONCAT (sql, SELECT_SEARCH_END);
+  if (limit)
+    SQL_CONCAT (sql, SELECT_LIST_LIMIT, SQL_PARAM_INT64 (&params, limit));
+  SQL_CONCAT (sql, ";");
+
+  /* The query is copied by the binding. */
+  rc = database_select_prepare (database, sql, &params, vhstmt);
+  free (query);
+  if (params.p)
+    free (params.p);
+  if (rc)
+  {
+    database_vhstmt_free (vhstmt);
+    return NULL;
+  }
+
+  return vhstmt;
 }
 
 /******************************************************************************/
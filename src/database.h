@@ -27,6 +27,25 @@
 
 typedef struct database_s database_t;
 
+typedef enum database_pragma {
+  DATABASE_PRAGMA_CACHE_SIZE = 0,
+  DATABASE_PRAGMA_JOURNAL_WAL,
+  DATABASE_PRAGMA_MMAP_SIZE,
+  DATABASE_PRAGMA_PAGE_SIZE,
+  DATABASE_PRAGMA_SYNCHRONOUS,
+  DATABASE_PRAGMA_TEMP_STORE,
+} database_pragma_t;
+
+typedef struct database_probe_s {
+  /* Identity of the content. */
+  int64_t dev, ino, size, fp;
+  /* Results of the parser. */
+  int     type;
+  char   *tags;     /* "key\0value\0..." */
+  size_t  tags_len;
+  int     moved;    /* found with another path, only the path is updated */
+} database_probe_t;
+
 void vh_database_file_insert (database_t *database, file_data_t *data);
 void vh_database_file_data_update (database_t *database, file_data_t *data);
 void vh_database_file_delete (database_t *database, const char *file);
@@ -48,7 +67,26 @@ void vh_database_file_interrupted_clear (database_t *database,
 void vh_database_file_interrupted_fix (database_t *database);
 int vh_database_file_get_interrupted (database_t *database, const char *file);
 
-void vh_database_file_checked_clear (database_t *database);
+int64_t vh_database_dir_get_mtime (database_t *database, const char *dir);
+char **vh_database_dir_get_children (database_t *database, const char *dir);
+void vh_database_dir_checked (database_t *database, const char *dir);
+void vh_database_dir_update (database_t *database,
+                             const char *dir, int64_t mtime, char **subdirs);
+void vh_database_dir_validate (database_t *database, const char *signature);
+
+int vh_database_probe_get (database_t *database,
+                           const char *file, database_probe_t *probe);
+void vh_database_probe_set (database_t *database,
+                            const char *file, const database_probe_t *probe);
+
+void vh_database_file_checked_next (database_t *database);
+void vh_database_file_checked (database_t *database, int64_t id);
+void vh_database_file_checked_flush (database_t *database);
+
+int vh_database_file_preload (database_t *database);
+void vh_database_file_preload_free (database_t *database);
+int vh_database_file_preload_get (database_t *database, const char *file,
+                                  int64_t *id, int64_t *mtime, int *interrup);
 const char *vh_database_file_get_checked_clear (database_t *database, int rst);
 const char *vh_database_file_get_outofpath_set (database_t *database, int rst);
 
@@ -57,23 +95,30 @@ void vh_database_end_transaction (database_t *database);
 void vh_database_step_transaction (database_t *database,
                                    unsigned int interval, int value);
 
+int vh_database_pragma (database_t *database,
+                        database_pragma_t pragma, int value);
+void vh_database_readers_set (database_t *database, unsigned int nb);
+
 database_t *vh_database_init (const char *path);
 void vh_database_uninit (database_t *database);
-int vh_database_cleanup (database_t *database);
+int vh_database_cleanup (database_t *database, unsigned int timebox);
 
 
 valhalla_db_stmt_t *
 vh_database_metalist_get (database_t *database,
                           valhalla_db_item_t *search,
                           valhalla_file_type_t filetype,
-                          valhalla_db_restrict_t *restriction);
+                          valhalla_db_restrict_t *restriction,
+                          const valhalla_db_metares_t *after,
+                          unsigned int limit);
 const valhalla_db_metares_t *
 vh_database_metalist_read (database_t *database, valhalla_db_stmt_t *vhstmt);
 
 valhalla_db_stmt_t *
 vh_database_filelist_get (database_t *database,
                           valhalla_file_type_t filetype,
-                          valhalla_db_restrict_t *restriction);
+                          valhalla_db_restrict_t *restriction,
+                          int64_t after, unsigned int limit);
 const valhalla_db_fileres_t *
 vh_database_filelist_read (database_t *database, valhalla_db_stmt_t *vhstmt);
 
@@ -83,6 +128,21 @@ vh_database_file_get (database_t *database, int64_t id, const char *path,
 const valhalla_db_metares_t *
 vh_database_file_read (database_t *database, valhalla_db_stmt_t *vhstmt);
 
+int64_t vh_database_count (database_t *database,
+                           valhalla_file_type_t filetype,
+                           valhalla_db_restrict_t *restriction);
+valhalla_db_stmt_t *
+vh_database_count_get (database_t *database,
+                       valhalla_db_item_t *search,
+                       valhalla_file_type_t filetype,
+                       valhalla_db_restrict_t *restriction);
+const valhalla_db_countres_t *
+vh_database_count_read (database_t *database, valhalla_db_stmt_t *vhstmt);
+
+valhalla_db_stmt_t *
+vh_database_search (database_t *database, const char *text, const char *meta,
+                    valhalla_file_type_t filetype, unsigned int limit);
+
 
 int vh_database_metadata_insert (database_t *database, const char *path,
                                  const char *meta, const char *data,
@@ -36,21 +36,28 @@
 #include "scanner.h"
 #include "dbmanager.h"
 #include "dispatcher.h"
+#include "inflight.h"
 
 #define VH_HANDLE dbmanager->valhalla
 
+/* Files received from the scanner before to preload the states. */
+#define DBMANAGER_PRELOAD_MIN  256
+
+/* Time (ms) for the cleanup with each loop. */
+#define DBMANAGER_CLEANUP_TIMEBOX  500
+
 struct dbmanager_s {
   valhalla_t   *valhalla;
   pthread_t     thread;
   fifo_queue_t *fifo;
   int           priority;
 
+  fifo_queue_batch_t batch; /* entries popped and not yet handled */
+
   int             wait;
   int             run;
   pthread_mutex_t mutex_run;
 
-  VH_THREAD_PAUSE_ATTRS
-
   database_t   *database;
   unsigned int  commit_int;
 
@@ -96,14 +103,33 @@ vh_dbmanager_extmd_free (dbmanager_extmd_t *extmd)
   free (extmd);
 }
 
+void
+vh_dbmanager_dir_free (dbmanager_dir_t *dir)
+{
+  char **it;
+
+  if (!dir)
+    return;
+
+  if (dir->path)
+    free (dir->path);
+  for (it = dir->subdirs; it && *it; it++)
+    free (*it);
+  if (dir->subdirs)
+    free (dir->subdirs);
+  free (dir);
+}
+
 static int
 dbmanager_queue (dbmanager_t *dbmanager)
 {
   int res;
   int e;
   int grab = 0;
+  int newfile = 0;
   void *data = NULL;
   file_data_t *pdata;
+  od_type_t od;
 
   do
   {
@@ -111,7 +137,8 @@ dbmanager_queue (dbmanager_t *dbmanager)
     e = ACTION_NO_OPERATION;
     data = NULL;
 
-    res = vh_fifo_queue_pop (dbmanager->fifo, &e, &data);
+    res = vh_fifo_queue_batch_pop (dbmanager->fifo,
+                                   &dbmanager->batch, &e, &data);
     if (res || e == ACTION_NO_OPERATION)
       continue;
 
@@ -202,15 +229,16 @@ dbmanager_queue (dbmanager_t *dbmanager)
     default:
       break;
 
-    case ACTION_PAUSE_THREAD:
-      VH_THREAD_PAUSE_ACTION (dbmanager)
-      continue;
-
     /* received from the dispatcher */
     case ACTION_DB_END:
       vh_database_file_interrupted_clear (dbmanager->database,
                                           pdata->file.path);
-      if (pdata->od != OD_TYPE_DEF)
+      /*
+       * Removed before to read 'od' because the on-demand changes it only
+       * when the file is in the in-flight table.
+       */
+      vh_inflight_del (VH_HANDLE->inflight, pdata);
+      if (VH_FILE_DATA_GET (pdata, od) != OD_TYPE_DEF)
         vh_event_handler_od_send (VH_HANDLE->event_handler,
                                   pdata->file.path,
                                   VALHALLA_EVENTOD_ENDED, NULL, NULL);
@@ -226,7 +254,7 @@ dbmanager_queue (dbmanager_t *dbmanager)
       if (e == ACTION_DB_UPDATE_G)
         vh_database_file_grab_update (dbmanager->database, pdata);
 
-      if (pdata->od != OD_TYPE_DEF)
+      if (VH_FILE_DATA_GET (pdata, od) != OD_TYPE_DEF)
         vh_event_handler_od_send (VH_HANDLE->event_handler,
                                   pdata->file.path,
                                   VALHALLA_EVENTOD_GRABBED,
@@ -252,7 +280,10 @@ dbmanager_queue (dbmanager_t *dbmanager)
       VH_STATS_COUNTER_INC (dbmanager->st_update);
     case ACTION_DB_INSERT_P:
       vh_database_file_data_update (dbmanager->database, pdata);
-      if (pdata->od != OD_TYPE_DEF)
+      if (pdata->probe)
+        vh_database_probe_set (dbmanager->database,
+                               pdata->file.path, pdata->probe);
+      if (VH_FILE_DATA_GET (pdata, od) != OD_TYPE_DEF)
         vh_event_handler_od_send (VH_HANDLE->event_handler,
                                   pdata->file.path,
                                   VALHALLA_EVENTOD_PARSED, NULL,
@@ -262,12 +293,62 @@ dbmanager_queue (dbmanager_t *dbmanager)
                                 &pdata->file, pdata->meta_parser);
       continue;
 
+    /* received from the scanner (inotify) */
+    case ACTION_DB_DELFILE:
+      vh_database_file_delete (dbmanager->database, data);
+      VH_STATS_COUNTER_INC (dbmanager->st_delete);
+      free (data);
+      continue;
+
+    /* received from the scanner (directories cache) */
+    case ACTION_DB_NEWDIR:
+    {
+      dbmanager_dir_t *dir = data;
+
+      if (!dir)
+        continue;
+
+      vh_database_dir_update (dbmanager->database,
+                              dir->path, dir->mtime, dir->subdirs);
+      vh_dbmanager_dir_free (dir);
+      continue;
+    }
+
+    case ACTION_DB_DIRCHECKED:
+      if (!data)
+        continue;
+
+      vh_database_dir_checked (dbmanager->database, data);
+      free (data);
+      continue;
+
     /* received from the scanner */
     case ACTION_DB_NEWFILE:
     {
       int interrup = 0;
-      int64_t mtime =
-        vh_database_file_get_mtime (dbmanager->database, pdata->file.path);
+      int64_t id = 0, mtime;
+
+      /*
+       * With many files from the scanner, the states of all files are
+       * loaded at once instead of two queries by file.
+       */
+      if (VH_FILE_DATA_GET (pdata, od) == OD_TYPE_DEF
+          && ++newfile == DBMANAGER_PRELOAD_MIN)
+        vh_database_file_preload (dbmanager->database);
+
+      if (VH_FILE_DATA_GET (pdata, od) != OD_TYPE_DEF
+          || vh_database_file_preload_get (dbmanager->database,
+                                           pdata->file.path,
+                                           &id, &mtime, &interrup))
+      {
+        mtime =
+          vh_database_file_get_mtime (dbmanager->database, pdata->file.path);
+        if (mtime >= 0)
+          interrup =
+            vh_database_file_get_interrupted (dbmanager->database,
+                                              pdata->file.path);
+      }
+
       /*
        * File is parsed only if mtime has changed, if the grabbing/downloading
        * was interrupted or if it is unexistant in the database.
@@ -285,9 +366,6 @@ dbmanager_queue (dbmanager_t *dbmanager)
        */
       if (mtime >= 0)
       {
-        interrup =
-          vh_database_file_get_interrupted (dbmanager->database,
-                                            pdata->file.path);
         /*
          * Retrieve the list of all grabbers already handled for this file
          * and search if there are files to download since the interruption.
@@ -320,11 +398,16 @@ dbmanager_queue (dbmanager_t *dbmanager)
       {
         int act = mtime < 0 ? ACTION_DB_INSERT_P : ACTION_DB_UPDATE_P;
         vh_dispatcher_action_send (VH_HANDLE->dispatcher,
-                                   pdata->priority, act, pdata);
+                                   VH_FILE_DATA_GET (pdata, priority),
+                                   act, pdata);
         continue;
       }
 
-      if (pdata->od != OD_TYPE_DEF)
+      /* Unchanged, then no need to check the file after the loop. */
+      vh_database_file_checked (dbmanager->database, id);
+
+      vh_inflight_del (VH_HANDLE->inflight, pdata);
+      if (VH_FILE_DATA_GET (pdata, od) != OD_TYPE_DEF)
         vh_event_handler_od_send (VH_HANDLE->event_handler,
                                   pdata->file.path,
                                   VALHALLA_EVENTOD_ENDED, NULL, NULL);
@@ -333,7 +416,8 @@ dbmanager_queue (dbmanager_t *dbmanager)
     }
 
     /* Must not come from "On-demand" */
-    if (pdata->od == OD_TYPE_DEF || pdata->od == OD_TYPE_UPD)
+    od = VH_FILE_DATA_GET (pdata, od);
+    if (od == OD_TYPE_DEF || od == OD_TYPE_UPD)
       vh_scanner_action_send (VH_HANDLE->scanner,
                               FIFO_QUEUE_PRIORITY_NORMAL,
                               ACTION_ACKNOWLEDGE, NULL);
@@ -344,6 +428,13 @@ dbmanager_queue (dbmanager_t *dbmanager)
   e = ACTION_KILL_THREAD;
 
  out:
+  /* The next entries are handled with the next loop or by the cleanup. */
+  if (e == ACTION_KILL_THREAD)
+    vh_fifo_queue_batch_flush (dbmanager->fifo, &dbmanager->batch);
+
+  vh_database_file_checked_flush (dbmanager->database);
+  vh_database_file_preload_free (dbmanager->database);
+
   /* Change files where interrupted__ is -1 to 1. */
   vh_database_file_interrupted_fix (dbmanager->database);
 
@@ -374,20 +465,19 @@ dbmanager_thread (void *arg)
   do
   {
     int stats_delete   = 0;
-    uint64_t stats_update = 0;
     int rst = 0;
 
     vh_log (VALHALLA_MSG_INFO, "[%s] Begin loop %i", __FUNCTION__, loop);
 
-    /* Clear all checked__ files */
-    vh_database_file_checked_clear (dbmanager->database);
+    /* New generation for checked__ */
+    vh_database_file_checked_next (dbmanager->database);
 
     vh_database_begin_transaction (dbmanager->database);
     rc = dbmanager_queue (dbmanager);
     vh_database_end_transaction (dbmanager->database);
 
     /*
-     * Get all files that have checked__ to 0 and verify if the file is valid.
+     * Get all files not seen with this loop and verify if the file is valid.
      * The entry is deleted otherwise.
      */
     vh_database_begin_transaction (dbmanager->database);
@@ -433,11 +523,13 @@ dbmanager_thread (void *arg)
 
     VH_STATS_COUNTER_ACC (dbmanager->st_delete, (unsigned) stats_delete);
 
-    /* Clean all relations */
-    stats_update = vh_stats_counter_read (dbmanager->st_update);
-    if (stats_update || stats_delete)
+    /*
+     * Clean the relations removed with this loop (and the previous ones if
+     * the time was elapsed).
+     */
     {
-      int val = vh_database_cleanup (dbmanager->database);
+      int val =
+        vh_database_cleanup (dbmanager->database, DBMANAGER_CLEANUP_TIMEBOX);
       if (val > 0)
         VH_STATS_COUNTER_ACC (dbmanager->st_cleanup, (uint64_t) val);
     }
@@ -490,17 +582,6 @@ vh_dbmanager_fifo_get (dbmanager_t *dbmanager)
   return dbmanager->fifo;
 }
 
-void
-vh_dbmanager_pause (dbmanager_t *dbmanager)
-{
-  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
-
-  if (!dbmanager)
-    return;
-
-  VH_THREAD_PAUSE_FCT (dbmanager, 1)
-}
-
 void
 vh_dbmanager_wait (dbmanager_t *dbmanager)
 {
@@ -533,8 +614,6 @@ vh_dbmanager_stop (dbmanager_t *dbmanager, int f)
     vh_fifo_queue_push (dbmanager->fifo,
                         FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
     dbmanager->wait = 1;
-
-    VH_THREAD_PAUSE_FORCESTOP (dbmanager, 1)
   }
 
   if (f & STOP_FLAG_WAIT && dbmanager->wait)
@@ -557,7 +636,6 @@ vh_dbmanager_uninit (dbmanager_t *dbmanager)
 
   vh_fifo_queue_free (dbmanager->fifo);
   pthread_mutex_destroy (&dbmanager->mutex_run);
-  VH_THREAD_PAUSE_UNINIT (dbmanager)
 
   free (dbmanager);
 }
@@ -615,7 +693,6 @@ vh_dbmanager_init (valhalla_t *handle, const char *db, unsigned int commit_int)
   dbmanager->valhalla = handle; /* VH_HANDLE */
 
   pthread_mutex_init (&dbmanager->mutex_run, NULL);
-  VH_THREAD_PAUSE_INIT (dbmanager)
 
   /* init statistics */
   vh_stats_grp_add (handle->stats,
@@ -697,6 +774,74 @@ vh_dbmanager_db_dlcontext_delete (dbmanager_t *dbmanager)
   vh_database_delete_dlcontext (dbmanager->database);
 }
 
+int64_t
+vh_dbmanager_db_dir_get_mtime (dbmanager_t *dbmanager, const char *dir)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return -1;
+
+  return vh_database_dir_get_mtime (dbmanager->database, dir);
+}
+
+char **
+vh_dbmanager_db_dir_get_children (dbmanager_t *dbmanager, const char *dir)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return NULL;
+
+  return vh_database_dir_get_children (dbmanager->database, dir);
+}
+
+void
+vh_dbmanager_db_dir_validate (dbmanager_t *dbmanager, const char *signature)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return;
+
+  vh_database_dir_validate (dbmanager->database, signature);
+}
+
+int
+vh_dbmanager_db_probe_get (dbmanager_t *dbmanager,
+                           const char *file, database_probe_t *probe)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return -1;
+
+  return vh_database_probe_get (dbmanager->database, file, probe);
+}
+
+int
+vh_dbmanager_db_pragma (dbmanager_t *dbmanager,
+                        database_pragma_t pragma, int value)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return -1;
+
+  return vh_database_pragma (dbmanager->database, pragma, value);
+}
+
+void
+vh_dbmanager_db_readers_set (dbmanager_t *dbmanager, unsigned int nb)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return;
+
+  vh_database_readers_set (dbmanager->database, nb);
+}
+
 void
 vh_dbmanager_db_begin_transaction (dbmanager_t *dbmanager)
 {
@@ -723,15 +868,17 @@ valhalla_db_stmt_t *
 vh_dbmanager_db_metalist_get (dbmanager_t *dbmanager,
                               valhalla_db_item_t *search,
                               valhalla_file_type_t filetype,
-                              valhalla_db_restrict_t *restriction)
+                              valhalla_db_restrict_t *restriction,
+                              const valhalla_db_metares_t *after,
+                              unsigned int limit)
 {
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
   if (!dbmanager)
     return NULL;
 
-  return vh_database_metalist_get (dbmanager->database,
-                                   search, filetype, restriction);
+  return vh_database_metalist_get (dbmanager->database, search,
+                                   filetype, restriction, after, limit);
 }
 
 const valhalla_db_metares_t *
@@ -749,14 +896,16 @@ vh_dbmanager_db_metalist_read (dbmanager_t *dbmanager,
 valhalla_db_stmt_t *
 vh_dbmanager_db_filelist_get (dbmanager_t *dbmanager,
                               valhalla_file_type_t filetype,
-                              valhalla_db_restrict_t *restriction)
+                              valhalla_db_restrict_t *restriction,
+                              int64_t after, unsigned int limit)
 {
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
   if (!dbmanager)
     return NULL;
 
-  return vh_database_filelist_get (dbmanager->database, filetype, restriction);
+  return vh_database_filelist_get (dbmanager->database,
+                                   filetype, restriction, after, limit);
 }
 
 const valhalla_db_fileres_t *
@@ -794,3 +943,56 @@ vh_dbmanager_db_file_read (dbmanager_t *dbmanager, valhalla_db_stmt_t *vhstmt)
 
   return vh_database_file_read (dbmanager->database, vhstmt);
 }
+
+int64_t
+vh_dbmanager_db_count (dbmanager_t *dbmanager,
+                       valhalla_file_type_t filetype,
+                       valhalla_db_restrict_t *restriction)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return -1;
+
+  return vh_database_count (dbmanager->database, filetype, restriction);
+}
+
+valhalla_db_stmt_t *
+vh_dbmanager_db_count_get (dbmanager_t *dbmanager,
+                           valhalla_db_item_t *search,
+                           valhalla_file_type_t filetype,
+                           valhalla_db_restrict_t *restriction)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return NULL;
+
+  return vh_database_count_get (dbmanager->database,
+                                search, filetype, restriction);
+}
+
+const valhalla_db_countres_t *
+vh_dbmanager_db_count_read (dbmanager_t *dbmanager, valhalla_db_stmt_t *vhstmt)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return NULL;
+
+  return vh_database_count_read (dbmanager->database, vhstmt);
+}
+
+valhalla_db_stmt_t *
+vh_dbmanager_db_search (dbmanager_t *dbmanager,
+                        const char *text, const char *meta,
+                        valhalla_file_type_t filetype, unsigned int limit)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return NULL;
+
+  return vh_database_search (dbmanager->database,
+                             text, meta, filetype, limit);
+}
@@ -24,6 +24,7 @@
 
 #include "fifo_queue.h"
 #include "utils.h"
+#include "database.h"
 
 typedef struct dbmanager_s dbmanager_t;
 
@@ -41,13 +42,19 @@ typedef struct dbmanager_extmd_s {
   valhalla_metadata_pl_t priority;
 } dbmanager_extmd_t;
 
+typedef struct dbmanager_dir_s {
+  char *path;
+  int64_t mtime;
+  char **subdirs;
+} dbmanager_dir_t;
+
 #define DBMANAGER_COMMIT_INTERVAL_DEF 128
 
 
 void vh_dbmanager_extmd_free (dbmanager_extmd_t *extmd);
+void vh_dbmanager_dir_free (dbmanager_dir_t *dir);
 
 int vh_dbmanager_run (dbmanager_t *dbmanager, int priority);
-void vh_dbmanager_pause (dbmanager_t *dbmanager);
 fifo_queue_t *vh_dbmanager_fifo_get (dbmanager_t *dbmanager);
 void vh_dbmanager_wait (dbmanager_t *dbmanager);
 void vh_dbmanager_stop (dbmanager_t *dbmanager, int f);
@@ -64,6 +71,19 @@ int vh_dbmanager_file_complete (dbmanager_t *dbmanager,
 void vh_dbmanager_db_dlcontext_save (dbmanager_t *dbmanager, file_data_t *data);
 void vh_dbmanager_db_dlcontext_delete (dbmanager_t *dbmanager);
 
+int64_t vh_dbmanager_db_dir_get_mtime (dbmanager_t *dbmanager,
+                                       const char *dir);
+char **vh_dbmanager_db_dir_get_children (dbmanager_t *dbmanager,
+                                         const char *dir);
+void vh_dbmanager_db_dir_validate (dbmanager_t *dbmanager,
+                                   const char *signature);
+int vh_dbmanager_db_probe_get (dbmanager_t *dbmanager,
+                               const char *file, database_probe_t *probe);
+
+int vh_dbmanager_db_pragma (dbmanager_t *dbmanager,
+                            database_pragma_t pragma, int value);
+void vh_dbmanager_db_readers_set (dbmanager_t *dbmanager, unsigned int nb);
+
 void vh_dbmanager_db_begin_transaction (dbmanager_t *dbmanager);
 void vh_dbmanager_db_end_transaction (dbmanager_t *dbmanager);
 
@@ -71,7 +91,9 @@ valhalla_db_stmt_t *
 vh_dbmanager_db_metalist_get (dbmanager_t *dbmanager,
                               valhalla_db_item_t *search,
                               valhalla_file_type_t filetype,
-                              valhalla_db_restrict_t *restriction);
+                              valhalla_db_restrict_t *restriction,
+                              const valhalla_db_metares_t *after,
+                              unsigned int limit);
 const valhalla_db_metares_t *
 vh_dbmanager_db_metalist_read (dbmanager_t *dbmanager,
                                valhalla_db_stmt_t *vhstmt);
@@ -79,7 +101,8 @@ vh_dbmanager_db_metalist_read (dbmanager_t *dbmanager,
 valhalla_db_stmt_t *
 vh_dbmanager_db_filelist_get (dbmanager_t *dbmanager,
                               valhalla_file_type_t filetype,
-                              valhalla_db_restrict_t *restriction);
+                              valhalla_db_restrict_t *restriction,
+                              int64_t after, unsigned int limit);
 const valhalla_db_fileres_t *
 vh_dbmanager_db_filelist_read (dbmanager_t *dbmanager,
                                valhalla_db_stmt_t *vhstmt);
@@ -90,4 +113,20 @@ vh_dbmanager_db_file_get (dbmanager_t *dbmanager, int64_t id, const char *path,
 const valhalla_db_metares_t *
 vh_dbmanager_db_file_read (dbmanager_t *dbmanager, valhalla_db_stmt_t *vhstmt);
 
+int64_t vh_dbmanager_db_count (dbmanager_t *dbmanager,
+                               valhalla_file_type_t filetype,
+                               valhalla_db_restrict_t *restriction);
+valhalla_db_stmt_t *
+vh_dbmanager_db_count_get (dbmanager_t *dbmanager,
+                           valhalla_db_item_t *search,
+                           valhalla_file_type_t filetype,
+                           valhalla_db_restrict_t *restriction);
+const valhalla_db_countres_t *
+vh_dbmanager_db_count_read (dbmanager_t *dbmanager, valhalla_db_stmt_t *vhstmt);
+
+valhalla_db_stmt_t *
+vh_dbmanager_db_search (dbmanager_t *dbmanager,
+                        const char *text, const char *meta,
+                        valhalla_file_type_t filetype, unsigned int limit);
+
 #endif /* VALHALLA_DBMANAGER_H */
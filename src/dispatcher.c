@@ -41,17 +41,25 @@
 
 #define VH_HANDLE dispatcher->valhalla
 
+typedef struct dispatcher_step_s {
+  void *handler;
+  void (*fct) (void *handler, fifo_queue_prio_t prio, int action, void *data);
+} dispatcher_step_t;
+
 struct dispatcher_s {
   valhalla_t   *valhalla;
   pthread_t     thread;
   fifo_queue_t *fifo;
   int           priority;
+  int           direct;
+
+  dispatcher_step_t send[STEP_ENDING + 1];
+
+  fifo_queue_batch_t batch; /* entries popped and not yet handled */
 
   int             wait;
   int             run;
   pthread_mutex_t mutex_run;
-
-  VH_THREAD_PAUSE_ATTRS
 };
 
 
@@ -65,28 +73,79 @@ dispatcher_is_stopped (dispatcher_t *dispatcher)
   return !run;
 }
 
+/*
+ * Send the data to the dbmanager (if necessary) and to the next step.
+ * It is called by the dispatcher thread or, with the direct routing, by
+ * the thread of the previous step.
+ */
+static void
+dispatcher_route (dispatcher_t *dispatcher, int e, file_data_t *pdata)
+{
+  dispatcher_step_t *send = dispatcher->send;
+  processing_step_t step = pdata->step;
+  fifo_queue_prio_t prio = VH_FILE_DATA_GET (pdata, priority);
+
+  vh_log (VALHALLA_MSG_VERBOSE,
+          "[%s] step: %i, file: \"%s\"",
+          __FUNCTION__, step, pdata->file.path);
+
+#ifdef USE_GRABBER
+  /*
+   * If step is GRABBING, then parsed data are added/updated for
+   * the first grab, and grabbed data are added/updated for the
+   * next potential grabbing. It depends if more than one grabber
+   * is available.
+   * If step is DOWNLOADING, then the last grabbed data is
+   * added/updated.
+   *
+   * When skip is != 0, then pdata has no meta_grabber available
+   * because all grabber threads are busy. In this case, nothing
+   * must be sent to the DBManager.
+   */
+  if (step > STEP_PARSING && step < STEP_ENDING && !pdata->skip)
+  {
+    /*
+     * Only one meta_grabber exists for all grabbers. It is necessary
+     * to lock the metadata in the grabber until the semaphore is
+     * released by the dbmanager, in order to prevent a race condition
+     * between the insertion and the next grabber.
+     */
+    if (step == STEP_GRABBING
+        && (e == ACTION_DB_INSERT_G || e == ACTION_DB_UPDATE_G))
+      pdata->wait = 1;
+#else /* USE_GRABBER */
+  /* Parsed data added/updated. */
+  if (step == STEP_ENDING)
+  {
+#endif /* !USE_GRABBER */
+    vh_dbmanager_action_send (VH_HANDLE->dbmanager, prio, e, pdata);
+  }
+
+  if (step == STEP_ENDING)
+  {
+    e = ACTION_DB_END;
+    /*
+     * Force NORMAL priority because the last step must be always
+     * at the end! It prevents to free pdata before the handling
+     * of metadata. The local value is used because the on-demand can
+     * change pdata->priority meanwhile.
+     */
+    prio = FIFO_QUEUE_PRIORITY_NORMAL;
+    VH_FILE_DATA_SET (pdata, priority, prio);
+  }
+
+  /* Proceed to the step */
+  send[step].fct (send[step].handler, prio, e, pdata);
+}
+
 static void *
 dispatcher_thread (void *arg)
 {
   int res, tid;
   int e;
   void *data = NULL;
-  file_data_t *pdata;
   dispatcher_t *dispatcher = arg;
 
-  struct dispatcher_step_s {
-    void *handler;
-    void (*fct) (void *handler, fifo_queue_prio_t prio, int action, void *data);
-  } send[] = {
-    [STEP_PARSING]      = { NULL, (void *) vh_parser_action_send     },
-#ifdef USE_GRABBER
-    [STEP_GRABBING]     = { NULL, (void *) vh_grabber_action_send    },
-    [STEP_DOWNLOADING]  = { NULL, (void *) vh_downloader_action_send },
-#endif /* USE_GRABBER */
-    [STEP_ENDING]       = { NULL, (void *) vh_dbmanager_action_send  },
-  };
-
-
   if (!dispatcher)
     pthread_exit (NULL);
 
@@ -95,33 +154,21 @@ dispatcher_thread (void *arg)
   vh_log (VALHALLA_MSG_VERBOSE,
           "[%s] tid: %i priority: %i", __FUNCTION__, tid, dispatcher->priority);
 
-  send[STEP_PARSING].handler     = VH_HANDLE->parser;
-#ifdef USE_GRABBER
-  send[STEP_GRABBING].handler    = VH_HANDLE->grabber;
-  send[STEP_DOWNLOADING].handler = VH_HANDLE->downloader;
-#endif /* USE_GRABBER */
-  send[STEP_ENDING].handler      = VH_HANDLE->dbmanager;
-
   do
   {
     e = ACTION_NO_OPERATION;
     data = NULL;
 
-    res = vh_fifo_queue_pop (dispatcher->fifo, &e, &data);
+    res = vh_fifo_queue_batch_pop (dispatcher->fifo,
+                                   &dispatcher->batch, &e, &data);
     if (res || e == ACTION_NO_OPERATION)
       continue;
 
     if (e == ACTION_KILL_THREAD)
       break;
 
-    pdata = data;
-
     switch (e)
     {
-    case ACTION_PAUSE_THREAD:
-      VH_THREAD_PAUSE_ACTION (dispatcher)
-      continue;
-
 #ifdef USE_GRABBER
     case ACTION_DB_NEXT_LOOP:
       vh_grabber_action_send (VH_HANDLE->grabber,
@@ -134,61 +181,8 @@ dispatcher_thread (void *arg)
     case ACTION_DB_UPDATE_P:
     case ACTION_DB_UPDATE_G:
     case ACTION_DB_END:
-    {
-      processing_step_t step = pdata->step;
-
-      vh_log (VALHALLA_MSG_VERBOSE,
-              "[%s] step: %i, file: \"%s\"",
-              __FUNCTION__, step, pdata->file.path);
-
-#ifdef USE_GRABBER
-      /*
-       * If step is GRABBING, then parsed data are added/updated for
-       * the first grab, and grabbed data are added/updated for the
-       * next potential grabbing. It depends if more than one grabber
-       * is available.
-       * If step is DOWNLOADING, then the last grabbed data is
-       * added/updated.
-       *
-       * When skip is != 0, then pdata has no meta_grabber available
-       * because all grabber threads are busy. In this case, nothing
-       * must be sent to the DBManager.
-       */
-      if (step > STEP_PARSING && step < STEP_ENDING && !pdata->skip)
-      {
-        /*
-         * Only one meta_grabber exists for all grabbers. It is necessary
-         * to lock the metadata in the grabber until the semaphore is
-         * released by the dbmanager, in order to prevent a race condition
-         * between the insertion and the next grabber.
-         */
-        if (step == STEP_GRABBING
-            && (e == ACTION_DB_INSERT_G || e == ACTION_DB_UPDATE_G))
-          pdata->wait = 1;
-#else /* USE_GRABBER */
-      /* Parsed data added/updated. */
-      if (step == STEP_ENDING)
-      {
-#endif /* !USE_GRABBER */
-        vh_dbmanager_action_send (VH_HANDLE->dbmanager,
-                                  pdata->priority, e, pdata);
-      }
-
-      if (step == STEP_ENDING)
-      {
-        e = ACTION_DB_END;
-        /*
-         * Force NORMAL priority because the last step must be always
-         * at the end! It prevents to free pdata before the handling
-         * of metadata.
-         */
-        pdata->priority = FIFO_QUEUE_PRIORITY_NORMAL;
-      }
-
-      /* Proceed to the step */
-      send[step].fct (send[step].handler, pdata->priority, e, pdata);
+      dispatcher_route (dispatcher, e, data);
       break;
-    }
 
     default:
       break;
@@ -196,6 +190,9 @@ dispatcher_thread (void *arg)
   }
   while (!dispatcher_is_stopped (dispatcher));
 
+  /* The next entries are freed by the cleanup. */
+  vh_fifo_queue_batch_flush (dispatcher->fifo, &dispatcher->batch);
+
   pthread_exit (NULL);
 }
 
@@ -213,6 +210,19 @@ vh_dispatcher_run (dispatcher_t *dispatcher, int priority)
   dispatcher->priority = priority;
   dispatcher->run      = 1;
 
+  dispatcher->send[STEP_PARSING].handler     = VH_HANDLE->parser;
+  dispatcher->send[STEP_PARSING].fct         = (void *) vh_parser_action_send;
+#ifdef USE_GRABBER
+  dispatcher->send[STEP_GRABBING].handler    = VH_HANDLE->grabber;
+  dispatcher->send[STEP_GRABBING].fct        = (void *) vh_grabber_action_send;
+  dispatcher->send[STEP_DOWNLOADING].handler = VH_HANDLE->downloader;
+  dispatcher->send[STEP_DOWNLOADING].fct     =
+    (void *) vh_downloader_action_send;
+#endif /* USE_GRABBER */
+  dispatcher->send[STEP_ENDING].handler      = VH_HANDLE->dbmanager;
+  dispatcher->send[STEP_ENDING].fct          =
+    (void *) vh_dbmanager_action_send;
+
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
 
@@ -240,14 +250,14 @@ vh_dispatcher_fifo_get (dispatcher_t *dispatcher)
 }
 
 void
-vh_dispatcher_pause (dispatcher_t *dispatcher)
+vh_dispatcher_direct_set (dispatcher_t *dispatcher, int enable)
 {
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
   if (!dispatcher)
     return;
 
-  VH_THREAD_PAUSE_FCT (dispatcher, 1)
+  dispatcher->direct = !!enable;
 }
 
 void
@@ -267,8 +277,6 @@ vh_dispatcher_stop (dispatcher_t *dispatcher, int f)
     vh_fifo_queue_push (dispatcher->fifo,
                         FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
     dispatcher->wait = 1;
-
-    VH_THREAD_PAUSE_FORCESTOP (dispatcher, 1)
   }
 
   if (f & STOP_FLAG_WAIT && dispatcher->wait)
@@ -288,7 +296,6 @@ vh_dispatcher_uninit (dispatcher_t *dispatcher)
 
   vh_fifo_queue_free (dispatcher->fifo);
   pthread_mutex_destroy (&dispatcher->mutex_run);
-  VH_THREAD_PAUSE_UNINIT (dispatcher)
 
   free (dispatcher);
 }
@@ -314,7 +321,6 @@ vh_dispatcher_init (valhalla_t *handle)
   dispatcher->valhalla = handle; /* VH_HANDLE */
 
   pthread_mutex_init (&dispatcher->mutex_run, NULL);
-  VH_THREAD_PAUSE_INIT (dispatcher)
 
   return dispatcher;
 
@@ -332,5 +338,24 @@ vh_dispatcher_action_send (dispatcher_t *dispatcher,
   if (!dispatcher)
     return;
 
+  /*
+   * With the direct routing, the files are sent to the next step by the
+   * caller. Only the other actions (NEXT_LOOP, ...) use the thread.
+   */
+  if (dispatcher->direct && data)
+    switch (action)
+    {
+    case ACTION_DB_INSERT_P:
+    case ACTION_DB_INSERT_G:
+    case ACTION_DB_UPDATE_P:
+    case ACTION_DB_UPDATE_G:
+    case ACTION_DB_END:
+      dispatcher_route (dispatcher, action, data);
+      return;
+
+    default:
+      break;
+    }
+
   vh_fifo_queue_push (dispatcher->fifo, prio, action, data);
 }
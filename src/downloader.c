@@ -47,8 +47,6 @@ struct downloader_s {
   int             run;
   pthread_mutex_t mutex_run;
 
-  VH_THREAD_PAUSE_ATTRS
-
   url_t *url_handler;
   char **dl_list;
 
@@ -105,12 +103,6 @@ downloader_thread (void *arg)
     if (e == ACTION_KILL_THREAD)
       break;
 
-    if (e == ACTION_PAUSE_THREAD)
-    {
-      VH_THREAD_PAUSE_ACTION (downloader)
-      continue;
-    }
-
     pdata = data;
 
     if (pdata->list_downloader)
@@ -180,7 +172,7 @@ downloader_thread (void *arg)
     if (!interrup)
       vh_file_data_step_increase (pdata, &e);
     vh_dispatcher_action_send (VH_HANDLE->dispatcher,
-                               pdata->priority, e, pdata);
+                               VH_FILE_DATA_GET (pdata, priority), e, pdata);
   }
   while (!downloader_is_stopped (downloader));
 
@@ -227,17 +219,6 @@ vh_downloader_fifo_get (downloader_t *downloader)
   return downloader->fifo;
 }
 
-void
-vh_downloader_pause (downloader_t *downloader)
-{
-  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
-
-  if (!downloader)
-    return;
-
-  VH_THREAD_PAUSE_FCT (downloader, 1)
-}
-
 void
 vh_downloader_stop (downloader_t *downloader, int f)
 {
@@ -255,8 +236,6 @@ vh_downloader_stop (downloader_t *downloader, int f)
     vh_fifo_queue_push (downloader->fifo,
                         FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
     downloader->wait = 1;
-
-    VH_THREAD_PAUSE_FORCESTOP (downloader, 1)
   }
 
   if (f & STOP_FLAG_WAIT && downloader->wait)
@@ -288,7 +267,6 @@ vh_downloader_uninit (downloader_t *downloader)
 
   vh_fifo_queue_free (downloader->fifo);
   pthread_mutex_destroy (&downloader->mutex_run);
-  VH_THREAD_PAUSE_UNINIT (downloader)
 
   free (downloader);
 }
@@ -352,7 +330,6 @@ vh_downloader_init (valhalla_t *handle)
   downloader->valhalla = handle; /* VH_HANDLE */
 
   pthread_mutex_init (&downloader->mutex_run, NULL);
-  VH_THREAD_PAUSE_INIT (downloader)
 
   /* init statistics */
   vh_stats_grp_add (handle->stats,
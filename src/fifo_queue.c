@@ -22,32 +22,206 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdlib.h>
+#ifdef USE_FIFO_RING
+#include <sched.h>
+#endif /* USE_FIFO_RING */
 
 #include "fifo_queue.h"
 
+#ifdef USE_FIFO_RING
+
+#ifndef FIFO_QUEUE_RING_SIZE
+#define FIFO_QUEUE_RING_SIZE 1024 /* slots by lane, must be a power of 2 */
+#endif /* FIFO_QUEUE_RING_SIZE */
+
+#ifndef FIFO_QUEUE_CACHELINE
+#define FIFO_QUEUE_CACHELINE 64
+#endif /* FIFO_QUEUE_CACHELINE */
+
+#define RING_LOAD(v)        __atomic_load_n (&(v), __ATOMIC_ACQUIRE)
+#define RING_STORE(v, n)    __atomic_store_n (&(v), n, __ATOMIC_RELEASE)
+#define RING_CAS(v, o, n)                                               \
+  __atomic_compare_exchange_n (&(v), &(o), n, 1,                        \
+                               __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
 typedef struct fifo_queue_item_s {
   int id;
   void *data;
   struct fifo_queue_item_s *next;
 } fifo_queue_item_t;
 
-struct fifo_queue_s {
+typedef struct fifo_queue_slot_s {
+  unsigned long seq;
+  int id;
+  void *data;
+} fifo_queue_slot_t;
+
+/*
+ * Bounded MPMC ring (Vyukov's algorithm). The producers and the consumers
+ * use different cache lines. When the ring is full, the items are saved in
+ * the overflow list (protected by a mutex) until that the ring is empty.
+ */
+typedef struct fifo_queue_lane_s {
+  unsigned long tail;
+  char pad1[FIFO_QUEUE_CACHELINE - sizeof (unsigned long)];
+  unsigned long head;
+  char pad2[FIFO_QUEUE_CACHELINE - sizeof (unsigned long)];
+  int overflow_nb;
   fifo_queue_item_t *item;
   fifo_queue_item_t *item_last;
   pthread_mutex_t mutex;
+  char pad3[FIFO_QUEUE_CACHELINE];
+  fifo_queue_slot_t slots[FIFO_QUEUE_RING_SIZE];
+} fifo_queue_lane_t;
+
+struct fifo_queue_s {
+  fifo_queue_lane_t lane[2]; /* indexed by fifo_queue_prio_t */
+  pthread_mutex_t mutex;     /* for fifo_queue_unpop() */
   sem_t sem;
 };
 
 
+static int
+fifo_ring_push (fifo_queue_lane_t *lane, int id, void *data)
+{
+  fifo_queue_slot_t *slot;
+  unsigned long pos = __atomic_load_n (&lane->tail, __ATOMIC_RELAXED);
+
+  for (;;)
+  {
+    long dif;
+
+    slot = &lane->slots[pos & (FIFO_QUEUE_RING_SIZE - 1)];
+    dif = (long) RING_LOAD (slot->seq) - (long) pos;
+    if (!dif)
+    {
+      if (RING_CAS (lane->tail, pos, pos + 1))
+        break;
+    }
+    else if (dif < 0)
+      return -1; /* full */
+    else
+      pos = __atomic_load_n (&lane->tail, __ATOMIC_RELAXED);
+  }
+
+  slot->id   = id;
+  slot->data = data;
+  RING_STORE (slot->seq, pos + 1);
+  return 0;
+}
+
+static int
+fifo_ring_pop (fifo_queue_lane_t *lane, int *id, void **data)
+{
+  fifo_queue_slot_t *slot;
+  unsigned long pos = __atomic_load_n (&lane->head, __ATOMIC_RELAXED);
+
+  for (;;)
+  {
+    long dif;
+
+    slot = &lane->slots[pos & (FIFO_QUEUE_RING_SIZE - 1)];
+    dif = (long) RING_LOAD (slot->seq) - (long) (pos + 1);
+    if (!dif)
+    {
+      if (RING_CAS (lane->head, pos, pos + 1))
+        break;
+    }
+    else if (dif < 0)
+      return -1; /* empty */
+    else
+      pos = __atomic_load_n (&lane->head, __ATOMIC_RELAXED);
+  }
+
+  *id   = slot->id;
+  *data = slot->data;
+  RING_STORE (slot->seq, pos + FIFO_QUEUE_RING_SIZE);
+  return 0;
+}
+
+static int
+fifo_lane_push (fifo_queue_lane_t *lane, int id, void *data)
+{
+  fifo_queue_item_t *item;
+
+  /* The order is kept by using the overflow list as long as it is used. */
+  if (!RING_LOAD (lane->overflow_nb) && !fifo_ring_push (lane, id, data))
+    return 0;
+
+  item = calloc (1, sizeof (fifo_queue_item_t));
+  if (!item)
+    return -1;
+
+  item->id   = id;
+  item->data = data;
+
+  pthread_mutex_lock (&lane->mutex);
+  if (lane->item_last)
+    lane->item_last->next = item;
+  else
+    lane->item = item;
+  lane->item_last = item;
+  RING_STORE (lane->overflow_nb, lane->overflow_nb + 1);
+  pthread_mutex_unlock (&lane->mutex);
+
+  return 0;
+}
+
+static int
+fifo_lane_pop (fifo_queue_lane_t *lane, int *id, void **data)
+{
+  fifo_queue_item_t *item;
+
+  if (!fifo_ring_pop (lane, id, data))
+    return 0;
+
+  if (!RING_LOAD (lane->overflow_nb))
+    return -1;
+
+  pthread_mutex_lock (&lane->mutex);
+  item = lane->item;
+  if (item)
+  {
+    lane->item = item->next;
+    if (!lane->item)
+      lane->item_last = NULL;
+    RING_STORE (lane->overflow_nb, lane->overflow_nb - 1);
+  }
+  pthread_mutex_unlock (&lane->mutex);
+
+  if (!item)
+    return -1;
+
+  *id   = item->id;
+  *data = item->data;
+  free (item);
+  return 0;
+}
+
+static int
+fifo_queue_get (fifo_queue_t *queue, int *id, void **data)
+{
+  return fifo_lane_pop (&queue->lane[FIFO_QUEUE_PRIORITY_HIGH], id, data)
+      && fifo_lane_pop (&queue->lane[FIFO_QUEUE_PRIORITY_NORMAL], id, data);
+}
+
 fifo_queue_t *
 vh_fifo_queue_new (void)
 {
+  unsigned int i, j;
   fifo_queue_t *queue;
 
   queue = calloc (1, sizeof (fifo_queue_t));
   if (!queue)
     return NULL;
 
+  for (i = 0; i < sizeof (queue->lane) / sizeof (*queue->lane); i++)
+  {
+    for (j = 0; j < FIFO_QUEUE_RING_SIZE; j++)
+      queue->lane[i].slots[j].seq = j;
+    pthread_mutex_init (&queue->lane[i].mutex, NULL);
+  }
+
   pthread_mutex_init (&queue->mutex, NULL);
   sem_init (&queue->sem, 0, 0);
 
@@ -57,19 +231,18 @@ vh_fifo_queue_new (void)
 void
 vh_fifo_queue_free (fifo_queue_t *queue)
 {
-  fifo_queue_item_t *item, *next;
+  int id;
+  void *data;
+  unsigned int i;
 
   if (!queue)
     return;
 
-  item = queue->item;
-  while (item)
-  {
-    next = item->next;
-    free (item);
-    item = next;
-  }
+  while (!fifo_queue_get (queue, &id, &data))
+    ;
 
+  for (i = 0; i < sizeof (queue->lane) / sizeof (*queue->lane); i++)
+    pthread_mutex_destroy (&queue->lane[i].mutex);
   pthread_mutex_destroy (&queue->mutex);
   sem_destroy (&queue->sem);
 
@@ -80,51 +253,376 @@ int
 vh_fifo_queue_push (fifo_queue_t *queue,
                     fifo_queue_prio_t p, int id, void *data)
 {
-  fifo_queue_item_t *item;
+  if (!queue)
+    return FIFO_QUEUE_ERROR_QUEUE;
+
+  if (p != FIFO_QUEUE_PRIORITY_HIGH)
+    p = FIFO_QUEUE_PRIORITY_NORMAL;
+
+  if (fifo_lane_push (&queue->lane[p], id, data))
+    return FIFO_QUEUE_ERROR_MALLOC;
+
+  /* new entry in the queue is ok */
+  sem_post (&queue->sem);
+
+  return FIFO_QUEUE_SUCCESS;
+}
+
+int
+vh_fifo_queue_pop (fifo_queue_t *queue, int *id, void **data)
+{
+  int tmp_id;
+  void *tmp_data;
 
   if (!queue)
     return FIFO_QUEUE_ERROR_QUEUE;
 
-  pthread_mutex_lock (&queue->mutex);
+  /* wait on the queue */
+  sem_wait (&queue->sem);
 
-  item = queue->item;
-  if (item)
+  /*
+   * An entry exists for sure, but it can be not yet visible in the ring.
+   */
+  while (fifo_queue_get (queue, &tmp_id, &tmp_data))
+    sched_yield ();
+
+  if (id)
+    *id = tmp_id;
+  if (data)
+    *data = tmp_data;
+
+  return FIFO_QUEUE_SUCCESS;
+}
+
+int
+vh_fifo_queue_push_many (fifo_queue_t *queue, fifo_queue_prio_t p,
+                         const fifo_queue_msg_t *msg, unsigned int nb)
+{
+  unsigned int i;
+
+  if (!queue || !msg)
+    return FIFO_QUEUE_ERROR_QUEUE;
+
+  if (p != FIFO_QUEUE_PRIORITY_HIGH)
+    p = FIFO_QUEUE_PRIORITY_NORMAL;
+
+  for (i = 0; i < nb; i++)
   {
-    switch (p)
-    {
-    default:
-    case FIFO_QUEUE_PRIORITY_NORMAL:
-      queue->item_last->next = calloc (1, sizeof (fifo_queue_item_t));
-      item = queue->item_last->next;
-      if (item)
-        queue->item_last = item;
+    if (fifo_lane_push (&queue->lane[p], msg[i].id, msg[i].data))
       break;
+    sem_post (&queue->sem);
+  }
+
+  return i < nb ? FIFO_QUEUE_ERROR_MALLOC : FIFO_QUEUE_SUCCESS;
+}
+
+int
+vh_fifo_queue_pop_many (fifo_queue_t *queue,
+                        fifo_queue_msg_t *msg, unsigned int nb)
+{
+  unsigned int i;
+
+  if (!queue || !msg || !nb)
+    return FIFO_QUEUE_ERROR_QUEUE;
 
-    case FIFO_QUEUE_PRIORITY_HIGH:
+  /* wait on the queue, only for the first entry */
+  sem_wait (&queue->sem);
+
+  for (i = 0; i < nb; i++)
+  {
+    if (i && sem_trywait (&queue->sem))
+      break;
+
+    while (fifo_queue_get (queue, &msg[i].id, &msg[i].data))
+      sched_yield ();
+  }
+
+  return (int) i;
+}
+
+/*
+ * An entry can not be put back in front of a ring, then all entries are
+ * taken and pushed again after the entries in \p msg. The entries pushed or
+ * popped meanwhile by other threads would be reordered, then it must be
+ * used only when the producers and the consumers are stopped (the batch
+ * flush on the kill).
+ */
+static void
+fifo_queue_unpop (fifo_queue_t *queue,
+                  const fifo_queue_msg_t *msg, unsigned int nb)
+{
+  unsigned int i;
+  fifo_queue_item_t *list[2] = { NULL, NULL }, *last[2] = { NULL, NULL };
+  fifo_queue_item_t *item, *next;
+  static const fifo_queue_prio_t order[] = {
+    FIFO_QUEUE_PRIORITY_HIGH,
+    FIFO_QUEUE_PRIORITY_NORMAL,
+  };
+
+  pthread_mutex_lock (&queue->mutex);
+
+  for (i = 0; i < sizeof (order) / sizeof (*order); i++)
+  {
+    int e;
+    void *data;
+    fifo_queue_prio_t p = order[i];
+
+    while (!fifo_lane_pop (&queue->lane[p], &e, &data))
+    {
       item = calloc (1, sizeof (fifo_queue_item_t));
       if (!item)
+      {
+        fifo_lane_push (&queue->lane[p], e, data);
         break;
-      item->next = queue->item;
-      queue->item = item;
-      break;
+      }
+
+      item->id   = e;
+      item->data = data;
+
+      if (last[p])
+        last[p]->next = item;
+      else
+        list[p] = item;
+      last[p] = item;
     }
   }
-  else
+
+  /* These entries are popped first even if the HIGH lane is used. */
+  for (i = 0; i < nb; i++)
+    fifo_lane_push (&queue->lane[FIFO_QUEUE_PRIORITY_HIGH],
+                    msg[i].id, msg[i].data);
+
+  for (i = 0; i < sizeof (order) / sizeof (*order); i++)
+    for (item = list[order[i]]; item; item = next)
+    {
+      next = item->next;
+      fifo_lane_push (&queue->lane[order[i]], item->id, item->data);
+      free (item);
+    }
+
+  pthread_mutex_unlock (&queue->mutex);
+
+  for (i = 0; i < nb; i++)
+    sem_post (&queue->sem);
+}
+
+/* An entry can not be removed from the rings without breaking the order. */
+int
+vh_fifo_queue_steal_data (fifo_queue_t *queue, const void *data, int *id)
+{
+  (void) queue;
+  (void) data;
+  (void) id;
+  return -1;
+}
+
+/*
+ * The rings can not be rebuilt while the threads are running (the on-demand
+ * does not pause them), then the entry is not moved. Only its priority is
+ * changed for the next steps.
+ */
+int
+vh_fifo_queue_moveup_data (fifo_queue_t *queue, const void *data)
+{
+  (void) queue;
+  (void) data;
+  return -1;
+}
+
+#else /* USE_FIFO_RING */
+
+#ifndef FIFO_QUEUE_INDEX_SIZE
+#define FIFO_QUEUE_INDEX_SIZE 64 /* initial buckets, must be a power of 2 */
+#endif /* FIFO_QUEUE_INDEX_SIZE */
+
+typedef struct fifo_queue_item_s {
+  int id;
+  void *data;
+  long seq;  /* the order in the queue is the order of seq */
+  struct fifo_queue_item_s *next;
+  struct fifo_queue_item_s *prev;
+  struct fifo_queue_item_s *hnext; /* index by data pointer */
+} fifo_queue_item_t;
+
+struct fifo_queue_s {
+  fifo_queue_item_t *item;
+  fifo_queue_item_t *item_last;
+  long seq_first, seq_last;
+  pthread_mutex_t mutex;
+  sem_t sem;
+
+  fifo_queue_item_t **index;
+  unsigned int index_size;
+  unsigned int nb;
+};
+
+
+static inline unsigned int
+fifo_queue_hash (const void *data, unsigned int size)
+{
+  unsigned long v = (unsigned long) data;
+
+  v ^= v >> 16;
+  v *= 0x45d9f3bUL;
+  v ^= v >> 16;
+  return (unsigned int) v & (size - 1);
+}
+
+static void
+fifo_queue_index_grow (fifo_queue_t *queue)
+{
+  unsigned int i, size = queue->index_size * 2;
+  fifo_queue_item_t **index, *item, *next;
+
+  index = calloc (size, sizeof (*index));
+  if (!index)
+    return; /* the chains are only longer */
+
+  for (i = 0; i < queue->index_size; i++)
+    for (item = queue->index[i]; item; item = next)
+    {
+      unsigned int h = fifo_queue_hash (item->data, size);
+
+      next = item->hnext;
+      item->hnext = index[h];
+      index[h] = item;
+    }
+
+  free (queue->index);
+  queue->index = index;
+  queue->index_size = size;
+}
+
+/* The item is already initialized (id and data). */
+static void
+fifo_queue_link (fifo_queue_t *queue, fifo_queue_item_t *item,
+                 fifo_queue_prio_t p)
+{
+  unsigned int h;
+
+  if (!queue->item)
+  {
+    item->prev = item->next = NULL;
+    item->seq = queue->seq_first = queue->seq_last = 0;
+    queue->item = queue->item_last = item;
+  }
+  else if (p == FIFO_QUEUE_PRIORITY_HIGH)
   {
-    item = calloc (1, sizeof (fifo_queue_item_t));
+    item->prev = NULL;
+    item->next = queue->item;
+    item->seq  = --queue->seq_first;
+    queue->item->prev = item;
     queue->item = item;
+  }
+  else
+  {
+    item->next = NULL;
+    item->prev = queue->item_last;
+    item->seq  = ++queue->seq_last;
+    queue->item_last->next = item;
     queue->item_last = item;
   }
 
-  if (!item)
+  if (++queue->nb > queue->index_size)
+    fifo_queue_index_grow (queue);
+
+  h = fifo_queue_hash (item->data, queue->index_size);
+  item->hnext = queue->index[h];
+  queue->index[h] = item;
+}
+
+static void
+fifo_queue_unlink (fifo_queue_t *queue, fifo_queue_item_t *item)
+{
+  fifo_queue_item_t **it;
+
+  for (it = &queue->index[fifo_queue_hash (item->data, queue->index_size)];
+       *it; it = &(*it)->hnext)
+    if (*it == item)
+    {
+      *it = item->hnext;
+      break;
+    }
+
+  if (item->prev)
+    item->prev->next = item->next;
+  else
+    queue->item = item->next;
+
+  if (item->next)
+    item->next->prev = item->prev;
+  else
+    queue->item_last = item->prev;
+
+  queue->nb--;
+}
+
+fifo_queue_t *
+vh_fifo_queue_new (void)
+{
+  fifo_queue_t *queue;
+
+  queue = calloc (1, sizeof (fifo_queue_t));
+  if (!queue)
+    return NULL;
+
+  queue->index_size = FIFO_QUEUE_INDEX_SIZE;
+  queue->index = calloc (queue->index_size, sizeof (*queue->index));
+  if (!queue->index)
   {
-    pthread_mutex_unlock (&queue->mutex);
-    return FIFO_QUEUE_ERROR_MALLOC;
+    free (queue);
+    return NULL;
   }
 
+  pthread_mutex_init (&queue->mutex, NULL);
+  sem_init (&queue->sem, 0, 0);
+
+  return queue;
+}
+
+void
+vh_fifo_queue_free (fifo_queue_t *queue)
+{
+  fifo_queue_item_t *item, *next;
+
+  if (!queue)
+    return;
+
+  item = queue->item;
+  while (item)
+  {
+    next = item->next;
+    free (item);
+    item = next;
+  }
+
+  pthread_mutex_destroy (&queue->mutex);
+  sem_destroy (&queue->sem);
+
+  free (queue->index);
+  free (queue);
+}
+
+int
+vh_fifo_queue_push (fifo_queue_t *queue,
+                    fifo_queue_prio_t p, int id, void *data)
+{
+  fifo_queue_item_t *item;
+
+  if (!queue)
+    return FIFO_QUEUE_ERROR_QUEUE;
+
+  item = calloc (1, sizeof (fifo_queue_item_t));
+  if (!item)
+    return FIFO_QUEUE_ERROR_MALLOC;
+
   item->id = id;
   item->data = data;
 
+  pthread_mutex_lock (&queue->mutex);
+
+  fifo_queue_link (queue, item, p);
+
   /* new entry in the queue is ok */
   sem_post (&queue->sem);
 
@@ -136,7 +634,7 @@ vh_fifo_queue_push (fifo_queue_t *queue,
 int
 vh_fifo_queue_pop (fifo_queue_t *queue, int *id, void **data)
 {
-  fifo_queue_item_t *item, *next;
+  fifo_queue_item_t *item;
 
   if (!queue)
     return FIFO_QUEUE_ERROR_QUEUE;
@@ -158,67 +656,242 @@ vh_fifo_queue_pop (fifo_queue_t *queue, int *id, void **data)
     *data = item->data;
 
   /* remove the entry and go to the next */
-  next = item->next;
-  free (item);
-  queue->item = next;
+  fifo_queue_unlink (queue, item);
   pthread_mutex_unlock (&queue->mutex);
 
+  free (item);
+
   return FIFO_QUEUE_SUCCESS;
 }
 
-void *
-vh_fifo_queue_search (fifo_queue_t *queue, int *id, const void *tocmp,
-                      int (*cmp_fct) (const void *tocmp,
-                                      int id, const void *data))
+int
+vh_fifo_queue_push_many (fifo_queue_t *queue, fifo_queue_prio_t p,
+                         const fifo_queue_msg_t *msg, unsigned int nb)
 {
-  void *data = NULL;
-  fifo_queue_item_t *item;
+  unsigned int i;
+  fifo_queue_item_t **items;
 
-  if (!queue || !tocmp || !cmp_fct)
-    return NULL;
+  if (!queue || !msg)
+    return FIFO_QUEUE_ERROR_QUEUE;
 
-  pthread_mutex_lock (&queue->mutex);
+  if (!nb)
+    return FIFO_QUEUE_SUCCESS;
 
-  for (item = queue->item; item; item = item->next)
-    if (!cmp_fct (tocmp, item->id, item->data))
+  /* the items are prepared without lock */
+  items = malloc (nb * sizeof (*items));
+  if (!items)
+    return FIFO_QUEUE_ERROR_MALLOC;
+
+  for (i = 0; i < nb; i++)
+  {
+    items[i] = calloc (1, sizeof (fifo_queue_item_t));
+    if (!items[i])
     {
-      *id  = item->id;
-      data = item->data;
-      break;
+      while (i--)
+        free (items[i]);
+      free (items);
+      return FIFO_QUEUE_ERROR_MALLOC;
     }
 
+    items[i]->id   = msg[i].id;
+    items[i]->data = msg[i].data;
+  }
+
+  pthread_mutex_lock (&queue->mutex);
+
+  /* the HIGH entries are linked backward in order to keep the order */
+  for (i = 0; i < nb; i++)
+    fifo_queue_link (queue,
+                     items[p == FIFO_QUEUE_PRIORITY_HIGH ? nb - i - 1 : i], p);
+
+  /* new entries in the queue are ok */
+  for (i = 0; i < nb; i++)
+    sem_post (&queue->sem);
+
   pthread_mutex_unlock (&queue->mutex);
 
-  return data;
+  free (items);
+  return FIFO_QUEUE_SUCCESS;
 }
 
-void
-vh_fifo_queue_moveup (fifo_queue_t *queue, const void *tomove,
-                      int (*cmp_fct) (const void *tocmp,
-                                      int id, const void *data))
+int
+vh_fifo_queue_pop_many (fifo_queue_t *queue,
+                        fifo_queue_msg_t *msg, unsigned int nb)
 {
-  fifo_queue_item_t *item, *item_p = NULL;
+  unsigned int i;
+  fifo_queue_item_t *item, *list = NULL;
 
-  if (!queue || !tomove || !cmp_fct)
-    return;
+  if (!queue || !msg || !nb)
+    return FIFO_QUEUE_ERROR_QUEUE;
+
+  /* wait on the queue, only for the first entry */
+  sem_wait (&queue->sem);
 
   pthread_mutex_lock (&queue->mutex);
 
-  for (item = queue->item; item; item = item->next)
+  for (i = 0; i < nb && (item = queue->item); i++)
   {
-    if (!cmp_fct (tomove, item->id, item->data))
-    {
-      if (!item_p)
-        break;
-      item_p->next = item->next;
-      if (!item_p->next)
-        queue->item_last = item_p;
-      item->next = queue->item;
-      queue->item = item;
+    if (i && sem_trywait (&queue->sem))
       break;
-    }
-    item_p = item;
+
+    msg[i].id   = item->id;
+    msg[i].data = item->data;
+
+    fifo_queue_unlink (queue, item);
+    item->next = list;
+    list = item;
+  }
+
+  pthread_mutex_unlock (&queue->mutex);
+
+  for (item = list; item; item = list)
+  {
+    list = item->next;
+    free (item);
+  }
+
+  return i ? (int) i : FIFO_QUEUE_ERROR_EMPTY;
+}
+
+static void
+fifo_queue_unpop (fifo_queue_t *queue,
+                  const fifo_queue_msg_t *msg, unsigned int nb)
+{
+  vh_fifo_queue_push_many (queue, FIFO_QUEUE_PRIORITY_HIGH, msg, nb);
+}
+
+/*
+ * The first entry (in the order of the queue) with this data pointer is
+ * found with the index, without browsing the queue.
+ */
+int
+vh_fifo_queue_moveup_data (fifo_queue_t *queue, const void *data)
+{
+  fifo_queue_item_t *item, *first = NULL;
+
+  if (!queue || !data)
+    return -1;
+
+  pthread_mutex_lock (&queue->mutex);
+
+  for (item = queue->index[fifo_queue_hash (data, queue->index_size)];
+       item; item = item->hnext)
+    if (item->data == data && (!first || item->seq < first->seq))
+      first = item;
+
+  if (first && first->prev)
+  {
+    fifo_queue_unlink (queue, first);
+    fifo_queue_link (queue, first, FIFO_QUEUE_PRIORITY_HIGH);
+  }
+
+  pthread_mutex_unlock (&queue->mutex);
+
+  return first ? 0 : -1;
+}
+
+/*
+ * Remove the first entry with this data pointer. If the token of the entry
+ * is already taken by a consumer, this one will get FIFO_QUEUE_ERROR_EMPTY.
+ */
+int
+vh_fifo_queue_steal_data (fifo_queue_t *queue, const void *data, int *id)
+{
+  fifo_queue_item_t *item, *first = NULL;
+
+  if (!queue || !data)
+    return -1;
+
+  pthread_mutex_lock (&queue->mutex);
+
+  for (item = queue->index[fifo_queue_hash (data, queue->index_size)];
+       item; item = item->hnext)
+    if (item->data == data && (!first || item->seq < first->seq))
+      first = item;
+
+  if (first)
+  {
+    if (id)
+      *id = first->id;
+    fifo_queue_unlink (queue, first);
+    sem_trywait (&queue->sem);
   }
 
   pthread_mutex_unlock (&queue->mutex);
+
+  if (!first)
+    return -1;
+
+  free (first);
+  return 0;
+}
+
+#endif /* !USE_FIFO_RING */
+
+/*
+ * A consumer takes up to FIFO_QUEUE_BATCH_MAX entries with only one wakeup,
+ * then these entries are returned one by one.
+ */
+int
+vh_fifo_queue_batch_pop (fifo_queue_t *queue,
+                         fifo_queue_batch_t *batch, int *id, void **data)
+{
+  fifo_queue_msg_t *msg;
+
+  if (!queue || !batch)
+    return FIFO_QUEUE_ERROR_QUEUE;
+
+  if (batch->it >= batch->nb)
+  {
+    int res;
+
+    batch->it = 0;
+    batch->nb = 0;
+
+    res = vh_fifo_queue_pop_many (queue, batch->msg, FIFO_QUEUE_BATCH_MAX);
+    if (res < 0)
+      return res;
+
+    batch->nb = (unsigned int) res;
+  }
+
+  msg = &batch->msg[batch->it++];
+  if (id)
+    *id = msg->id;
+  if (data)
+    *data = msg->data;
+
+  return FIFO_QUEUE_SUCCESS;
+}
+
+/*
+ * The entries not yet handled are put back at the head of the queue (for
+ * example before a kill, then these are freed by the cleanup).
+ */
+void
+vh_fifo_queue_batch_flush (fifo_queue_t *queue, fifo_queue_batch_t *batch)
+{
+  if (!queue || !batch)
+    return;
+
+  if (batch->it < batch->nb)
+    fifo_queue_unpop (queue, &batch->msg[batch->it], batch->nb - batch->it);
+
+  batch->it = 0;
+  batch->nb = 0;
+}
+
+/*
+ * Number of entries in the queue. It is only an indication when the queue
+ * is used concurrently.
+ */
+unsigned int
+vh_fifo_queue_count (fifo_queue_t *queue)
+{
+  int val = 0;
+
+  if (!queue || sem_getvalue (&queue->sem, &val) || val < 0)
+    return 0;
+
+  return (unsigned int) val;
 }
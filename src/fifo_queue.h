@@ -36,6 +36,20 @@ typedef enum fifo_queue_prio {
   FIFO_QUEUE_PRIORITY_HIGH,
 } fifo_queue_prio_t;
 
+typedef struct fifo_queue_msg_s {
+  int id;
+  void *data;
+} fifo_queue_msg_t;
+
+#ifndef FIFO_QUEUE_BATCH_MAX
+#define FIFO_QUEUE_BATCH_MAX 32
+#endif /* FIFO_QUEUE_BATCH_MAX */
+
+/* Entries popped by a consumer and not yet handled. */
+typedef struct fifo_queue_batch_s {
+  fifo_queue_msg_t msg[FIFO_QUEUE_BATCH_MAX];
+  unsigned int nb, it;
+} fifo_queue_batch_t;
 
 fifo_queue_t *vh_fifo_queue_new (void);
 void vh_fifo_queue_free (fifo_queue_t *queue);
@@ -44,11 +58,18 @@ int vh_fifo_queue_push (fifo_queue_t *queue,
                         fifo_queue_prio_t p, int id, void *data);
 int vh_fifo_queue_pop (fifo_queue_t *queue, int *id, void **data);
 
-void *vh_fifo_queue_search (fifo_queue_t *queue, int *id, const void *tocmp,
-                            int (*cmp_fct) (const void *tocmp,
-                                            int id, const void *data));
-void vh_fifo_queue_moveup (fifo_queue_t *queue, const void *tomove,
-                           int (*cmp_fct) (const void *tocmp,
-                                           int id, const void *data));
+int vh_fifo_queue_push_many (fifo_queue_t *queue, fifo_queue_prio_t p,
+                             const fifo_queue_msg_t *msg, unsigned int nb);
+int vh_fifo_queue_pop_many (fifo_queue_t *queue,
+                            fifo_queue_msg_t *msg, unsigned int nb);
+
+int vh_fifo_queue_batch_pop (fifo_queue_t *queue,
+                             fifo_queue_batch_t *batch, int *id, void **data);
+void vh_fifo_queue_batch_flush (fifo_queue_t *queue,
+                                fifo_queue_batch_t *batch);
+
+int vh_fifo_queue_moveup_data (fifo_queue_t *queue, const void *data);
+int vh_fifo_queue_steal_data (fifo_queue_t *queue, const void *data, int *id);
+unsigned int vh_fifo_queue_count (fifo_queue_t *queue);
 
 #endif /* VALHALLA_FIFO_QUEUE_H */
@@ -101,8 +101,6 @@ struct grabber_s {
   unsigned int    run_id;
   pthread_mutex_t mutex_run;
 
-  VH_THREAD_PAUSE_ATTRS
-
   grabber_list_t *list;
   sem_t          *sem_grabber[GRABBER_NB_MAX];
   pthread_mutex_t mutex_grabber[GRABBER_NB_MAX];
@@ -344,12 +342,6 @@ grabber_thread (void *arg)
       continue;
     }
 
-    if (e == ACTION_PAUSE_THREAD)
-    {
-      VH_THREAD_PAUSE_ACTION (grabber)
-      continue;
-    }
-
     pdata = data;
 
     /*
@@ -417,7 +409,7 @@ grabber_thread (void *arg)
             __FUNCTION__, grab ? "continue" : "finished", pdata->file.path);
 
     vh_dispatcher_action_send (VH_HANDLE->dispatcher,
-                               pdata->priority, e, pdata);
+                               VH_FILE_DATA_GET (pdata, priority), e, pdata);
   }
   while (!grabber_is_stopped (grabber));
 
@@ -561,17 +553,6 @@ vh_grabber_next (grabber_t *grabber, const char *id)
   return it ? it->name : NULL;
 }
 
-void
-vh_grabber_pause (grabber_t *grabber)
-{
-  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
-
-  if (!grabber)
-    return;
-
-  VH_THREAD_PAUSE_FCT (grabber, grabber->nb)
-}
-
 void
 vh_grabber_stop (grabber_t *grabber, int f)
 {
@@ -594,8 +575,6 @@ vh_grabber_stop (grabber_t *grabber, int f)
 
     grabber->wait = 1;
 
-    VH_THREAD_PAUSE_FORCESTOP (grabber, grabber->nb)
-
     for (i = 0; i < grabber->nb; i++)
     {
       int rc;
@@ -639,7 +618,6 @@ vh_grabber_uninit (grabber_t *grabber)
     vh_timer_thread_delete (grabber->timer[i]);
     pthread_mutex_destroy (&grabber->mutex_grabber[i]);
   }
-  VH_THREAD_PAUSE_UNINIT (grabber)
 
   /* uninit all childs */
   for (it = grabber->list; it; it = it->next)
@@ -776,7 +754,6 @@ vh_grabber_init (valhalla_t *handle, unsigned int nb)
     grabber->timer[i] = vh_timer_thread_create ();
     pthread_mutex_init (&grabber->mutex_grabber[i], NULL);
   }
-  VH_THREAD_PAUSE_INIT (grabber)
 
   grabber->fifo = vh_fifo_queue_new ();
   if (!grabber->fifo)
@@ -207,14 +207,17 @@ grabber_ffmpeg_grab (void *priv, file_data_t *data)
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
-  ctx = vh_lavf_utils_open_input_file (data->file.path);
+  /* The context of the parser is used when available. */
+  ctx = vh_file_data_lavf_get (data);
+  if (!ctx)
+    ctx = vh_lavf_utils_open_input_file (data->file.path);
   if (!ctx)
     return -1;
 
   res = grabber_ffmpeg_properties_get (ffmpeg, ctx, data);
   /* TODO: res = grabber_ffmpeg_snapshot (ctx, data, pos); */
 
-  avformat_close_input (&ctx);
+  vh_lavf_utils_close_input_file (&ctx);
   return res;
 }
 
@@ -0,0 +1,192 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2009 Mathieu Schroeter <mathieu@schroetersa.ch>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Table of the files currently handled by the threads (between the scanner
+ * or the on-demand and the end in the dbmanager), indexed by path. The
+ * file_data_t are chained in the buckets without allocation.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "inflight.h"
+
+#ifndef INFLIGHT_SIZE
+#define INFLIGHT_SIZE 256 /* initial buckets, must be a power of 2 */
+#endif /* INFLIGHT_SIZE */
+
+struct inflight_s {
+  file_data_t   **bucket;
+  unsigned int    size;
+  unsigned int    nb;
+  pthread_mutex_t mutex;
+};
+
+
+static unsigned int
+inflight_hash (const char *str)
+{
+  unsigned int hash = 5381;
+
+  while (*str)
+    hash = (hash << 5) + hash + (unsigned char) *str++;
+  return hash;
+}
+
+static void
+inflight_grow (inflight_t *inflight)
+{
+  unsigned int i, size = inflight->size * 2;
+  file_data_t **bucket, *it, *next;
+
+  bucket = calloc (size, sizeof (*bucket));
+  if (!bucket)
+    return; /* the chains are only longer */
+
+  for (i = 0; i < inflight->size; i++)
+    for (it = inflight->bucket[i]; it; it = next)
+    {
+      unsigned int h = it->inflight_hash & (size - 1);
+
+      next = it->inflight_next;
+      it->inflight_next = bucket[h];
+      bucket[h] = it;
+    }
+
+  free (inflight->bucket);
+  inflight->bucket = bucket;
+  inflight->size   = size;
+}
+
+void
+vh_inflight_add (inflight_t *inflight, file_data_t *fdata)
+{
+  unsigned int h;
+
+  if (!inflight || !fdata || !fdata->file.path)
+    return;
+
+  fdata->inflight_hash = inflight_hash (fdata->file.path);
+
+  pthread_mutex_lock (&inflight->mutex);
+
+  if (++inflight->nb > inflight->size)
+    inflight_grow (inflight);
+
+  h = fdata->inflight_hash & (inflight->size - 1);
+  fdata->inflight_next = inflight->bucket[h];
+  inflight->bucket[h] = fdata;
+
+  pthread_mutex_unlock (&inflight->mutex);
+}
+
+void
+vh_inflight_del (inflight_t *inflight, file_data_t *fdata)
+{
+  file_data_t **it;
+
+  if (!inflight || !fdata || !fdata->file.path)
+    return;
+
+  pthread_mutex_lock (&inflight->mutex);
+
+  for (it = &inflight->bucket[fdata->inflight_hash & (inflight->size - 1)];
+       *it; it = &(*it)->inflight_next)
+    if (*it == fdata)
+    {
+      *it = fdata->inflight_next;
+      fdata->inflight_next = NULL;
+      inflight->nb--;
+      break;
+    }
+
+  pthread_mutex_unlock (&inflight->mutex);
+}
+
+/*
+ * The callback is called with the table locked, then the file_data_t can
+ * not be released by the dbmanager in the meantime.
+ */
+int
+vh_inflight_promote (inflight_t *inflight, const char *path,
+                     void (*promote) (file_data_t *fdata, void *data),
+                     void *data)
+{
+  int res = -1;
+  unsigned int hash;
+  file_data_t *it;
+
+  if (!inflight || !path || !promote)
+    return -1;
+
+  hash = inflight_hash (path);
+
+  pthread_mutex_lock (&inflight->mutex);
+
+  for (it = inflight->bucket[hash & (inflight->size - 1)];
+       it; it = it->inflight_next)
+    if (it->inflight_hash == hash && !strcmp (it->file.path, path))
+    {
+      promote (it, data);
+      res = 0;
+      break;
+    }
+
+  pthread_mutex_unlock (&inflight->mutex);
+
+  return res;
+}
+
+void
+vh_inflight_free (inflight_t *inflight)
+{
+  if (!inflight)
+    return;
+
+  pthread_mutex_destroy (&inflight->mutex);
+  free (inflight->bucket);
+  free (inflight);
+}
+
+inflight_t *
+vh_inflight_new (void)
+{
+  inflight_t *inflight;
+
+  inflight = calloc (1, sizeof (inflight_t));
+  if (!inflight)
+    return NULL;
+
+  inflight->size   = INFLIGHT_SIZE;
+  inflight->bucket = calloc (inflight->size, sizeof (*inflight->bucket));
+  if (!inflight->bucket)
+  {
+    free (inflight);
+    return NULL;
+  }
+
+  pthread_mutex_init (&inflight->mutex, NULL);
+
+  return inflight;
+}
@@ -0,0 +1,39 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2009 Mathieu Schroeter <mathieu@schroetersa.ch>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef VALHALLA_INFLIGHT_H
+#define VALHALLA_INFLIGHT_H
+
+#include "utils.h"
+
+typedef struct inflight_s inflight_t;
+
+
+inflight_t *vh_inflight_new (void);
+void vh_inflight_free (inflight_t *inflight);
+
+void vh_inflight_add (inflight_t *inflight, file_data_t *fdata);
+void vh_inflight_del (inflight_t *inflight, file_data_t *fdata);
+int vh_inflight_promote (inflight_t *inflight, const char *path,
+                         void (*promote) (file_data_t *fdata, void *data),
+                         void *data);
+
+#endif /* VALHALLA_INFLIGHT_H */
@@ -20,15 +20,27 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <libavformat/avformat.h>
 
 #include "valhalla.h"
 #include "valhalla_internals.h"
 #include "logs.h"
+#include "stats.h"
 #include "lavf_utils.h"
 
+#define STATS_GROUP "lavf"
+
+#define ATOMIC_INC(v)   __atomic_add_fetch (&(v), 1, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(v)  __atomic_load_n (&(v), __ATOMIC_RELAXED)
+#define ATOMIC_STORE(v, n) __atomic_store_n (&(v), n, __ATOMIC_RELAXED)
+
 static const struct fileext_s {
   const char *fmtname;
   const char *suffix;
@@ -91,22 +103,105 @@ static const struct fileext_s {
   { NULL,                      NULL   },
 };
 
-const char *
-vh_lavf_utils_fmtname_get (const char *suffix)
+/*
+ * Suffixes sorted at the init with their demuxer. The names of all demuxers
+ * are added after g_fileext, then a suffix is resolved like with
+ * av_find_input_format() but without browsing the demuxers.
+ *
+ * The guesses are counted by suffix. When the demuxer found by libavformat
+ * is not the guess, it is saved as fallback and probed before the full
+ * probing of libavformat (or even before the guess when it is more often
+ * the right one). The fallback is an entry of the table, then its name is
+ * not read in the AVInputFormat (the parser can change it).
+ */
+typedef struct lavf_utils_fmt_s {
+  char          *suffix;
+  const char    *fmtname;
+  AVInputFormat *fmt;
+  unsigned int   order;
+
+  const struct lavf_utils_fmt_s *fallback;
+  unsigned long  hit;
+  unsigned long  fb_hit;
+  unsigned long  miss;
+} lavf_utils_fmt_t;
+
+static lavf_utils_fmt_t *g_fmt;
+static unsigned int      g_fmt_nb;
+
+static int
+lavf_utils_fmt_cmp (const void *a, const void *b)
+{
+  const lavf_utils_fmt_t *fa = a, *fb = b;
+  int res = strcasecmp (fa->suffix, fb->suffix);
+  return res ? res : (int) fa->order - (int) fb->order;
+}
+
+static int
+lavf_utils_fmt_find_cmp (const void *key, const void *b)
+{
+  return strcasecmp (key, ((const lavf_utils_fmt_t *) b)->suffix);
+}
+
+static int
+lavf_utils_fmt_add (unsigned int *max, const char *suffix, size_t len,
+                    const char *fmtname, AVInputFormat *fmt)
 {
-  const struct fileext_s *it;
+  lavf_utils_fmt_t *it;
+
+  if (g_fmt_nb == *max)
+  {
+    unsigned int size = *max ? *max * 2 : 128;
+    it = realloc (g_fmt, size * sizeof (*g_fmt));
+    if (!it)
+      return -1;
+    g_fmt = it;
+    *max  = size;
+  }
+
+  it = g_fmt + g_fmt_nb;
+  memset (it, 0, sizeof (*it));
+  it->suffix = strndup (suffix, len);
+  if (!it->suffix)
+    return -1;
+
+  it->fmtname = fmtname ? fmtname : it->suffix;
+  it->fmt     = fmt;
+  it->order   = g_fmt_nb++;
+  return 0;
+}
 
-  if (!suffix)
+static const lavf_utils_fmt_t *
+lavf_utils_fmt_find (const char *suffix)
+{
+  if (!suffix || !g_fmt)
     return NULL;
 
-  for (it = g_fileext; it->fmtname; it++)
-    if (!strcasecmp (suffix, it->suffix))
-      return it->fmtname;
+  return bsearch (suffix, g_fmt, g_fmt_nb, sizeof (*g_fmt),
+                  lavf_utils_fmt_find_cmp);
+}
+
+/* Browsed only after a wrong guess. */
+static const lavf_utils_fmt_t *
+lavf_utils_fmt_find_demuxer (const AVInputFormat *fmt)
+{
+  unsigned int i;
+
+  for (i = 0; i < g_fmt_nb; i++)
+    if (g_fmt[i].fmt == fmt)
+      return g_fmt + i;
 
-  return suffix;
+  return NULL;
 }
 
-static const char *
+const char *
+vh_lavf_utils_fmtname_get (const char *suffix)
+{
+  const lavf_utils_fmt_t *it = lavf_utils_fmt_find (suffix);
+  return it ? it->fmtname : suffix;
+}
+
+static lavf_utils_fmt_t *
 suffix_fmt_guess (const char *file)
 {
   const char *it;
@@ -118,12 +213,217 @@ suffix_fmt_guess (const char *file)
   if (it)
     it++;
 
-  return vh_lavf_utils_fmtname_get (it);
+  /* The counters and the fallback are the only fields changed later. */
+  return (lavf_utils_fmt_t *) lavf_utils_fmt_find (it);
 }
 
 #define PROBE_BUF_MIN 2048
 #define PROBE_BUF_MAX (1 << 20)
 
+#define LAVF_IO_BUF_SIZE 32768
+
+/* Bytes hashed at the head and at the tail for the fingerprint. */
+#define LAVF_FP_SIZE 4096
+
+/*
+ * The head of the file is read only one time, for the fingerprint, for the
+ * probes of the format and for libavformat (with its AVIOContext). The
+ * structure is kept by thread in order to reuse the buffer with the next
+ * file.
+ */
+typedef struct lavf_utils_io_s {
+  FILE    *fd;
+  int64_t  size;     /* size of the file */
+  int64_t  mtime;
+  int64_t  pos;      /* position of libavformat */
+  int64_t  fpos;     /* position of fd */
+
+  uint8_t *head;
+  int      head_max; /* allocated (without the padding) */
+  int      head_size;
+  char    *file;     /* head kept after the fingerprint of this file */
+} lavf_utils_io_t;
+
+static pthread_key_t  g_io_key;
+static pthread_once_t g_io_once = PTHREAD_ONCE_INIT;
+
+static void
+lavf_utils_io_destroy (void *arg)
+{
+  lavf_utils_io_t *io = arg;
+
+  if (!io)
+    return;
+
+  if (io->head)
+    free (io->head);
+  if (io->file)
+    free (io->file);
+  free (io);
+}
+
+static void
+lavf_utils_io_key (void)
+{
+  pthread_key_create (&g_io_key, lavf_utils_io_destroy);
+}
+
+/*
+ * The AVFormatContext can be closed by an other thread, then the structure
+ * is removed of the thread while it is used and it is given back to the
+ * thread which closes the file.
+ */
+static void
+lavf_utils_io_free (lavf_utils_io_t *io, const char *file)
+{
+  if (!io)
+    return;
+
+  if (io->fd)
+    fclose (io->fd);
+  io->fd = NULL;
+
+  if (io->file)
+    free (io->file);
+  io->file = file ? strdup (file) : NULL;
+  if (!io->file)
+    io->head_size = 0;
+
+  if (pthread_getspecific (g_io_key))
+    lavf_utils_io_destroy (io);
+  else
+    pthread_setspecific (g_io_key, io);
+}
+
+static lavf_utils_io_t *
+lavf_utils_io_open (const char *file)
+{
+  struct stat st;
+  lavf_utils_io_t *io;
+
+  pthread_once (&g_io_once, lavf_utils_io_key);
+
+  io = pthread_getspecific (g_io_key);
+  if (io)
+    pthread_setspecific (g_io_key, NULL);
+  else
+  {
+    io = calloc (1, sizeof (lavf_utils_io_t));
+    if (!io)
+      return NULL;
+  }
+
+  io->fd = fopen (file, "rb");
+  if (!io->fd || fstat (fileno (io->fd), &st))
+  {
+    lavf_utils_io_free (io, NULL);
+    return NULL;
+  }
+
+  /* The head of the fingerprint is reused only for the same content. */
+  if (!io->file || strcmp (io->file, file)
+      || io->size != st.st_size || io->mtime != st.st_mtime)
+    io->head_size = 0;
+  if (io->file)
+    free (io->file);
+  io->file = NULL;
+
+  io->size  = st.st_size;
+  io->mtime = st.st_mtime;
+  io->pos   = 0;
+  io->fpos  = -1;
+  return io;
+}
+
+/* Read the head of the file up to size bytes (less only with EOF). */
+static int
+lavf_utils_io_fill (lavf_utils_io_t *io, int size)
+{
+  size_t n;
+
+  if (size <= io->head_size)
+    return size;
+
+  if (size > io->head_max)
+  {
+    uint8_t *tmp = realloc (io->head, size + AVPROBE_PADDING_SIZE);
+    if (!tmp)
+      return io->head_size;
+
+    io->head     = tmp;
+    io->head_max = size;
+  }
+
+  if (io->fpos != io->head_size
+      && fseeko (io->fd, io->head_size, SEEK_SET))
+    return io->head_size;
+
+  n = fread (io->head + io->head_size, 1, size - io->head_size, io->fd);
+  io->head_size += n;
+  io->fpos       = io->head_size;
+
+  memset (io->head + io->head_size, 0, AVPROBE_PADDING_SIZE);
+  return io->head_size;
+}
+
+static int
+lavf_utils_io_read (void *opaque, uint8_t *buf, int buf_size)
+{
+  size_t n;
+  lavf_utils_io_t *io = opaque;
+
+  if (io->pos < io->head_size)
+  {
+    n = io->head_size - io->pos;
+    if (n > (size_t) buf_size)
+      n = buf_size;
+    memcpy (buf, io->head + io->pos, n);
+  }
+  else
+  {
+    if (io->fpos != io->pos && fseeko (io->fd, io->pos, SEEK_SET))
+      return AVERROR (EIO);
+
+    n = fread (buf, 1, buf_size, io->fd);
+    io->fpos = io->pos + n;
+  }
+
+  io->pos += n;
+  return n ? (int) n : AVERROR_EOF;
+}
+
+static int64_t
+lavf_utils_io_seek (void *opaque, int64_t offset, int whence)
+{
+  lavf_utils_io_t *io = opaque;
+
+  switch (whence & ~AVSEEK_FORCE)
+  {
+  case AVSEEK_SIZE:
+    return io->size;
+
+  case SEEK_SET:
+    break;
+
+  case SEEK_CUR:
+    offset += io->pos;
+    break;
+
+  case SEEK_END:
+    offset += io->size;
+    break;
+
+  default:
+    return -1;
+  }
+
+  if (offset < 0)
+    return -1;
+
+  io->pos = offset;
+  return offset;
+}
+
 /*
  * This function is fully inspired of (libavformat/utils.c v52.28.0
  * "av_open_input_file()") to probe data in order to test if *ftm argument
@@ -138,10 +438,8 @@ suffix_fmt_guess (const char *file)
  *          and can be "broken" with future versions of FFmpeg.
  */
 static int
-lavf_utils_probe (AVInputFormat *fmt, const char *file)
+lavf_utils_probe (AVInputFormat *fmt, lavf_utils_io_t *io, const char *file)
 {
-  FILE *fd;
-  int rc = 0;
   int p_size;
   AVProbeData p_data;
 
@@ -154,87 +452,328 @@ lavf_utils_probe (AVInputFormat *fmt, const char *file)
 
   /* No file should be opened here. */
   if (fmt->flags & AVFMT_NOFILE)
-  {
-    rc = fmt->read_probe (&p_data);
-    goto out;
-  }
+    return fmt->read_probe (&p_data);
 
-  fd = fopen (file, "rb");
-  if (!fd)
+  if (!io)
     return 0;
 
+  /* Each probe only reads the bytes after the previous window. */
   for (p_size = PROBE_BUF_MIN; p_size <= PROBE_BUF_MAX; p_size <<= 1)
   {
     int score;
     int score_max = p_size < PROBE_BUF_MAX ? AVPROBE_SCORE_MAX / 4 : 0;
 
-    p_data.buf = realloc (p_data.buf, p_size + AVPROBE_PADDING_SIZE);
-    if (!p_data.buf)
-      break;
-
-    p_data.buf_size = fread (p_data.buf, 1, p_size, fd);
-    if (p_data.buf_size != p_size) /* EOF is reached? */
+    if (lavf_utils_io_fill (io, p_size) != p_size) /* EOF is reached? */
       break;
 
-    memset (p_data.buf + p_data.buf_size, 0, AVPROBE_PADDING_SIZE);
-
-    if (fseek (fd, 0, SEEK_SET))
-      break;
+    p_data.buf = io->head;
+    p_data.buf_size = p_size;
 
     score = fmt->read_probe (&p_data);
     if (score > score_max)
-    {
-      rc = score;
-      break;
-    }
+      return score;
   }
 
-  fclose (fd);
+  return 0;
+}
 
- out:
-  if (p_data.buf)
-    free (p_data.buf);
-  return rc;
+static void
+lavf_utils_io_close (AVIOContext **pb)
+{
+  if (!*pb)
+    return;
+
+  lavf_utils_io_free ((*pb)->opaque, NULL);
+  av_freep (&(*pb)->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT (57, 80, 100)
+  avio_context_free (pb);
+#else
+  av_freep (pb);
+#endif
 }
 
 AVFormatContext *
 vh_lavf_utils_open_input_file (const char *file)
 {
   int res;
-  const char *name;
+  unsigned int i;
+  uint8_t           *buf;
+  lavf_utils_io_t   *io;
+  lavf_utils_fmt_t  *guess;
+  AVIOContext       *pb = NULL;
   AVFormatContext   *ctx;
   AVInputFormat     *fmt = NULL;
+  const lavf_utils_fmt_t *fmts[2] = { NULL, NULL };
 
   ctx = avformat_alloc_context ();
   if (!ctx)
     return NULL;
 
+  io = lavf_utils_io_open (file);
+
   ctx->flags |= AVFMT_FLAG_IGNIDX;
 
   /*
    * Try a format in function of the suffix.
    * We gain a lot of speed if the fmt is already the right.
    */
-  name = suffix_fmt_guess (file);
-  if (name)
-    fmt = av_find_input_format (name);
+  guess = suffix_fmt_guess (file);
+  if (guess)
+  {
+    fmts[0] = guess;
+    fmts[1] = ATOMIC_LOAD (guess->fallback);
+    if (ATOMIC_LOAD (guess->fb_hit) > ATOMIC_LOAD (guess->hit))
+    {
+      fmts[0] = fmts[1];
+      fmts[1] = guess;
+    }
+  }
 
-  if (fmt)
+  for (i = 0; i < 2 && !fmt; i++)
   {
-    int score = lavf_utils_probe (fmt, file);
+    int score;
+
+    if (!fmts[i] || !fmts[i]->fmt)
+      continue;
+
+    score = lavf_utils_probe (fmts[i]->fmt, io, file);
     vh_log (VALHALLA_MSG_VERBOSE,
-            "Probe score (%i) [%s] : %s", score, name, file);
-    if (!score) /* Bad score? */
-      fmt = NULL;
+            "Probe score (%i) [%s] : %s", score, fmts[i]->fmtname, file);
+    if (score) /* Good score? */
+      fmt = fmts[i]->fmt;
+  }
+
+  if (fmt && fmt == guess->fmt)
+    ATOMIC_INC (guess->hit);
+  else if (fmt)
+    ATOMIC_INC (guess->fb_hit);
+
+  /* libavformat continues with the head already read for the probes. */
+  if (io && !(fmt && fmt->flags & AVFMT_NOFILE))
+  {
+    buf = av_malloc (LAVF_IO_BUF_SIZE);
+    if (buf)
+      pb = avio_alloc_context (buf, LAVF_IO_BUF_SIZE, 0, io,
+                               lavf_utils_io_read, NULL, lavf_utils_io_seek);
+    if (pb)
+      ctx->pb = pb;
+    else if (buf)
+      av_free (buf);
   }
 
+  if (!pb)
+    lavf_utils_io_free (io, NULL);
+
   res = avformat_open_input(&ctx, file, fmt, NULL);
   if (res)
   {
+    lavf_utils_io_close (&pb);
     vh_log (VALHALLA_MSG_WARNING,
             "FFmpeg can't open file (%i) : %s", res, file);
     return NULL;
   }
 
+  /* Wrong guess, the demuxer of libavformat is learned for this suffix. */
+  if (guess && !fmt)
+  {
+    const lavf_utils_fmt_t *fb = lavf_utils_fmt_find_demuxer (ctx->iformat);
+
+    ATOMIC_INC (guess->miss);
+    if (fb && ctx->iformat != guess->fmt)
+      ATOMIC_STORE (guess->fallback, fb);
+  }
+
   return ctx;
 }
+
+/*
+ * FNV-1a hash on the head and the tail of the file. The head is kept for
+ * the probes when the file is opened next by the same thread, then only
+ * the tail is an additional read.
+ */
+int
+vh_lavf_utils_fingerprint (const char *file, int64_t *fp)
+{
+  int i, n;
+  uint8_t tail[LAVF_FP_SIZE];
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  lavf_utils_io_t *io;
+
+  if (!file || !fp)
+    return -1;
+
+  io = lavf_utils_io_open (file);
+  if (!io)
+    return -1;
+
+  n = lavf_utils_io_fill (io, LAVF_FP_SIZE);
+  for (i = 0; i < n; i++)
+  {
+    hash ^= io->head[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  n = 0;
+  if (io->size > LAVF_FP_SIZE
+      && !fseeko (io->fd, io->size - LAVF_FP_SIZE, SEEK_SET))
+    n = fread (tail, 1, sizeof (tail), io->fd);
+  io->fpos = -1;
+
+  for (i = 0; i < n; i++)
+  {
+    hash ^= tail[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  lavf_utils_io_free (io, file);
+  *fp = (int64_t) hash;
+  return 0;
+}
+
+void
+vh_lavf_utils_close_input_file (AVFormatContext **ctx)
+{
+  AVIOContext *pb = NULL;
+
+  if (!ctx || !*ctx)
+    return;
+
+  /* The AVIOContext is not released by libavformat. */
+  if ((*ctx)->flags & AVFMT_FLAG_CUSTOM_IO)
+    pb = (*ctx)->pb;
+
+  avformat_close_input (ctx);
+  lavf_utils_io_close (&pb);
+}
+
+/*
+ * The head read for the probes (up to PROBE_BUF_MAX) is released for a
+ * context which is kept opened; the next reads are done in the file.
+ */
+void
+vh_lavf_utils_head_free (AVFormatContext *ctx)
+{
+  lavf_utils_io_t *io;
+
+  if (!ctx || !(ctx->flags & AVFMT_FLAG_CUSTOM_IO) || !ctx->pb)
+    return;
+
+  io = ctx->pb->opaque;
+  if (!io || !io->head)
+    return;
+
+  free (io->head);
+  io->head      = NULL;
+  io->head_max  = 0;
+  io->head_size = 0;
+}
+
+static void
+lavf_utils_stats_dump (vh_stats_t *stats, void *data)
+{
+  unsigned int i;
+
+  (void) data;
+
+  if (!stats)
+    return;
+
+  vh_log (VALHALLA_MSG_INFO, "==============================");
+  vh_log (VALHALLA_MSG_INFO, "Statistics dump (" STATS_GROUP ")");
+  vh_log (VALHALLA_MSG_INFO, "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~");
+  vh_log (VALHALLA_MSG_INFO, "Suffix   | Guess | Fallback | Probed | Learned");
+
+  for (i = 0; i < g_fmt_nb; i++)
+  {
+    const lavf_utils_fmt_t *it = g_fmt + i;
+    const lavf_utils_fmt_t *fb = ATOMIC_LOAD (it->fallback);
+    unsigned long hit    = ATOMIC_LOAD (it->hit);
+    unsigned long fb_hit = ATOMIC_LOAD (it->fb_hit);
+    unsigned long miss   = ATOMIC_LOAD (it->miss);
+
+    if (!hit && !fb_hit && !miss)
+      continue;
+
+    vh_log (VALHALLA_MSG_INFO, "%-8s | %5lu | %8lu | %6lu | %s",
+            it->suffix, hit, fb_hit, miss, fb ? fb->fmtname : "");
+  }
+}
+
+void
+vh_lavf_utils_stats (vh_stats_t *stats)
+{
+  vh_stats_grp_add (stats, STATS_GROUP, lavf_utils_stats_dump, NULL);
+}
+
+void
+vh_lavf_utils_uninit (void)
+{
+  unsigned int i;
+
+  for (i = 0; i < g_fmt_nb; i++)
+    free (g_fmt[i].suffix);
+
+  if (g_fmt)
+    free (g_fmt);
+  g_fmt    = NULL;
+  g_fmt_nb = 0;
+}
+
+/* Must be called after av_register_all(). */
+int
+vh_lavf_utils_init (void)
+{
+  unsigned int i, j, max = 0;
+  const struct fileext_s *ext;
+  AVInputFormat *fmt = NULL;
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT (58, 9, 100)
+  void *opaque = NULL;
+#endif /* LIBAVFORMAT_VERSION_INT */
+
+  for (ext = g_fileext; ext->fmtname; ext++)
+    if (lavf_utils_fmt_add (&max, ext->suffix, strlen (ext->suffix),
+                            ext->fmtname, av_find_input_format (ext->fmtname)))
+      goto err;
+
+  /* A demuxer is found by each name of its list (like "mov,mp4,m4a"). */
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT (58, 9, 100)
+  while ((fmt = (AVInputFormat *) av_demuxer_iterate (&opaque)))
+#else
+  while ((fmt = av_iformat_next (fmt)))
+#endif /* LIBAVFORMAT_VERSION_INT */
+  {
+    const char *it = fmt->name;
+
+    while (it && *it)
+    {
+      size_t len = strcspn (it, ",");
+
+      if (len && lavf_utils_fmt_add (&max, it, len, NULL, fmt))
+        goto err;
+
+      it += len;
+      if (*it)
+        it++;
+    }
+  }
+
+  /* Sorted by suffix, the first added is kept with the duplicates. */
+  qsort (g_fmt, g_fmt_nb, sizeof (*g_fmt), lavf_utils_fmt_cmp);
+  for (i = 0, j = 0; i < g_fmt_nb; i++)
+  {
+    if (j && !strcasecmp (g_fmt[j - 1].suffix, g_fmt[i].suffix))
+    {
+      free (g_fmt[i].suffix);
+      continue;
+    }
+    g_fmt[j++] = g_fmt[i];
+  }
+  g_fmt_nb = j;
+
+  vh_log (VALHALLA_MSG_VERBOSE, "%u suffixes for the demuxers", g_fmt_nb);
+  return 0;
+
+ err:
+  vh_lavf_utils_uninit ();
+  return -1;
+}
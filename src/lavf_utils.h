@@ -22,7 +22,16 @@
 #ifndef VALHALLA_LAVF_UTILS
 #define VALHALLA_LAVF_UTILS
 
+#include "stats.h"
+
+int vh_lavf_utils_init (void);
+void vh_lavf_utils_uninit (void);
+void vh_lavf_utils_stats (vh_stats_t *stats);
+
 const char *vh_lavf_utils_fmtname_get (const char *suffix);
 AVFormatContext *vh_lavf_utils_open_input_file (const char *file);
+void vh_lavf_utils_close_input_file (AVFormatContext **ctx);
+int vh_lavf_utils_fingerprint (const char *file, int64_t *fp);
+void vh_lavf_utils_head_free (AVFormatContext *ctx);
 
 #endif /* VALHALLA_LAVF_UTILS */
@@ -36,6 +36,7 @@
 #include "dispatcher.h"
 #include "parser.h"
 #include "scanner.h"
+#include "inflight.h"
 #include "ondemand.h"
 
 #ifdef USE_GRABBER
@@ -57,6 +58,8 @@ struct ondemand_s {
 
   vh_stats_cnt_t *st_cnt;
   vh_stats_tmr_t *st_tmr;
+
+  fifo_queue_t *queue[8]; /* where an in-flight file can wait */
 };
 
 #define STATS_GROUP "ondemand"
@@ -72,28 +75,29 @@ ondemand_is_stopped (ondemand_t *ondemand)
   return !run;
 }
 
-static int
-ondemand_cmp_fct (const void *tocmp, int id, const void *data)
+/*
+ * Called with the in-flight table locked. The file is moved up in the queues
+ * where it is waiting (if any); the next steps use its new priority.
+ */
+static void
+ondemand_promote (file_data_t *fdata, void *data)
 {
-  const char *file = tocmp;
-  const file_data_t *fdata = data;
-
-  if (!tocmp || !data)
-    return -1;
+  unsigned int i;
+  ondemand_t *ondemand = data;
 
-  switch (id)
+  if (VH_FILE_DATA_GET (fdata, step) != STEP_ENDING)
   {
-  case ACTION_DB_INSERT_P:
-  case ACTION_DB_INSERT_G:
-  case ACTION_DB_UPDATE_P:
-  case ACTION_DB_UPDATE_G:
-  case ACTION_DB_END:
-  case ACTION_DB_NEWFILE:
-    return strcmp (file, fdata->file.path);
-
-  default:
-    return -1;
+    VH_FILE_DATA_SET (fdata, priority, FIFO_QUEUE_PRIORITY_HIGH);
+
+    /* The file waiting for the parser goes in the fast lane. */
+    if (vh_parser_promote (VH_HANDLE->parser, fdata))
+      for (i = 0; ondemand->queue[i]; i++)
+        vh_fifo_queue_moveup_data (ondemand->queue[i], fdata);
   }
+
+  /* The other threads only read 'od', then it can not be lost. */
+  if (VH_FILE_DATA_GET (fdata, od) == OD_TYPE_DEF)
+    VH_FILE_DATA_SET (fdata, od, OD_TYPE_UPD);
 }
 
 static void *
@@ -107,25 +111,6 @@ ondemand_thread (void *arg)
   file_data_t *fdata;
   ondemand_t *ondemand = arg;
 
-  struct {
-    void *handler;
-    void (*fct_pause) (void *handler);
-    fifo_queue_t *(*fct_fifo_get) (void *handler);
-  } pause[] = {
-    /*
-     * Because the grabber can be in waiting on the dbmanager, it must be
-     * the first to be sent in the pause mode. And in all cases, it is better
-     * to keep the dbmanager at the end of this list.
-     */
-#ifdef USE_GRABBER
-    { NULL, (void *) vh_grabber_pause,    (void *) vh_grabber_fifo_get    },
-    { NULL, (void *) vh_downloader_pause, (void *) vh_downloader_fifo_get },
-#endif /* USE_GRABBER */
-    { NULL, (void *) vh_parser_pause,     (void *) vh_parser_fifo_get     },
-    { NULL, (void *) vh_dispatcher_pause, (void *) vh_dispatcher_fifo_get },
-    { NULL, (void *) vh_dbmanager_pause,  (void *) vh_dbmanager_fifo_get  },
-  };
-
   if (!ondemand)
     pthread_exit (NULL);
 
@@ -134,17 +119,18 @@ ondemand_thread (void *arg)
   vh_log (VALHALLA_MSG_VERBOSE,
           "[%s] tid: %i priority: %i", __FUNCTION__, tid, ondemand->priority);
 
+  /* Queues where an in-flight file can wait, NULL-terminated. */
 #ifdef USE_GRABBER
-  pause[i++].handler = VH_HANDLE->grabber;
-  pause[i++].handler = VH_HANDLE->downloader;
+  ondemand->queue[i++] = vh_grabber_fifo_get (VH_HANDLE->grabber);
+  ondemand->queue[i++] = vh_downloader_fifo_get (VH_HANDLE->downloader);
 #endif /* USE_GRABBER */
-  pause[i++].handler = VH_HANDLE->parser;
-  pause[i++].handler = VH_HANDLE->dispatcher;
-  pause[i++].handler = VH_HANDLE->dbmanager;
+  ondemand->queue[i++] = vh_parser_fifo_get (VH_HANDLE->parser);
+  ondemand->queue[i++] = vh_dispatcher_fifo_get (VH_HANDLE->dispatcher);
+  ondemand->queue[i++] = vh_dbmanager_fifo_get (VH_HANDLE->dbmanager);
+  ondemand->queue[i]   = NULL;
 
   do
   {
-    int id = 0;
     struct stat st;
     e = ACTION_NO_OPERATION;
     data = NULL;
@@ -185,39 +171,13 @@ ondemand_thread (void *arg)
     VH_STATS_TIMER_START (ondemand->st_tmr);
 
     /*
-     * On-demand engaged, all threads must be in pause mode.
-     * After this loop, we are sure that "all" threads are in waiting list.
+     * Maybe the file for "on-demand" is already handled by the threads, then
+     * only its priority is changed (without pausing the threads).
      */
-    for (i = 0; i < ARRAY_NB_ELEMENTS (pause); i++)
-      pause[i].fct_pause (pause[i].handler);
-
-    /*
-     * Maybe the file for "on-demand" is already in a queue, we must check
-     * all queues in order to change its priority.
-     */
-    for (i = 0; i < ARRAY_NB_ELEMENTS (pause) && !fdata; i++)
-    {
-      fifo_queue_t *queue = pause[i].fct_fifo_get (pause[i].handler);
-      fdata = vh_fifo_queue_search (queue, &id, file, ondemand_cmp_fct);
-    }
-
-    /* Already in queues? */
-    if (fdata)
-    {
-      if (id != ACTION_DB_END)
-      {
-        fdata->priority = FIFO_QUEUE_PRIORITY_HIGH;
-
-        /* Move up this entry in the queues. */
-        for (i = 0; i < ARRAY_NB_ELEMENTS (pause); i++)
-        {
-          fifo_queue_t *queue = pause[i].fct_fifo_get (pause[i].handler);
-          vh_fifo_queue_moveup (queue, file, ondemand_cmp_fct);
-        }
-      }
-      if (fdata->od == OD_TYPE_DEF)
-        fdata->od = OD_TYPE_UPD;
-    }
+    if (!vh_inflight_promote (VH_HANDLE->inflight,
+                              file, ondemand_promote, ondemand))
+      vh_log (VALHALLA_MSG_VERBOSE,
+              "[%s] File %s already in the queues", __FUNCTION__, file);
     /* Check if the file is available and consistent. */
     else if (S_ISREG (st.st_mode)
              && !vh_scanner_suffix_cmp (VH_HANDLE->scanner, file))
@@ -227,8 +187,11 @@ ondemand_thread (void *arg)
       fdata = vh_file_data_new (file, &st, outofpath, OD_TYPE_NEW,
                                 FIFO_QUEUE_PRIORITY_HIGH, STEP_PARSING);
       if (fdata)
+      {
+        vh_inflight_add (VH_HANDLE->inflight, fdata);
         vh_dbmanager_action_send (VH_HANDLE->dbmanager,
                                   fdata->priority, ACTION_DB_NEWFILE, fdata);
+      }
     }
     else
       vh_log (VALHALLA_MSG_WARNING,
@@ -236,10 +199,6 @@ ondemand_thread (void *arg)
 
     free (file);
 
-    /* Wake up threads */
-    for (i = 0; i < ARRAY_NB_ELEMENTS (pause); i++)
-      pause[i].fct_pause (pause[i].handler);
-
     VH_STATS_TIMER_STOP (ondemand->st_tmr);
   }
   while (!ondemand_is_stopped (ondemand));
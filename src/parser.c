@@ -21,8 +21,13 @@
 
 #define _GNU_SOURCE
 #include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <libavformat/avformat.h>
 
@@ -32,6 +37,7 @@
 #include "osdep.h"
 #include "fifo_queue.h"
 #include "logs.h"
+#include "stats.h"
 #include "lavf_utils.h"
 #include "metadata.h"
 #include "thread_utils.h"
@@ -43,29 +49,80 @@
 #define PARSER_NB_MAX 8
 #endif /* PARSER_NB_MAX */
 
+#ifndef PARSER_ADAPTIVE_MAX
+#define PARSER_ADAPTIVE_MAX 16
+#endif /* PARSER_ADAPTIVE_MAX */
+
+#define PARSER_ADAPT_FILES    16  /* files by measurement */
+#define PARSER_ADAPT_CPU_HIGH 85  /* %, no more threads beyond this load */
+#define PARSER_ADAPT_GAIN     110 /* %, files/s expected after a new thread */
+#define PARSER_ADAPT_HOLD     8   /* measurements without new thread */
+
 #define VH_HANDLE parser->valhalla
 
+#define STATS_GROUP   "parser"
+#define STATS_FILES   "files"
+#define STATS_PARSE   "parse_us"
+#define STATS_GROW    "grow"
+#define STATS_SHRINK  "shrink"
+
 #define IS_TO_DECRAPIFY(c)                \
  ((unsigned) (c) <= 0x7F                  \
   && (c) != '\''                          \
   && !VH_ISSPACE (c)                      \
   && !VH_ISALNUM (c))
 
+typedef struct parser_worker_s {
+  struct parser_s *parser;
+  pthread_t        thread;
+  unsigned int     id;
+  int              run; /* not yet joined */
+} parser_worker_t;
+
 struct parser_s {
-  valhalla_t   *valhalla;
-  pthread_t     thread[PARSER_NB_MAX];
-  fifo_queue_t *fifo;
-  unsigned int  nb;
-  int           priority;
+  valhalla_t     *valhalla;
+  parser_worker_t worker[PARSER_ADAPTIVE_MAX];
+  fifo_queue_t   *fifo;
+  unsigned int    nb;
+  int             priority;
+
+  /*
+   * Adaptive pool, the number of threads on the common queue is between
+   * nb_min and nb_max. These fields and nb are protected by mutex_pool.
+   */
+  unsigned int    nb_min;
+  unsigned int    nb_max;
+  unsigned int    cpus;
+  pthread_mutex_t mutex_pool;
+  int             adapt;      /* pending change of the pool (+1 or -1) */
+  int             adapt_idle; /* the pending removal is for an empty queue */
+  int             adapt_hold;
+  int             last_grow;
+  double          last_rate;
+  struct timespec win_start;
+  clock_t         win_cpu;
+  unsigned long   win_files;  /* atomic */
+  uint64_t        win_parse;  /* atomic, us */
+
+  vh_stats_cnt_t *st_files;
+  vh_stats_cnt_t *st_parse;
+  vh_stats_cnt_t *st_grow;
+  vh_stats_cnt_t *st_shrink;
+
+  /* fast lane, only for the on-demand files (HIGH priority) */
+  pthread_t     thread_od;
+  fifo_queue_t *fifo_od;
+  int           run_od;
 
   int    decrapifier;
   char **bl_list;
 
+  /* libavformat contexts kept for the grabber ffmpeg (0 to disable) */
+  unsigned int ctx_max;
+
   int             wait;
   int             run;
   pthread_mutex_t mutex_run;
-
-  VH_THREAD_PAUSE_ATTRS
 };
 
 
@@ -278,24 +335,82 @@ parser_decrapify (parser_t *parser, const char *file, metadata_t **meta)
   return res;
 }
 
+static const metadata_plist_t g_parser_pl = {
+  .metadata = NULL,
+  .priority = VALHALLA_METADATA_PL_HIGHEST
+};
+
+/*
+ * The tags are saved in the probe cache exactly like these are added to the
+ * metadata, then the same list is retrieved from the cache.
+ */
+static void
+parser_tags_add (metadata_t **meta, database_probe_t *probe,
+                 const char *key, const char *value)
+{
+  size_t size_k, size_v;
+  char *tmp;
+
+  vh_metadata_add_auto (meta, key, value, VALHALLA_LANG_UNDEF, &g_parser_pl);
+
+  if (!probe)
+    return;
+
+  size_k = strlen (key) + 1;
+  size_v = strlen (value) + 1;
+  tmp = realloc (probe->tags, probe->tags_len + size_k + size_v);
+  if (!tmp)
+    return;
+
+  probe->tags = tmp;
+  memcpy (probe->tags + probe->tags_len, key, size_k);
+  probe->tags_len += size_k;
+  memcpy (probe->tags + probe->tags_len, value, size_v);
+  probe->tags_len += size_v;
+}
+
+static metadata_t *
+parser_tags_load (const database_probe_t *probe)
+{
+  metadata_t *meta = NULL;
+  const char *it, *end;
+
+  it  = probe->tags;
+  end = probe->tags + probe->tags_len;
+
+  while (it && it < end)
+  {
+    const char *key = it, *value;
+
+    value = memchr (key, '\0', end - key);
+    if (!value || ++value >= end)
+      break;
+
+    it = memchr (value, '\0', end - value);
+    if (!it)
+      break;
+    it++;
+
+    vh_metadata_add_auto (&meta, key, value,
+                          VALHALLA_LANG_UNDEF, &g_parser_pl);
+  }
+
+  return meta;
+}
+
 static metadata_t *
-parser_metadata_get (parser_t *parser, AVFormatContext *ctx, const char *file)
+parser_metadata_get (AVFormatContext *ctx, database_probe_t *probe)
 {
   unsigned int i;
   metadata_t *meta = NULL;
   const metadata_t *title_tag = NULL;
   AVDictionaryEntry *tag = NULL;
-  const metadata_plist_t pl = {
-    .metadata = NULL,
-    .priority = VALHALLA_METADATA_PL_HIGHEST
-  };
 
   if (!ctx)
     return NULL;
 
   while ((tag = av_dict_get (ctx->metadata, "", tag, AV_DICT_IGNORE_SUFFIX)))
-    vh_metadata_add_auto (&meta, tag->key, tag->value,
-                          VALHALLA_LANG_UNDEF, &pl);
+    parser_tags_add (&meta, probe, tag->key, tag->value);
 
   for (i = 0; i < ctx->nb_streams; i++)
   {
@@ -309,29 +424,34 @@ parser_metadata_get (parser_t *parser, AVFormatContext *ctx, const char *file)
           && !strcasecmp (key, VALHALLA_METADATA_TITLE))
         key = VALHALLA_METADATA_TITLE_STREAM;
 
-      vh_metadata_add_auto (&meta, key, tag->value,
-                            VALHALLA_LANG_UNDEF, &pl);
+      parser_tags_add (&meta, probe, key, tag->value);
     }
   }
 
-  if (!meta)
+  return meta;
+}
+
+static void
+parser_metadata_title (parser_t *parser, const char *file, metadata_t **meta)
+{
+  const metadata_t *title_tag = NULL;
+
+  if (!*meta)
     vh_log (VALHALLA_MSG_VERBOSE, "no available metadata for %s", file);
 
   /* if necessary, use the filename as title */
   if (parser->decrapifier
-      && vh_metadata_get (meta, VALHALLA_METADATA_TITLE, 0, &title_tag))
+      && vh_metadata_get (*meta, VALHALLA_METADATA_TITLE, 0, &title_tag))
   {
-    char *title = parser_decrapify (parser, file, &meta);
+    char *title = parser_decrapify (parser, file, meta);
     if (title)
     {
-      vh_metadata_add (&meta, VALHALLA_METADATA_TITLE, title,
+      vh_metadata_add (meta, VALHALLA_METADATA_TITLE, title,
                        VALHALLA_LANG_UNDEF, VALHALLA_META_GRP_TITLES,
                        VALHALLA_METADATA_PL_NORMAL);
       free (title);
     }
   }
-
-  return meta;
 }
 
 static valhalla_file_type_t
@@ -367,68 +487,346 @@ parser_stream_info (AVFormatContext *ctx)
   return VALHALLA_FILE_TYPE_NULL;
 }
 
+/*
+ * With the inode and the size, the fingerprint of the head and the tail
+ * identifies the content even if the file is renamed or touched.
+ */
+static int
+parser_probe_key (const char *file, database_probe_t *probe)
+{
+  struct stat st;
+
+  /* No inode on some filesystems (or with the Windows build). */
+  if (stat (file, &st) || !st.st_ino)
+    return -1;
+
+  probe->dev  = (int64_t) st.st_dev;
+  probe->ino  = (int64_t) st.st_ino;
+  probe->size = (int64_t) st.st_size;
+  return vh_lavf_utils_fingerprint (file, &probe->fp);
+}
+
+/* The results are given to the dbmanager which is the only writer. */
+static void
+parser_probe_keep (file_data_t *data, database_probe_t *probe)
+{
+  data->probe = malloc (sizeof (database_probe_t));
+  if (data->probe)
+  {
+    *data->probe = *probe;
+    probe->tags  = NULL;
+  }
+}
+
+/*
+ * The context is kept with the file for the grabber ffmpeg (audio and video
+ * only), then the file is opened and probed only one time. The number of
+ * contexts (and then of opened files) is limited.
+ */
+static int
+parser_context_keep (parser_t *parser, file_data_t *data)
+{
+  unsigned int *nb = &VH_HANDLE->lavf_ctx_nb;
+
+  if (!parser->ctx_max
+      || (data->file.type != VALHALLA_FILE_TYPE_AUDIO
+          && data->file.type != VALHALLA_FILE_TYPE_VIDEO))
+    return 0;
+
+  if (__atomic_add_fetch (nb, 1, __ATOMIC_RELAXED) > parser->ctx_max)
+  {
+    __atomic_sub_fetch (nb, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  data->lavf_nb = nb;
+  return 1;
+}
+
 static void
 parser_metadata (parser_t *parser, file_data_t *data)
 {
   AVFormatContext *ctx;
+  database_probe_t probe;
+  int cache;
+
+  memset (&probe, 0, sizeof (probe));
+  cache = !parser_probe_key (data->file.path, &probe);
+
+  /* Same content already parsed, libavformat is not necessary. */
+  if (cache
+      && !vh_dbmanager_db_probe_get (VH_HANDLE->dbmanager,
+                                     data->file.path, &probe))
+  {
+    vh_log (VALHALLA_MSG_VERBOSE, "probe cache hit for %s", data->file.path);
+    data->file.type = probe.type;
+    data->meta_parser = parser_tags_load (&probe);
+    if (probe.moved)
+    {
+      free (probe.tags);
+      probe.tags     = NULL;
+      probe.tags_len = 0;
+      parser_probe_keep (data, &probe);
+    }
+    goto out;
+  }
 
   ctx = vh_lavf_utils_open_input_file (data->file.path);
   if (!ctx)
     return;
 
   data->file.type = parser_stream_info (ctx);
-  data->meta_parser = parser_metadata_get (parser, ctx, data->file.path);
+  data->meta_parser = parser_metadata_get (ctx, cache ? &probe : NULL);
+
+  if (cache)
+  {
+    probe.type  = data->file.type;
+    probe.moved = 0;
+    parser_probe_keep (data, &probe);
+  }
+
+  if (parser_context_keep (parser, data))
+  {
+    vh_lavf_utils_head_free (ctx);
+    data->lavf_ctx = ctx;
+    goto out;
+  }
 
   // FIXME Some versions of ffmpeg might fail if name is null
   ctx->iformat->name = malloc(sizeof(char));
   if(ctx->iformat->name)
-	  avformat_close_input (&ctx);
+	  vh_lavf_utils_close_input_file (&ctx);
+
+ out:
+  if (probe.tags)
+    free (probe.tags);
+  parser_metadata_title (parser, data->file.path, &data->meta_parser);
 }
 
-static void *
-parser_thread (void *arg)
+static void *parser_thread (void *arg);
+
+static double
+parser_elapsed (const struct timespec *ts, struct timespec *now)
 {
-  int res, tid;
-  int e;
-  void *data = NULL;
-  file_data_t *pdata;
-  parser_t *parser = arg;
+  clock_gettime (CLOCK_REALTIME, now);
+  return (double) (now->tv_sec - ts->tv_sec)
+         + (double) (now->tv_nsec - ts->tv_nsec) / 1000000000.0;
+}
 
-  if (!parser)
-    pthread_exit (NULL);
+/* The caller must hold mutex_pool. */
+static void
+parser_grow (parser_t *parser)
+{
+  parser_worker_t *worker = &parser->worker[parser->nb];
 
-  tid = vh_setpriority (parser->priority);
+  /* This slot was used by a thread which is retired. */
+  if (worker->run)
+  {
+    pthread_join (worker->thread, NULL);
+    worker->run = 0;
+  }
+
+  if (pthread_create (&worker->thread, NULL, parser_thread, worker))
+    return;
+
+  worker->run = 1;
+  parser->nb++;
+  VH_STATS_COUNTER_INC (parser->st_grow);
+}
+
+/*
+ * Decision for the adaptive pool, after PARSER_ADAPT_FILES files. A thread
+ * is added while the files are waiting in the queue and the CPUs are not
+ * saturated (the parsing is slowed by the latency of the I/O). If this
+ * thread has not increased the number of files parsed by second, it is
+ * removed and no thread is added for a while. A thread is removed when the
+ * queue is empty. The caller must hold mutex_pool.
+ */
+static int
+parser_adapt_decide (parser_t *parser)
+{
+  int res = 0;
+  unsigned long files;
+  uint64_t parse;
+  unsigned int backlog;
+  double wall, rate, load;
+  clock_t cpu = clock ();
+  struct timespec now;
+
+  files   = __atomic_exchange_n (&parser->win_files, 0, __ATOMIC_RELAXED);
+  parse   = __atomic_exchange_n (&parser->win_parse, 0, __ATOMIC_RELAXED);
+  backlog = vh_fifo_queue_count (parser->fifo);
+
+  wall = parser_elapsed (&parser->win_start, &now);
+  if (wall <= 0.0)
+    wall = 0.000001;
+
+  rate = files / wall;
+  load = (double) (cpu - parser->win_cpu) * 100.0
+         / CLOCKS_PER_SEC / wall / parser->cpus;
+
+  if (parser->adapt_hold)
+    parser->adapt_hold--;
+
+  parser->adapt_idle = 0;
+
+  if (parser->last_grow && rate * 100.0 < parser->last_rate * PARSER_ADAPT_GAIN)
+  {
+    res = -1;
+    parser->adapt_hold = PARSER_ADAPT_HOLD;
+  }
+  else if (backlog > parser->nb && load < PARSER_ADAPT_CPU_HIGH
+           && parser->nb < parser->nb_max && !parser->adapt_hold)
+    res = 1;
+  else if (!backlog && parser->nb > parser->nb_min)
+  {
+    res = -1;
+    parser->adapt_idle = 1;
+  }
 
   vh_log (VALHALLA_MSG_VERBOSE,
-          "[%s] tid: %i priority: %i", __FUNCTION__, tid, parser->priority);
+          "[%s] threads: %u files/s: %.1f ms/file: %.1f cpu: %.0f%% "
+          "backlog: %u => %+i", __FUNCTION__, parser->nb, rate,
+          files ? parse / 1000.0 / files : 0.0, load, backlog, res);
+
+  /* Only a new thread is checked with the next measurement. */
+  parser->last_grow = res > 0;
+  parser->last_rate = rate;
+  parser->win_start = now;
+  parser->win_cpu   = cpu;
+  return res;
+}
+
+/*
+ * Called by the threads of the common queue after each file. It returns 1
+ * when the thread must be retired; only the last thread is retired in
+ * order to keep the slots contiguous, then a removal can wait for it. A
+ * removal for an empty queue can be replaced by a new measurement, and it
+ * is cancelled if files are waiting when the last thread takes it. Nothing
+ * is changed while the pool is locked by a stop.
+ */
+static int
+parser_adapt (parser_worker_t *worker, uint64_t parse)
+{
+  int retire = 0;
+  parser_t *parser = worker->parser;
+
+  __atomic_add_fetch (&parser->win_parse, parse, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&parser->win_files, 1, __ATOMIC_RELAXED);
+
+  if (pthread_mutex_trylock (&parser->mutex_pool))
+    return 0;
+
+  if (parser_is_stopped (parser))
+    goto out;
+
+  if ((!parser->adapt || parser->adapt_idle)
+      && __atomic_load_n (&parser->win_files, __ATOMIC_RELAXED)
+         >= PARSER_ADAPT_FILES)
+    parser->adapt = parser_adapt_decide (parser);
+
+  if (parser->adapt > 0)
+  {
+    parser->adapt = 0;
+    parser_grow (parser);
+  }
+  else if (parser->adapt < 0 && worker->id == parser->nb - 1)
+  {
+    parser->adapt = 0;
+    if (parser->adapt_idle && vh_fifo_queue_count (parser->fifo))
+      goto out;
+    parser->nb--;
+    retire = 1;
+    VH_STATS_COUNTER_INC (parser->st_shrink);
+  }
+
+ out:
+  pthread_mutex_unlock (&parser->mutex_pool);
+  return retire;
+}
+
+static void
+parser_loop (parser_t *parser, fifo_queue_t *fifo, parser_worker_t *worker)
+{
+  int res;
+  int e;
+  void *data = NULL;
+  file_data_t *pdata;
+  uint64_t parse;
+  struct timespec ts, now;
 
   do
   {
     e = ACTION_NO_OPERATION;
     data = NULL;
 
-    res = vh_fifo_queue_pop (parser->fifo, &e, &data);
+    res = vh_fifo_queue_pop (fifo, &e, &data);
     if (res || e == ACTION_NO_OPERATION)
       continue;
 
     if (e == ACTION_KILL_THREAD)
       break;
 
-    if (e == ACTION_PAUSE_THREAD)
-    {
-      VH_THREAD_PAUSE_ACTION (parser)
-      continue;
-    }
-
     pdata = data;
+    clock_gettime (CLOCK_REALTIME, &ts);
     if (pdata)
       parser_metadata (parser, pdata);
+    parse = (uint64_t) (parser_elapsed (&ts, &now) * 1000000.0);
+
+    VH_STATS_COUNTER_INC (parser->st_files);
+    VH_STATS_COUNTER_ACC (parser->st_parse, parse);
 
     vh_file_data_step_increase (pdata, &e);
     vh_dispatcher_action_send (VH_HANDLE->dispatcher,
-                               pdata->priority, e, pdata);
+                               VH_FILE_DATA_GET (pdata, priority), e, pdata);
+
+    if (worker && parser->nb_max > parser->nb_min
+        && parser_adapt (worker, parse))
+      break;
   }
   while (!parser_is_stopped (parser));
+}
+
+static void *
+parser_thread (void *arg)
+{
+  int tid;
+  parser_worker_t *worker = arg;
+  parser_t *parser;
+
+  if (!worker)
+    pthread_exit (NULL);
+
+  parser = worker->parser;
+  tid = vh_setpriority (parser->priority);
+
+  vh_log (VALHALLA_MSG_VERBOSE,
+          "[%s] tid: %i priority: %i", __FUNCTION__, tid, parser->priority);
+
+  parser_loop (parser, parser->fifo, worker);
+
+  pthread_exit (NULL);
+}
+
+/*
+ * The on-demand files are parsed by this thread, then these are not waiting
+ * behind the files of the scanner when all other threads are busy.
+ */
+static void *
+parser_thread_od (void *arg)
+{
+  int tid;
+  parser_t *parser = arg;
+
+  if (!parser)
+    pthread_exit (NULL);
+
+  tid = vh_setpriority (parser->priority);
+
+  vh_log (VALHALLA_MSG_VERBOSE,
+          "[%s] tid: %i priority: %i", __FUNCTION__, tid, parser->priority);
+
+  parser_loop (parser, parser->fifo_od, NULL);
 
   pthread_exit (NULL);
 }
@@ -448,19 +846,32 @@ vh_parser_run (parser_t *parser, int priority)
   parser->priority = priority;
   parser->run      = 1;
 
+  clock_gettime (CLOCK_REALTIME, &parser->win_start);
+  parser->win_cpu = clock ();
+
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
 
+  pthread_mutex_lock (&parser->mutex_pool);
   for (i = 0; i < parser->nb; i++)
   {
-    res = pthread_create (&parser->thread[i], &attr, parser_thread, parser);
+    parser_worker_t *worker = &parser->worker[i];
+
+    res = pthread_create (&worker->thread, &attr, parser_thread, worker);
     if (res)
     {
       res = PARSER_ERROR_THREAD;
       parser->run = 0;
       break;
     }
+    worker->run = 1;
   }
+  pthread_mutex_unlock (&parser->mutex_pool);
+
+  /* Without the fast lane, the on-demand files use the common queue. */
+  if (!res)
+    parser->run_od =
+      !pthread_create (&parser->thread_od, &attr, parser_thread_od, parser);
 
   pthread_attr_destroy (&attr);
   return res;
@@ -497,6 +908,39 @@ vh_parser_bl_keyword_add (parser_t *parser, const char *keyword)
   parser->bl_list[n - 1] = strdup (keyword);
 }
 
+/*
+ * The pool grows up to nb threads when the parsing is slowed by the I/O.
+ * It must be set before vh_parser_run().
+ */
+void
+vh_parser_adaptive_set (parser_t *parser, unsigned int nb)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!parser)
+    return;
+
+  if (nb > ARRAY_NB_ELEMENTS (parser->worker))
+    nb = ARRAY_NB_ELEMENTS (parser->worker);
+
+  parser->nb_max = nb > parser->nb_min ? nb : parser->nb_min;
+}
+
+/*
+ * At most nb libavformat contexts are kept for the grabber ffmpeg. It must
+ * be set before vh_parser_run().
+ */
+void
+vh_parser_context_set (parser_t *parser, unsigned int nb)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!parser)
+    return;
+
+  parser->ctx_max = nb;
+}
+
 fifo_queue_t *
 vh_parser_fifo_get (parser_t *parser)
 {
@@ -508,15 +952,15 @@ vh_parser_fifo_get (parser_t *parser)
   return parser->fifo;
 }
 
-void
-vh_parser_pause (parser_t *parser)
+fifo_queue_t *
+vh_parser_fifo_od_get (parser_t *parser)
 {
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
   if (!parser)
-    return;
+    return NULL;
 
-  VH_THREAD_PAUSE_FCT (parser, parser->nb)
+  return parser->fifo_od;
 }
 
 void
@@ -531,6 +975,7 @@ vh_parser_stop (parser_t *parser, int f)
 
   if (f & STOP_FLAG_REQUEST && !parser_is_stopped (parser))
   {
+    pthread_mutex_lock (&parser->mutex_pool);
     pthread_mutex_lock (&parser->mutex_run);
     parser->run = 0;
     pthread_mutex_unlock (&parser->mutex_run);
@@ -538,16 +983,26 @@ vh_parser_stop (parser_t *parser, int f)
     for (i = 0; i < parser->nb; i++)
       vh_fifo_queue_push (parser->fifo,
                           FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
+    vh_fifo_queue_push (parser->fifo_od,
+                        FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
     parser->wait = 1;
 
-    VH_THREAD_PAUSE_FORCESTOP (parser, parser->nb)
+    pthread_mutex_unlock (&parser->mutex_pool);
   }
 
+  /* The retired threads are joined too. */
   if (f & STOP_FLAG_WAIT && parser->wait)
   {
-    for (i = 0; i < parser->nb; i++)
-      pthread_join (parser->thread[i], NULL);
+    for (i = 0; i < ARRAY_NB_ELEMENTS (parser->worker); i++)
+      if (parser->worker[i].run)
+      {
+        pthread_join (parser->worker[i].thread, NULL);
+        parser->worker[i].run = 0;
+      }
+    if (parser->run_od)
+      pthread_join (parser->thread_od, NULL);
     parser->wait = 0;
+    parser->run_od = 0;
   }
 }
 
@@ -568,15 +1023,49 @@ vh_parser_uninit (parser_t *parser)
   }
 
   vh_fifo_queue_free (parser->fifo);
+  vh_fifo_queue_free (parser->fifo_od);
   pthread_mutex_destroy (&parser->mutex_run);
-  VH_THREAD_PAUSE_UNINIT (parser)
+  pthread_mutex_destroy (&parser->mutex_pool);
 
   free (parser);
 }
 
+static void
+parser_stats_dump (vh_stats_t *stats, void *data)
+{
+  parser_t *parser = data;
+  uint64_t files, parse;
+  unsigned int nb;
+
+  if (!stats || !parser)
+    return;
+
+  files = vh_stats_counter_read (parser->st_files);
+  parse = vh_stats_counter_read (parser->st_parse);
+
+  pthread_mutex_lock (&parser->mutex_pool);
+  nb = parser->nb;
+  pthread_mutex_unlock (&parser->mutex_pool);
+
+  vh_log (VALHALLA_MSG_INFO, "==============================");
+  vh_log (VALHALLA_MSG_INFO, "Statistics dump (" STATS_GROUP ")");
+  vh_log (VALHALLA_MSG_INFO, "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~");
+
+  vh_log (VALHALLA_MSG_INFO, "Files parsed      | %"PRIu64, files);
+  vh_log (VALHALLA_MSG_INFO, "Time by file (ms) | %.1f",
+          files ? parse / 1000.0 / files : 0.0);
+  vh_log (VALHALLA_MSG_INFO, "Threads           | %u (%u..%u)",
+          nb, parser->nb_min, parser->nb_max);
+  vh_log (VALHALLA_MSG_INFO, "Threads added     | %"PRIu64,
+          vh_stats_counter_read (parser->st_grow));
+  vh_log (VALHALLA_MSG_INFO, "Threads removed   | %"PRIu64,
+          vh_stats_counter_read (parser->st_shrink));
+}
+
 parser_t *
 vh_parser_init (valhalla_t *handle, unsigned int nb, unsigned int decrapifier)
 {
+  unsigned int i;
   parser_t *parser;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
@@ -588,19 +1077,48 @@ vh_parser_init (valhalla_t *handle, unsigned int nb, unsigned int decrapifier)
   if (!parser)
     return NULL;
 
-  if (nb > ARRAY_NB_ELEMENTS (parser->thread))
+  if (nb > PARSER_NB_MAX)
     goto err;
 
   parser->fifo = vh_fifo_queue_new ();
   if (!parser->fifo)
     goto err;
 
+  parser->fifo_od = vh_fifo_queue_new ();
+  if (!parser->fifo_od)
+    goto err;
+
   parser->valhalla    = handle; /* VH_HANDLE */
   parser->nb          = nb ? nb : PARSER_NUMBER_DEF;
+  parser->nb_min      = parser->nb;
+  parser->nb_max      = parser->nb;
   parser->decrapifier = !!decrapifier;
 
+  for (i = 0; i < ARRAY_NB_ELEMENTS (parser->worker); i++)
+  {
+    parser->worker[i].parser = parser;
+    parser->worker[i].id     = i;
+  }
+
+  parser->cpus = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+  if (sysconf (_SC_NPROCESSORS_ONLN) > 0)
+    parser->cpus = (unsigned int) sysconf (_SC_NPROCESSORS_ONLN);
+#endif /* _SC_NPROCESSORS_ONLN */
+
   pthread_mutex_init (&parser->mutex_run, NULL);
-  VH_THREAD_PAUSE_INIT (parser)
+  pthread_mutex_init (&parser->mutex_pool, NULL);
+
+  /* init statistics */
+  vh_stats_grp_add (handle->stats, STATS_GROUP, parser_stats_dump, parser);
+  parser->st_files =
+    vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_FILES,  NULL);
+  parser->st_parse =
+    vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_PARSE,  NULL);
+  parser->st_grow =
+    vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_GROW,   NULL);
+  parser->st_shrink =
+    vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_SHRINK, NULL);
 
   return parser;
 
@@ -618,5 +1136,27 @@ vh_parser_action_send (parser_t *parser,
   if (!parser)
     return;
 
-  vh_fifo_queue_push (parser->fifo, prio, action, data);
+  vh_fifo_queue_push (prio == FIFO_QUEUE_PRIORITY_HIGH && parser->run_od
+                      ? parser->fifo_od : parser->fifo, prio, action, data);
+}
+
+/*
+ * Move a file waiting in the common queue to the fast lane. It returns 0
+ * if the file was found.
+ */
+int
+vh_parser_promote (parser_t *parser, void *data)
+{
+  int e;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!parser || !parser->run_od)
+    return -1;
+
+  if (vh_fifo_queue_steal_data (parser->fifo, data, &e))
+    return -1;
+
+  vh_fifo_queue_push (parser->fifo_od, FIFO_QUEUE_PRIORITY_HIGH, e, data);
+  return 0;
 }
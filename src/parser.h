@@ -36,16 +36,19 @@ enum parser_errno {
 
 
 int vh_parser_run (parser_t *parser, int priority);
-void vh_parser_pause (parser_t *parser);
 fifo_queue_t *vh_parser_fifo_get (parser_t *parser);
+fifo_queue_t *vh_parser_fifo_od_get (parser_t *parser);
 void vh_parser_stop (parser_t *parser, int f);
 void vh_parser_uninit (parser_t *parser);
 parser_t *vh_parser_init (valhalla_t *handle,
                           unsigned int nb, unsigned int decrapifier);
 
 void vh_parser_bl_keyword_add (parser_t *parser, const char *keyword);
+void vh_parser_adaptive_set (parser_t *parser, unsigned int nb);
+void vh_parser_context_set (parser_t *parser, unsigned int nb);
 
 void vh_parser_action_send (parser_t *parser,
                             fifo_queue_prio_t prio, int action, void *data);
+int vh_parser_promote (parser_t *parser, void *data);
 
 #endif /* VALHALLA_PARSER_H */
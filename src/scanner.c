@@ -26,8 +26,17 @@
 #include <inttypes.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
 #include <sys/stat.h>
 
+#ifdef USE_INOTIFY
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif /* USE_INOTIFY */
+
 #include "valhalla.h"
 #include "valhalla_internals.h"
 #include "utils.h"
@@ -38,14 +47,39 @@
 #include "timer_thread.h"
 #include "dbmanager.h"
 #include "event_handler.h"
+#include "inflight.h"
 #include "scanner.h"
 
 #ifndef PATH_RECURSIVENESS_MAX
 #define PATH_RECURSIVENESS_MAX 42
 #endif /* PATH_RECURSIVENESS_MAX */
 
+#ifndef SCANNER_WALKER_NB_MAX
+#define SCANNER_WALKER_NB_MAX 16
+#endif /* SCANNER_WALKER_NB_MAX */
+
+#ifdef USE_INOTIFY
+#define INOTIFY_MASK                                                    \
+  (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO   \
+   | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define INOTIFY_BUFSIZE  (16 * (sizeof (struct inotify_event) + 256))
+#endif /* USE_INOTIFY */
+
 #define VH_HANDLE scanner->valhalla
 
+struct walker_s {
+  scanner_t      *scanner;
+  pthread_t       thread;
+  pthread_mutex_t mutex;
+
+  /* deque: the owner uses the tail and the thieves use the head */
+  struct walk_dir_s {
+    char *path;
+    int recursive;
+  } *dirs;
+  int head, nb, size;
+};
+
 struct scanner_s {
   valhalla_t   *valhalla;
   pthread_t     thread;
@@ -68,6 +102,33 @@ struct scanner_s {
     int nb_files;
   } *paths;
   char **suffix;
+  int    dircache;
+
+  struct walker_s walker[SCANNER_WALKER_NB_MAX];
+  unsigned int    walker_nb;
+  int             walker_run;
+  pthread_mutex_t mutex_walk;
+  pthread_cond_t  cond_walk;
+  int             walk_queued;  /* directories in the deques */
+  int             walk_pending; /* directories in the deques or being read */
+  int             walk_files;
+  int             walk_quit;
+
+#ifdef USE_INOTIFY
+  struct inotify_s {
+    int enabled;
+    int fd;
+    int pipe[2];  /* to break poll() on wakeup and stop */
+    int files;    /* files sent on events, waiting for the ACKs */
+    int rescan;   /* a full scanning is necessary */
+    pthread_mutex_t mutex; /* the walkers can add watches concurrently */
+    struct watch_s {
+      char *dir;
+      int recursive;
+    } *wd;        /* indexed by the watch descriptors */
+    int wd_nb;
+  } inotify;
+#endif /* USE_INOTIFY */
 };
 
 
@@ -167,7 +228,315 @@ scanner_is_stopped (scanner_t *scanner)
 }
 
 static void
-scanner_readdir (scanner_t *scanner,
+scanner_file_send (scanner_t *scanner,
+                   const char *file, struct stat *st, int *files)
+{
+  file_data_t *data;
+
+  data = vh_file_data_new (file, st, 0, OD_TYPE_DEF,
+                           FIFO_QUEUE_PRIORITY_NORMAL, STEP_PARSING);
+  if (!data)
+    return;
+
+  vh_inflight_add (VH_HANDLE->inflight, data);
+  vh_dbmanager_action_send (VH_HANDLE->dbmanager,
+                            VH_FILE_DATA_GET (data, priority),
+                            ACTION_DB_NEWFILE, data);
+  (*files)++;
+}
+
+static int
+scanner_ack_wait (scanner_t *scanner, int files)
+{
+  while (files)
+  {
+    int e;
+    vh_fifo_queue_pop (scanner->fifo, &e, NULL);
+    if (e == ACTION_ACKNOWLEDGE)
+      files--;
+
+    if (scanner_is_stopped (scanner))
+      return -1;
+  }
+
+  return 0;
+}
+
+#ifdef USE_INOTIFY
+static void
+scanner_inotify_watch (scanner_t *scanner, const char *dir, int recursive)
+{
+  int wd;
+  struct inotify_s *inotify = &scanner->inotify;
+
+  if (inotify->fd < 0)
+    return;
+
+  wd = inotify_add_watch (inotify->fd, dir, INOTIFY_MASK);
+  if (wd < 0)
+  {
+    vh_log (VALHALLA_MSG_WARNING, "[%s] Unable to watch %s: %s",
+            __FUNCTION__, dir, strerror (errno));
+    return;
+  }
+
+  pthread_mutex_lock (&inotify->mutex);
+
+  if (wd >= inotify->wd_nb)
+  {
+    int nb = wd + 64;
+    struct watch_s *tmp;
+
+    tmp = realloc (inotify->wd, nb * sizeof (*inotify->wd));
+    if (!tmp)
+    {
+      inotify_rm_watch (inotify->fd, wd);
+      goto out;
+    }
+
+    memset (tmp + inotify->wd_nb, 0, (nb - inotify->wd_nb) * sizeof (*tmp));
+    inotify->wd    = tmp;
+    inotify->wd_nb = nb;
+  }
+
+  /*
+   * The same directory is watched again with each scanning. The path is
+   * replaced if the directory was moved (same inode, then same wd).
+   */
+  if (!inotify->wd[wd].dir || strcmp (inotify->wd[wd].dir, dir))
+  {
+    char *tmp = strdup (dir);
+    if (tmp)
+    {
+      free (inotify->wd[wd].dir);
+      inotify->wd[wd].dir = tmp;
+    }
+  }
+  inotify->wd[wd].recursive = recursive;
+
+ out:
+  pthread_mutex_unlock (&inotify->mutex);
+}
+
+/*
+ * Stop to watch a directory and all its subdirectories. The paths of the
+ * nested watches are no longer valid when the directory is moved.
+ */
+static void
+scanner_inotify_unwatch (scanner_t *scanner, const char *dir)
+{
+  int i;
+  size_t len = strlen (dir);
+  struct inotify_s *inotify = &scanner->inotify;
+
+  pthread_mutex_lock (&inotify->mutex);
+
+  for (i = 0; i < inotify->wd_nb; i++)
+  {
+    struct watch_s *w = &inotify->wd[i];
+
+    if (!w->dir || strncmp (w->dir, dir, len)
+        || (w->dir[len] != '\0' && w->dir[len] != '/'))
+      continue;
+
+    inotify_rm_watch (inotify->fd, i);
+    free (w->dir);
+    w->dir = NULL;
+  }
+
+  pthread_mutex_unlock (&inotify->mutex);
+}
+#endif /* USE_INOTIFY */
+
+static char *
+scanner_path_build (const char *dir, const char *name)
+{
+  char *file;
+  size_t size = strlen (dir) + strlen (name) + 2;
+
+  file = malloc (size);
+  if (file)
+    snprintf (file, size, "%s%s%s",
+              dir, *dir == '/' && *(dir + 1) == '\0' ? "" : "/", name);
+  return file;
+}
+
+static void
+walker_push (struct walker_s *walker, const char *path, int recursive)
+{
+  scanner_t *scanner = walker->scanner;
+  struct walk_dir_s *dir;
+  char *p;
+
+  p = strdup (path);
+  if (!p)
+    return;
+
+  pthread_mutex_lock (&walker->mutex);
+
+  if (walker->nb == walker->size)
+  {
+    int i, size = walker->size ? 2 * walker->size : 64;
+    struct walk_dir_s *tmp;
+
+    tmp = malloc (size * sizeof (*tmp));
+    if (!tmp)
+    {
+      pthread_mutex_unlock (&walker->mutex);
+      free (p);
+      return;
+    }
+
+    for (i = 0; i < walker->nb; i++)
+      tmp[i] = walker->dirs[(walker->head + i) % walker->size];
+
+    free (walker->dirs);
+    walker->dirs = tmp;
+    walker->head = 0;
+    walker->size = size;
+  }
+
+  /*
+   * The counters are increased before that the directory is available in the
+   * deque, then the walk can not be seen as finished in the meantime.
+   */
+  pthread_mutex_lock (&scanner->mutex_walk);
+  scanner->walk_pending++;
+  scanner->walk_queued++;
+  pthread_cond_broadcast (&scanner->cond_walk);
+  pthread_mutex_unlock (&scanner->mutex_walk);
+
+  dir = &walker->dirs[(walker->head + walker->nb) % walker->size];
+  dir->path      = p;
+  dir->recursive = recursive;
+  walker->nb++;
+
+  pthread_mutex_unlock (&walker->mutex);
+}
+
+static int
+walker_pop (struct walker_s *walker, struct walk_dir_s *dir, int steal)
+{
+  int res = -1;
+
+  pthread_mutex_lock (&walker->mutex);
+
+  if (walker->nb)
+  {
+    walker->nb--;
+    if (steal)
+    {
+      *dir = walker->dirs[walker->head];
+      walker->head = (walker->head + 1) % walker->size;
+    }
+    else
+      *dir = walker->dirs[(walker->head + walker->nb) % walker->size];
+    res = 0;
+  }
+
+  pthread_mutex_unlock (&walker->mutex);
+  return res;
+}
+
+/*
+ * Return 0 if the directory is unchanged since its last listing. The mtime
+ * to save with the new listing is returned with \p mtime; it is -1 when the
+ * mtime is too recent because a change in the same second can be missed.
+ */
+static int
+scanner_dircache_check (scanner_t *scanner, const char *dir, int64_t *mtime)
+{
+  struct stat st;
+
+  *mtime = -1;
+
+  if (stat (dir, &st) || st.st_mtime + 1 >= time (NULL))
+    return -1;
+
+  *mtime = (int64_t) st.st_mtime;
+  return vh_dbmanager_db_dir_get_mtime (VH_HANDLE->dbmanager, dir) != *mtime;
+}
+
+static int
+scanner_dircache_add (char ***list, unsigned int *nb, char *dir)
+{
+  char **tmp = realloc (*list, (*nb + 2) * sizeof (**list));
+
+  if (!tmp)
+    return -1;
+
+  *list = tmp;
+  (*list)[(*nb)++] = dir;
+  (*list)[*nb] = NULL;
+  return 0;
+}
+
+static void
+scanner_dircache_save (scanner_t *scanner,
+                       char *dir, int64_t mtime, char **subdirs)
+{
+  dbmanager_dir_t *data = calloc (1, sizeof (dbmanager_dir_t));
+
+  if (!data)
+  {
+    char **it;
+
+    free (dir);
+    for (it = subdirs; it && *it; it++)
+      free (*it);
+    free (subdirs);
+    return;
+  }
+
+  data->path    = dir;
+  data->mtime   = mtime;
+  data->subdirs = subdirs;
+  vh_dbmanager_action_send (VH_HANDLE->dbmanager,
+                            FIFO_QUEUE_PRIORITY_NORMAL,
+                            ACTION_DB_NEWDIR, data);
+}
+
+static void scanner_readdir (scanner_t *scanner, struct walker_s *walker,
+                             const char *path, const char *dir,
+                             int recursive, int *files);
+
+/*
+ * The files of an unchanged directory are only checked in the database (no
+ * file is sent to the dbmanager) and the known sub-directories are walked
+ * without listing the directory.
+ */
+static void
+scanner_dircache_skip (scanner_t *scanner, struct walker_s *walker,
+                       const char *dir, int recursive, int *files)
+{
+  char **subdirs, **it;
+  char *data = strdup (dir);
+
+  if (data)
+    vh_dbmanager_action_send (VH_HANDLE->dbmanager,
+                              FIFO_QUEUE_PRIORITY_NORMAL,
+                              ACTION_DB_DIRCHECKED, data);
+
+  if (!recursive)
+    return;
+
+  subdirs = vh_dbmanager_db_dir_get_children (VH_HANDLE->dbmanager, dir);
+  for (it = subdirs; it && *it; it++)
+  {
+    if (!scanner_is_stopped (scanner))
+    {
+      if (!walker)
+        scanner_readdir (scanner, NULL, *it, NULL, recursive, files);
+      else
+        walker_push (walker, *it, recursive);
+    }
+    free (*it);
+  }
+  free (subdirs);
+}
+
+static void
+scanner_readdir (scanner_t *scanner, struct walker_s *walker,
                  const char *path, const char *dir, int recursive, int *files)
 {
   DIR *dirp;
@@ -175,26 +544,23 @@ scanner_readdir (scanner_t *scanner,
   struct stat st;
   char *file;
   char *new_path;
-  size_t size;
+  int unchanged = 0;
+  int64_t mtime = -1;
+  char **subdirs = NULL;
+  unsigned int subdirs_nb = 0;
 
   if (!scanner || !path)
     return;
 
-  if (dir)
-  {
-    size_t size = strlen (path) + strlen (dir) + 2;
-    new_path = malloc (size);
-    if (!new_path)
-      return;
+  new_path = dir ? scanner_path_build (path, dir) : strdup (path);
+  if (!new_path)
+    return;
 
-    snprintf (new_path, size, "%s%s%s",
-              path, *path == '/' && *(path + 1) == '\0' ? "" : "/", dir);
-  }
-  else
-    new_path = strdup (path);
+  if (scanner->dircache && !scanner_dircache_check (scanner, new_path, &mtime))
+    unchanged = 1;
 
-  dirp = opendir (new_path);
-  if (!dirp)
+  dirp = unchanged ? NULL : opendir (new_path);
+  if (!unchanged && !dirp)
   {
     free (new_path);
     return;
@@ -208,6 +574,17 @@ scanner_readdir (scanner_t *scanner,
               "[scanner_thread] Max recursiveness reached : %s", new_path);
   }
 
+#ifdef USE_INOTIFY
+  scanner_inotify_watch (scanner, new_path, recursive);
+#endif /* USE_INOTIFY */
+
+  if (unchanged)
+  {
+    scanner_dircache_skip (scanner, walker, new_path, recursive, files);
+    free (new_path);
+    return;
+  }
+
   do
   {
     dp = readdir (dirp);
@@ -217,43 +594,367 @@ scanner_readdir (scanner_t *scanner,
     if (!strcmp (dp->d_name, ".") || !strcmp (dp->d_name, ".."))
       continue;
 
-    size = strlen (new_path) + strlen (dp->d_name) + 2;
+#ifdef HAVE_DIRENT_D_TYPE
+    /*
+     * The type (if provided by the filesystem) is enough in order to skip
+     * most of the entries without stat (symlinks, bad suffixes, ...).
+     */
+    switch (dp->d_type)
+    {
+    case DT_UNKNOWN:
+      break;
 
-    file = malloc (size);
-    if (!file)
+    case DT_REG:
+      if (suffix_cmp (scanner->suffix, dp->d_name))
+        continue;
+      break;
+
+    case DT_DIR:
+      if (!recursive)
+        continue;
+      break;
+
+    default:
       continue;
+    }
+#endif /* HAVE_DIRENT_D_TYPE */
 
-    snprintf (file, size, "%s/%s", new_path, dp->d_name);
-    if (lstat (file, &st))
+    /* The full path is built only when it is really necessary. */
+    file = NULL;
+#ifdef HAVE_FSTATAT
+    if (fstatat (dirfd (dirp), dp->d_name, &st, AT_SYMLINK_NOFOLLOW))
+      continue;
+#else /* HAVE_FSTATAT */
+    file = scanner_path_build (new_path, dp->d_name);
+    if (!file || lstat (file, &st))
     {
       free (file);
       continue;
     }
+#endif /* !HAVE_FSTATAT */
 
     if (S_ISREG (st.st_mode) && !suffix_cmp (scanner->suffix, dp->d_name))
     {
-      file_data_t *data;
-
-      data = vh_file_data_new (file, &st, 0, OD_TYPE_DEF,
-                               FIFO_QUEUE_PRIORITY_NORMAL, STEP_PARSING);
-      if (data)
-      {
-        vh_dbmanager_action_send (VH_HANDLE->dbmanager,
-                                  data->priority, ACTION_DB_NEWFILE, data);
-        (*files)++;
-      }
+      if (file || (file = scanner_path_build (new_path, dp->d_name)))
+        scanner_file_send (scanner, file, &st, files);
     }
     else if (S_ISDIR (st.st_mode) && recursive)
-      scanner_readdir (scanner, new_path, dp->d_name, recursive, files);
+    {
+      /* The sub-directories are read concurrently with the walkers. */
+      if (!walker)
+        scanner_readdir (scanner, NULL,
+                         new_path, dp->d_name, recursive, files);
+      else if (file || (file = scanner_path_build (new_path, dp->d_name)))
+        walker_push (walker, file, recursive);
+
+      if (scanner->dircache
+          && (file || (file = scanner_path_build (new_path, dp->d_name)))
+          && !scanner_dircache_add (&subdirs, &subdirs_nb, file))
+        file = NULL;
+    }
 
     free (file);
   }
   while (!scanner_is_stopped (scanner));
 
   closedir (dirp);
+
+  /* The listing is saved only if it is complete. */
+  if (scanner->dircache && !scanner_is_stopped (scanner))
+  {
+    scanner_dircache_save (scanner, new_path, mtime, subdirs);
+    return;
+  }
+
+  while (subdirs_nb--)
+    free (subdirs[subdirs_nb]);
+  free (subdirs);
   free (new_path);
 }
 
+static void *
+walker_thread (void *arg)
+{
+  struct walker_s *walker = arg;
+  scanner_t *scanner = walker->scanner;
+  struct walk_dir_s dir;
+  unsigned int i;
+
+  vh_setpriority (scanner->priority);
+
+  for (;;)
+  {
+    int files = 0;
+
+    /* Own directories first (depth-first), then steal the oldest. */
+    int res = walker_pop (walker, &dir, 0);
+    for (i = 1; res && i < scanner->walker_nb; i++)
+      res = walker_pop (&scanner->walker[(walker - scanner->walker + i)
+                                         % scanner->walker_nb], &dir, 1);
+
+    pthread_mutex_lock (&scanner->mutex_walk);
+    if (res)
+    {
+      while (!scanner->walk_quit && scanner->walk_queued <= 0)
+        pthread_cond_wait (&scanner->cond_walk, &scanner->mutex_walk);
+      res = scanner->walk_quit;
+      pthread_mutex_unlock (&scanner->mutex_walk);
+      if (res)
+        break;
+      continue;
+    }
+    scanner->walk_queued--;
+    pthread_mutex_unlock (&scanner->mutex_walk);
+
+    scanner_readdir (scanner, walker, dir.path, NULL, dir.recursive, &files);
+    free (dir.path);
+
+    pthread_mutex_lock (&scanner->mutex_walk);
+    scanner->walk_files += files;
+    scanner->walk_pending--;
+    if (!scanner->walk_pending)
+      pthread_cond_broadcast (&scanner->cond_walk);
+    pthread_mutex_unlock (&scanner->mutex_walk);
+  }
+
+  pthread_exit (NULL);
+}
+
+/*
+ * Walk a path with the pool of walkers. The function returns when all
+ * directories are read, or on stop.
+ */
+static int
+scanner_walk (scanner_t *scanner, struct path_s *path)
+{
+  int files;
+
+  pthread_mutex_lock (&scanner->mutex_walk);
+  scanner->walk_files = 0;
+  pthread_mutex_unlock (&scanner->mutex_walk);
+
+  walker_push (&scanner->walker[0], path->location, path->recursive);
+
+  pthread_mutex_lock (&scanner->mutex_walk);
+  while (scanner->walk_pending && !scanner->walk_quit)
+    pthread_cond_wait (&scanner->cond_walk, &scanner->mutex_walk);
+  files = scanner->walk_files;
+  pthread_mutex_unlock (&scanner->mutex_walk);
+
+  return files;
+}
+
+static void
+scanner_walkers_quit (scanner_t *scanner)
+{
+  pthread_mutex_lock (&scanner->mutex_walk);
+  scanner->walk_quit = 1;
+  pthread_cond_broadcast (&scanner->cond_walk);
+  pthread_mutex_unlock (&scanner->mutex_walk);
+}
+
+static void
+scanner_walkers_join (scanner_t *scanner)
+{
+  unsigned int i;
+
+  if (!scanner->walker_run)
+    return;
+
+  scanner_walkers_quit (scanner);
+  for (i = 0; i < scanner->walker_nb; i++)
+    pthread_join (scanner->walker[i].thread, NULL);
+  scanner->walker_run = 0;
+}
+
+#ifdef USE_INOTIFY
+static void
+scanner_inotify_event (scanner_t *scanner, const struct inotify_event *ev)
+{
+  struct stat st;
+  struct watch_s *w;
+  char *file;
+  struct inotify_s *inotify = &scanner->inotify;
+
+  if (ev->mask & IN_Q_OVERFLOW)
+  {
+    vh_log (VALHALLA_MSG_WARNING,
+            "[%s] Events queue overflow, a scanning is forced", __FUNCTION__);
+    inotify->rescan = 1;
+    return;
+  }
+
+  if (ev->wd < 0 || ev->wd >= inotify->wd_nb || !inotify->wd[ev->wd].dir)
+    return;
+
+  w = &inotify->wd[ev->wd];
+
+  /*
+   * The directory is no longer watched. When it is moved, the whole subtree
+   * is dropped and a scanning watches again the directories still in the
+   * paths (with their new names).
+   */
+  if (ev->mask & IN_MOVE_SELF)
+  {
+    char *dir = w->dir;
+
+    w->dir = NULL;
+    scanner_inotify_unwatch (scanner, dir);
+    inotify_rm_watch (inotify->fd, ev->wd);
+    free (dir);
+    inotify->rescan = 1;
+    return;
+  }
+
+  if (ev->mask & IN_IGNORED)
+  {
+    free (w->dir);
+    w->dir = NULL;
+    return;
+  }
+
+  if (!ev->len)
+    return;
+
+  if (ev->mask & IN_ISDIR)
+  {
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO) && w->recursive)
+      scanner_readdir (scanner, NULL, w->dir, ev->name, w->recursive,
+                       &inotify->files);
+    /*
+     * The files of a directory moved away must be removed from the database,
+     * but they are unknown here. The checked__ sweep of a full scanning is
+     * used instead.
+     */
+    else if (ev->mask & IN_MOVED_FROM)
+      inotify->rescan = 1;
+    return;
+  }
+
+  if (suffix_cmp (scanner->suffix, ev->name))
+    return;
+
+  file = scanner_path_build (w->dir, ev->name);
+  if (!file)
+    return;
+
+  if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+  {
+    /* the string is released by the dbmanager */
+    vh_dbmanager_action_send (VH_HANDLE->dbmanager,
+                              FIFO_QUEUE_PRIORITY_NORMAL,
+                              ACTION_DB_DELFILE, file);
+    return;
+  }
+
+  if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)
+      && !lstat (file, &st) && S_ISREG (st.st_mode))
+    scanner_file_send (scanner, file, &st, &inotify->files);
+
+  free (file);
+}
+
+/*
+ * Handle the inotify events until the timeout, a wake up or a stop request.
+ * The timeout is then the interval between two reconciliations (full
+ * scannings) and 0 means that only the events are handled.
+ */
+static void
+scanner_inotify_wait (scanner_t *scanner)
+{
+  uint64_t start = 0, now;
+  struct pollfd fds[2];
+  struct inotify_s *inotify = &scanner->inotify;
+  char buf[INOTIFY_BUFSIZE]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+  fds[0].fd     = inotify->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd     = inotify->pipe[0];
+  fds[1].events = POLLIN;
+
+  VH_TIMERNOW (&start);
+
+  while (!inotify->rescan && !scanner_is_stopped (scanner))
+  {
+    int res, timeout = -1;
+    ssize_t len;
+    char *it;
+
+    if (scanner->timeout)
+    {
+      VH_TIMERNOW (&now);
+      if (now - start >= scanner->timeout)
+        break;
+      timeout = (int) ((scanner->timeout - (now - start)) / 1000000) + 1;
+    }
+
+    res = poll (fds, ARRAY_NB_ELEMENTS (fds), timeout);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      break;
+
+    /* wake up or stop */
+    if (fds[1].revents & POLLIN)
+    {
+      char c;
+      if (read (inotify->pipe[0], &c, 1) < 0)
+        vh_log (VALHALLA_MSG_WARNING,
+                "[%s] %s", __FUNCTION__, strerror (errno));
+      break;
+    }
+
+    if (!(fds[0].revents & POLLIN))
+      continue;
+
+    len = read (inotify->fd, buf, sizeof (buf));
+    if (len <= 0)
+      continue;
+
+    for (it = buf; it < buf + len;)
+    {
+      const struct inotify_event *ev = (const struct inotify_event *) it;
+      scanner_inotify_event (scanner, ev);
+      it += sizeof (struct inotify_event) + ev->len;
+    }
+  }
+
+  inotify->rescan = 0;
+}
+
+static void
+scanner_inotify_signal (scanner_t *scanner)
+{
+  const char c = 0;
+
+  if (scanner->inotify.pipe[1] < 0)
+    return;
+
+  if (write (scanner->inotify.pipe[1], &c, 1) < 0)
+    vh_log (VALHALLA_MSG_WARNING,
+            "[%s] %s", __FUNCTION__, strerror (errno));
+}
+
+/*
+ * The wake ups sent while a scanning is running are useless, the bytes are
+ * dropped before to wait for the events.
+ */
+static void
+scanner_inotify_drain (scanner_t *scanner)
+{
+  char buf[16];
+  struct pollfd fd;
+
+  fd.fd     = scanner->inotify.pipe[0];
+  fd.events = POLLIN;
+
+  while (poll (&fd, 1, 0) > 0 && (fd.revents & POLLIN))
+    if (read (fd.fd, buf, sizeof (buf)) <= 0)
+      break;
+}
+#endif /* USE_INOTIFY */
+
 static void *
 scanner_thread (void *arg)
 {
@@ -296,8 +997,11 @@ scanner_thread (void *arg)
               "[%s] Start scanning : %s", __FUNCTION__, path->location);
 
       path->nb_files = 0;
-      scanner_readdir (scanner,
-                       path->location, NULL, path->recursive, &path->nb_files);
+      if (scanner->walker_run)
+        path->nb_files = scanner_walk (scanner, path);
+      else
+        scanner_readdir (scanner, NULL, path->location, NULL,
+                         path->recursive, &path->nb_files);
 
       vh_log (VALHALLA_MSG_INFO,
               "[%s] End scanning   : %i files", __FUNCTION__, path->nb_files);
@@ -311,19 +1015,8 @@ scanner_thread (void *arg)
      * for each path (wait all ACKs).
      */
     for (path = scanner->paths; path; path = path->next)
-    {
-      int files = path->nb_files;
-      while (files)
-      {
-        int e;
-        vh_fifo_queue_pop (scanner->fifo, &e, NULL);
-        if (e == ACTION_ACKNOWLEDGE)
-          files--;
-
-        if (scanner_is_stopped (scanner))
-          goto kill;
-      }
-    }
+      if (scanner_ack_wait (scanner, path->nb_files))
+        goto kill;
 
     vh_event_handler_gl_send (VH_HANDLE->event_handler,
                               VALHALLA_EVENTGL_SCANNER_ACKS);
@@ -336,6 +1029,19 @@ scanner_thread (void *arg)
                                 ACTION_DB_NEXT_LOOP, NULL);
       vh_event_handler_gl_send (VH_HANDLE->event_handler,
                                 VALHALLA_EVENTGL_SCANNER_SLEEP);
+#ifdef USE_INOTIFY
+      if (scanner->inotify.fd >= 0)
+      {
+        scanner_inotify_drain (scanner);
+        scanner_inotify_wait (scanner);
+
+        /* Wait the ACKs for the files sent on the events. */
+        if (scanner_ack_wait (scanner, scanner->inotify.files))
+          goto kill;
+        scanner->inotify.files = 0;
+      }
+      else
+#endif /* USE_INOTIFY */
       if (scanner->timeout)
         vh_timer_thread_sleep (scanner->timer, scanner->timeout);
     }
@@ -348,6 +1054,7 @@ scanner_thread (void *arg)
                             VALHALLA_EVENTGL_SCANNER_EXIT);
 
  kill:
+  scanner_walkers_quit (scanner);
   pthread_exit (NULL);
 }
 
@@ -359,14 +1066,50 @@ vh_scanner_wakeup (scanner_t *scanner)
   if (!scanner)
     return;
 
+#ifdef USE_INOTIFY
+  scanner_inotify_signal (scanner);
+#endif /* USE_INOTIFY */
   vh_timer_thread_wakeup (scanner->timer);
 }
 
+/*
+ * The directories cache depends of the paths and the suffixes, it is dropped
+ * by the database when this signature has changed.
+ */
+static void
+scanner_dircache_validate (scanner_t *scanner)
+{
+  size_t size = 1, len = 0;
+  char *sig;
+  char *const *it;
+  struct path_s *path;
+
+  for (path = scanner->paths; path; path = path->next)
+    size += strlen (path->location) + 16;
+  for (it = scanner->suffix; it && *it; it++)
+    size += strlen (*it) + 1;
+
+  sig = malloc (size);
+  if (!sig)
+    return;
+
+  *sig = '\0';
+  for (path = scanner->paths; path; path = path->next)
+    len += snprintf (sig + len, size - len,
+                     "%s:%i;", path->location, path->recursive);
+  for (it = scanner->suffix; it && *it; it++)
+    len += snprintf (sig + len, size - len, "%s;", *it);
+
+  vh_dbmanager_db_dir_validate (VH_HANDLE->dbmanager, sig);
+  free (sig);
+}
+
 int
 vh_scanner_run (scanner_t *scanner,
                 int loop, uint16_t timeout, uint16_t delay, int priority)
 {
   int res = SCANNER_SUCCESS;
+  unsigned int i;
   pthread_attr_t attr;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
@@ -387,6 +1130,22 @@ vh_scanner_run (scanner_t *scanner,
   if (delay || timeout)
     vh_timer_thread_start (scanner->timer);
 
+  if (scanner->dircache)
+    scanner_dircache_validate (scanner);
+
+#ifdef USE_INOTIFY
+  if (scanner->inotify.enabled)
+  {
+    scanner->inotify.fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (scanner->inotify.fd < 0 || pipe (scanner->inotify.pipe))
+      vh_log (VALHALLA_MSG_WARNING,
+              "Unable to init inotify, only the full scannings are used: %s",
+              strerror (errno));
+    else
+      vh_log (VALHALLA_MSG_INFO, "The scanner uses inotify between the loops");
+  }
+#endif /* USE_INOTIFY */
+
   /* -1 for infinite loop */
   scanner->loop = loop < 1 ? -1 : loop;
 
@@ -396,11 +1155,27 @@ vh_scanner_run (scanner_t *scanner,
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
 
+  for (i = 0; i < scanner->walker_nb; i++)
+  {
+    scanner->walker[i].scanner = scanner;
+    if (pthread_create (&scanner->walker[i].thread,
+                        &attr, walker_thread, &scanner->walker[i]))
+      break;
+  }
+
+  /* Use only the walkers available. */
+  if (i < scanner->walker_nb)
+    vh_log (VALHALLA_MSG_WARNING,
+            "Only %u walkers are available on %u", i, scanner->walker_nb);
+  scanner->walker_nb  = i;
+  scanner->walker_run = !!i;
+
   res = pthread_create (&scanner->thread, &attr, scanner_thread, scanner);
   if (res)
   {
     res = SCANNER_ERROR_THREAD;
     scanner->run = 0;
+    scanner_walkers_join (scanner);
   }
 
   pthread_attr_destroy (&attr);
@@ -416,6 +1191,7 @@ vh_scanner_wait (scanner_t *scanner)
     return;
 
   pthread_join (scanner->thread, NULL);
+  scanner_walkers_join (scanner);
 
   scanner->run = 0;
 }
@@ -449,11 +1225,16 @@ vh_scanner_stop (scanner_t *scanner, int f)
                         FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
     scanner->wait = 1;
     vh_timer_thread_stop (scanner->timer);
+    scanner_walkers_quit (scanner);
+#ifdef USE_INOTIFY
+    scanner_inotify_signal (scanner);
+#endif /* USE_INOTIFY */
   }
 
   if (f & STOP_FLAG_WAIT && scanner->wait)
   {
     pthread_join (scanner->thread, NULL);
+    scanner_walkers_join (scanner);
     scanner->wait = 0;
   }
 }
@@ -461,6 +1242,8 @@ vh_scanner_stop (scanner_t *scanner, int f)
 void
 vh_scanner_uninit (scanner_t *scanner)
 {
+  int i;
+
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
   if (!scanner)
@@ -468,6 +1251,34 @@ vh_scanner_uninit (scanner_t *scanner)
 
   vh_timer_thread_delete (scanner->timer);
 
+  for (i = 0; i < SCANNER_WALKER_NB_MAX; i++)
+  {
+    struct walker_s *walker = &scanner->walker[i];
+    for (; walker->nb; walker->nb--, walker->head++)
+      free (walker->dirs[walker->head % walker->size].path);
+    free (walker->dirs);
+    pthread_mutex_destroy (&walker->mutex);
+  }
+  pthread_mutex_destroy (&scanner->mutex_walk);
+  pthread_cond_destroy (&scanner->cond_walk);
+
+#ifdef USE_INOTIFY
+  pthread_mutex_destroy (&scanner->inotify.mutex);
+  if (scanner->inotify.wd)
+  {
+    for (i = 0; i < scanner->inotify.wd_nb; i++)
+      if (scanner->inotify.wd[i].dir)
+        free (scanner->inotify.wd[i].dir);
+    free (scanner->inotify.wd);
+  }
+  if (scanner->inotify.fd >= 0)
+    close (scanner->inotify.fd);
+  if (scanner->inotify.pipe[0] >= 0)
+    close (scanner->inotify.pipe[0]);
+  if (scanner->inotify.pipe[1] >= 0)
+    close (scanner->inotify.pipe[1]);
+#endif /* USE_INOTIFY */
+
   if (scanner->paths)
     path_free (scanner->paths);
 
@@ -561,9 +1372,45 @@ vh_scanner_suffix_add (scanner_t *scanner, const char *suffix)
   scanner->suffix[n - 1] = strdup (suffix);
 }
 
+void
+vh_scanner_walker_set (scanner_t *scanner, unsigned int nb)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner)
+    return;
+
+  scanner->walker_nb = nb > SCANNER_WALKER_NB_MAX ? SCANNER_WALKER_NB_MAX : nb;
+}
+
+void
+vh_scanner_dircache_set (scanner_t *scanner, int enable)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner)
+    return;
+
+  scanner->dircache = !!enable;
+}
+
+#ifdef USE_INOTIFY
+void
+vh_scanner_inotify_set (scanner_t *scanner, int enable)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner)
+    return;
+
+  scanner->inotify.enabled = !!enable;
+}
+#endif /* USE_INOTIFY */
+
 scanner_t *
 vh_scanner_init (valhalla_t *handle)
 {
+  int i;
   scanner_t *scanner;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
@@ -575,6 +1422,18 @@ vh_scanner_init (valhalla_t *handle)
   if (!scanner)
     return NULL;
 
+  for (i = 0; i < SCANNER_WALKER_NB_MAX; i++)
+    pthread_mutex_init (&scanner->walker[i].mutex, NULL);
+  pthread_mutex_init (&scanner->mutex_walk, NULL);
+  pthread_cond_init (&scanner->cond_walk, NULL);
+
+#ifdef USE_INOTIFY
+  pthread_mutex_init (&scanner->inotify.mutex, NULL);
+  scanner->inotify.fd      = -1;
+  scanner->inotify.pipe[0] = -1;
+  scanner->inotify.pipe[1] = -1;
+#endif /* USE_INOTIFY */
+
   scanner->fifo = vh_fifo_queue_new ();
   if (!scanner->fifo)
     goto err;
@@ -48,6 +48,11 @@ void vh_scanner_path_add (scanner_t *scanner,
                           const char *location, int recursive);
 int vh_scanner_suffix_cmp (scanner_t *scanner, const char *file);
 void vh_scanner_suffix_add (scanner_t *scanner, const char *suffix);
+void vh_scanner_walker_set (scanner_t *scanner, unsigned int nb);
+void vh_scanner_dircache_set (scanner_t *scanner, int enable);
+#ifdef USE_INOTIFY
+void vh_scanner_inotify_set (scanner_t *scanner, int enable);
+#endif /* USE_INOTIFY */
 
 void vh_scanner_action_send (scanner_t *scanner,
                              fifo_queue_prio_t prio, int action, void *data);
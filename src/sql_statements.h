@@ -51,6 +51,9 @@
 #define END_TRANSACTION   \
  "COMMIT;"
 
+#define ROLLBACK_TRANSACTION \
+ "ROLLBACK;"
+
 /******************************************************************************/
 /*                                                                            */
 /*                              Create tables                                 */
@@ -139,6 +142,59 @@
    "PRIMARY KEY (file_id, grabber_id) "                   \
  ");"
 
+#define CREATE_TABLE_DIR                                  \
+ "CREATE TABLE IF NOT EXISTS dir ( "                      \
+   "dir_id           INTEGER PRIMARY KEY AUTOINCREMENT, " \
+   "dir_path         TEXT    NOT NULL UNIQUE, "           \
+   "dir_mtime        INTEGER NOT NULL, "                  \
+   "dir_parent       TEXT    NULL "                       \
+ ");"
+
+/* Ids which are maybe no longer used, see the triggers. */
+#define CREATE_TABLE_CLEANUP_META                         \
+ "CREATE TABLE IF NOT EXISTS cleanup_meta ( "             \
+   "meta_id          INTEGER PRIMARY KEY "                \
+ ");"
+
+#define CREATE_TABLE_CLEANUP_DATA                         \
+ "CREATE TABLE IF NOT EXISTS cleanup_data ( "             \
+   "data_id          INTEGER PRIMARY KEY "                \
+ ");"
+
+#define CREATE_TABLE_CLEANUP_GRABBER                      \
+ "CREATE TABLE IF NOT EXISTS cleanup_grabber ( "          \
+   "grabber_id       INTEGER PRIMARY KEY "                \
+ ");"
+
+/*
+ * Results of the parser, the key is the identity of the content on the disk
+ * (device, inode, size and a fingerprint of the head and the tail, then a
+ * renamed or touched file is found). The tags
+ * are serialized as "key\0value\0..." like returned by libavformat.
+ */
+#define CREATE_TABLE_PROBE                                \
+ "CREATE TABLE IF NOT EXISTS probe ( "                    \
+   "probe_dev        INTEGER NOT NULL, "                  \
+   "probe_ino        INTEGER NOT NULL, "                  \
+   "probe_size       INTEGER NOT NULL, "                  \
+   "probe_fp         INTEGER NOT NULL, "                  \
+   "probe_type       INTEGER NOT NULL, "                  \
+   "probe_tags       BLOB    NULL, "                      \
+   "probe_path       TEXT    NOT NULL, "                  \
+   "PRIMARY KEY (probe_dev, probe_ino) "                  \
+ ");"
+
+/* Full-text index on the values (external content, optional FTS5 module). */
+#define CREATE_TABLE_DATA_FTS                             \
+ "CREATE VIRTUAL TABLE IF NOT EXISTS data_fts "           \
+ "USING fts5 ( "                                          \
+   "data_value, "                                         \
+   "content = 'data', "                                   \
+   "content_rowid = 'data_id', "                          \
+   "tokenize = 'unicode61 remove_diacritics 2', "         \
+   "prefix = '1 2 3' "                                    \
+ ");"
+
 /******************************************************************************/
 /*                                                                            */
 /*                              Create indexes                                */
@@ -161,6 +217,14 @@
  "CREATE INDEX IF NOT EXISTS "    \
  "assoc_idx ON assoc_file_metadata (meta_id, data_id);"
 
+#define CREATE_INDEX_ASSOC_DATA   \
+ "CREATE INDEX IF NOT EXISTS "    \
+ "assoc_data_idx ON assoc_file_metadata (data_id);"
+
+#define CREATE_INDEX_ASSOC_GRABBER \
+ "CREATE INDEX IF NOT EXISTS "     \
+ "assoc_grabber_idx ON assoc_file_grabber (grabber_id);"
+
 #define CREATE_INDEX_FK_FILE      \
  "CREATE INDEX IF NOT EXISTS "    \
  "file_fk_idx ON dlcontext (_file_id);"
@@ -169,6 +233,77 @@
  "CREATE INDEX IF NOT EXISTS "    \
  "grp_fk_idx ON assoc_file_metadata (_grp_id);"
 
+#define CREATE_INDEX_DIR_PARENT   \
+ "CREATE INDEX IF NOT EXISTS "    \
+ "dir_parent_idx ON dir (dir_parent);"
+
+#define CREATE_INDEX_FILE_TYPE    \
+ "CREATE INDEX IF NOT EXISTS "    \
+ "file_type_idx ON file (_type_id);"
+
+#define CREATE_INDEX_PROBE_PATH   \
+ "CREATE INDEX IF NOT EXISTS "    \
+ "probe_path_idx ON probe (probe_path);"
+
+/******************************************************************************/
+/*                                                                            */
+/*                              Create triggers                               */
+/*                                                                            */
+/******************************************************************************/
+
+#define CREATE_TRIGGER_FILE_DELETE                        \
+ "CREATE TRIGGER IF NOT EXISTS file_delete "              \
+ "AFTER DELETE ON file "                                  \
+ "BEGIN "                                                 \
+   "DELETE FROM assoc_file_metadata "                     \
+   "WHERE file_id = OLD.file_id; "                        \
+   "DELETE FROM assoc_file_grabber "                      \
+   "WHERE file_id = OLD.file_id; "                        \
+   "DELETE FROM probe "                                   \
+   "WHERE probe_path = OLD.file_path; "                   \
+ "END;"
+
+#define CREATE_TRIGGER_ASSOC_FILE_METADATA_DELETE         \
+ "CREATE TRIGGER IF NOT EXISTS assoc_file_metadata_delete " \
+ "AFTER DELETE ON assoc_file_metadata "                   \
+ "BEGIN "                                                 \
+   "INSERT OR IGNORE INTO cleanup_meta VALUES (OLD.meta_id); " \
+   "INSERT OR IGNORE INTO cleanup_data VALUES (OLD.data_id); " \
+ "END;"
+
+#define CREATE_TRIGGER_ASSOC_FILE_GRABBER_DELETE          \
+ "CREATE TRIGGER IF NOT EXISTS assoc_file_grabber_delete " \
+ "AFTER DELETE ON assoc_file_grabber "                    \
+ "BEGIN "                                                 \
+   "INSERT OR IGNORE INTO cleanup_grabber VALUES (OLD.grabber_id); " \
+ "END;"
+
+#define CREATE_TRIGGER_DATA_FTS_INSERT                    \
+ "CREATE TRIGGER IF NOT EXISTS data_fts_insert "          \
+ "AFTER INSERT ON data "                                  \
+ "BEGIN "                                                 \
+   "INSERT INTO data_fts (rowid, data_value) "            \
+   "VALUES (NEW.data_id, NEW.data_value); "               \
+ "END;"
+
+#define CREATE_TRIGGER_DATA_FTS_DELETE                    \
+ "CREATE TRIGGER IF NOT EXISTS data_fts_delete "          \
+ "AFTER DELETE ON data "                                  \
+ "BEGIN "                                                 \
+   "INSERT INTO data_fts (data_fts, rowid, data_value) "  \
+   "VALUES ('delete', OLD.data_id, OLD.data_value); "     \
+ "END;"
+
+#define CREATE_TRIGGER_DATA_FTS_UPDATE                    \
+ "CREATE TRIGGER IF NOT EXISTS data_fts_update "          \
+ "AFTER UPDATE OF data_value ON data "                    \
+ "BEGIN "                                                 \
+   "INSERT INTO data_fts (data_fts, rowid, data_value) "  \
+   "VALUES ('delete', OLD.data_id, OLD.data_value); "     \
+   "INSERT INTO data_fts (rowid, data_value) "            \
+   "VALUES (NEW.data_id, NEW.data_value); "               \
+ "END;"
+
 /******************************************************************************/
 /*                                                                            */
 /*                                 Updater                                    */
@@ -212,9 +347,9 @@
  "ORDER BY assoc.priority__;"
 
 #define SELECT_FILE_WHERE_FILE_ID \
- "file.file_id = %"VH_I64" "
+ "file.file_id = ?%u "
 #define SELECT_FILE_WHERE_FILE_PATH \
- "file.file_path = '%q' "
+ "file.file_path = ?%u "
 
 /* File list selection */
 
@@ -222,11 +357,14 @@
  "SELECT file_id, file_path, _type_id " \
  "FROM file AS assoc " /* "assoc" is a trick to factorize with the sub-query */
 
+#define SELECT_LIST_FILE_AFTER \
+ "file_id > ?%u "
+
 #define SELECT_LIST_FILE_END \
- "ORDER BY file_id;"
+ "ORDER BY file_id "
 
 #define SELECT_LIST_WHERE_TYPE_ID \
- "_type_id = %"VH_I64" "
+ "_type_id = ?%u "
 
 /* Metadata list selection */
 
@@ -245,18 +383,76 @@
  "assoc.file_id IN ( "                      \
    "SELECT file_id "                        \
    "FROM file "                             \
-   "WHERE _type_id = %"VH_I64" "            \
+   "WHERE _type_id = ?%u "                  \
  ") "
 
+/* data_value is unique, then the key of a row is (data_value, meta_id) */
+#define SELECT_LIST_METADATA_AFTER                   \
+ "(data.data_value > ?%u "                           \
+   "OR (data.data_value = ?%u AND assoc.meta_id > ?%u)) "
+
 #define SELECT_LIST_METADATA_END          \
  "GROUP BY assoc.meta_id, assoc.data_id " \
- "ORDER BY data.data_value;"
+ "ORDER BY data.data_value, assoc.meta_id "
+
+/* Counts */
+
+#define SELECT_COUNT_FILE_FROM \
+ "SELECT COUNT(*) "           \
+ "FROM file AS assoc "
+
+#define SELECT_COUNT_TYPE_FROM     \
+ "SELECT _type_id, COUNT(*) "      \
+ "FROM file AS assoc "
+
+#define SELECT_COUNT_TYPE_END \
+ "GROUP BY _type_id "         \
+ "ORDER BY _type_id;"
+
+#define SELECT_COUNT_METADATA_FROM                        \
+ "SELECT meta.meta_id, data.data_id, "                    \
+        "meta.meta_name, data.data_value, "               \
+        "COUNT(DISTINCT assoc.file_id) "                  \
+ "FROM ( "                                                \
+   "data INNER JOIN assoc_file_metadata AS assoc "        \
+   "ON data.data_id = assoc.data_id "                     \
+ ") INNER JOIN meta "                                     \
+ "ON assoc.meta_id = meta.meta_id "
+
+/* Full-text search */
+
+#define SELECT_SEARCH_FROM                                          \
+ "SELECT file.file_id, file.file_path, file._type_id "              \
+ "FROM ( "                                                          \
+   "SELECT assoc.file_id AS file_id, MIN(data_fts.rank) AS rank "   \
+   "FROM data_fts INNER JOIN assoc_file_metadata AS assoc "         \
+   "ON assoc.data_id = data_fts.rowid "                             \
+   "WHERE data_fts MATCH ?%u "
+
+#define SELECT_SEARCH_WHERE_META                                    \
+     "AND assoc.meta_id IN ( "                                      \
+       "SELECT meta_id FROM meta WHERE meta_name = ?%u "            \
+     ") "
+
+#define SELECT_SEARCH_GROUP                                         \
+   "GROUP BY assoc.file_id "                                        \
+ ") AS res INNER JOIN file "                                        \
+ "ON file.file_id = res.file_id "
+
+#define SELECT_SEARCH_WHERE_TYPE_ID \
+ "WHERE file._type_id = ?%u "
+
+#define SELECT_SEARCH_END \
+ "ORDER BY res.rank, file.file_id "
 
 /* Common */
 
 #define SELECT_LIST_WHERE \
  "WHERE "
 
+#define SELECT_LIST_LIMIT \
+ "LIMIT ?%u"
+
 #define SELECT_LIST_WHERE_SUB_IN \
    "assoc.file_id IN ( "
 #define SELECT_LIST_WHERE_SUB_NOTIN \
@@ -276,19 +472,19 @@
 #define SELECT_LIST_OR \
  "OR "
 #define SELECT_LIST_WHERE_META_NAME \
- "meta.meta_name = '%q' "
+ "meta.meta_name = ?%u "
 #define SELECT_LIST_WHERE_META_ID \
- "meta.meta_id = %"VH_I64" "
+ "meta.meta_id = ?%u "
 #define SELECT_LIST_WHERE_DATA_NAME \
- "data.data_value = '%q' "
+ "data.data_value = ?%u "
 #define SELECT_LIST_WHERE_DATA_ID \
- "data.data_id = %"VH_I64" "
+ "data.data_id = ?%u "
 #define SELECT_LIST_WHERE_LANG_ID \
- "data._lang_id = %"VH_I64" "
+ "data._lang_id = ?%u "
 #define SELECT_LIST_WHERE_GROUP_ID \
- "assoc._grp_id = %"VH_I64" "
+ "assoc._grp_id = ?%u "
 #define SELECT_LIST_WHERE_PRIORITY \
- "assoc.priority__ <= %i " /* << highest,  >> lowest */
+ "assoc.priority__ <= ?%u " /* << highest,  >> lowest */
 
 /* Internal */
 
@@ -307,6 +503,10 @@
  "FROM file "             \
  "WHERE file_path = ?;"
 
+#define SELECT_FILE_PRELOAD                                   \
+ "SELECT file_id, file_path, file_mtime, interrupted__ "      \
+ "FROM file;"
+
 #define SELECT_TYPE_ID   \
  "SELECT type_id "       \
  "FROM type "            \
@@ -367,10 +567,15 @@
  "FROM assoc_file_metadata "       \
  "WHERE file_id = ? AND meta_id = ? AND data_id = ?;"
 
+/* The files not seen with the current generation. */
 #define SELECT_FILE_CHECKED_CLEAR \
  "SELECT file_path "              \
  "FROM file "                     \
- "WHERE checked__ = 0 AND outofpath__ = 0;"
+ "WHERE checked__ < ? AND outofpath__ = 0;"
+
+#define SELECT_FILE_CHECKED_MAX \
+ "SELECT max (checked__) "      \
+ "FROM file;"
 
 #define SELECT_FILE_OUTOFPATH_SET \
  "SELECT file_path "              \
@@ -386,6 +591,32 @@
  "ON assoc.file_id = file.file_id "                   \
  "WHERE file.file_path = ?;"
 
+/*
+ * The mtime is not returned when a file (at any depth) is not fully handled,
+ * then the directory is listed again and the files are sent to the parser.
+ */
+#define SELECT_DIR_MTIME                            \
+ "SELECT dir_mtime "                                \
+ "FROM dir "                                        \
+ "WHERE dir_path = ?1 AND NOT EXISTS ( "            \
+   "SELECT 1 "                                      \
+   "FROM file INDEXED BY interrupted_idx "          \
+   "WHERE interrupted__ IN (-1, 1) "                \
+     "AND file_path > ?1 || '/' "                   \
+     "AND file_path < ?1 || '0' "                   \
+ ");"
+
+#define SELECT_PROBE                          \
+ "SELECT probe_type, probe_tags, probe_path " \
+ "FROM probe "                                \
+ "WHERE probe_dev = ? AND probe_ino = ? "     \
+   "AND probe_size = ? AND probe_fp = ?;"
+
+#define SELECT_DIR_CHILDREN \
+ "SELECT dir_path "         \
+ "FROM dir "                \
+ "WHERE dir_parent = ?;"
+
 #define SELECT_FILE_DLCONTEXT                           \
  "SELECT dlcontext_url, dlcontext_dst, dlcontext_name " \
  "FROM dlcontext INNER JOIN file "                      \
@@ -410,7 +641,7 @@
  "           checked__, "     \
  "           interrupted__, " \
  "           outofpath__) "   \
- "VALUES (?, ?, 1, -1, ?);"
+ "VALUES (?1, ?2, ?4, -1, ?3);"
 
 #define INSERT_TYPE        \
  "INSERT "                 \
@@ -460,24 +691,46 @@
  "INTO assoc_file_grabber (file_id, grabber_id) "                 \
  "VALUES (?, ?);"
 
+#define INSERT_DIR                                    \
+ "INSERT OR IGNORE "                                  \
+ "INTO dir (dir_path, dir_mtime, dir_parent) "        \
+ "VALUES (?, ?, ?);"
+
+#define INSERT_PROBE                                  \
+ "INSERT OR REPLACE "                                 \
+ "INTO probe (probe_dev, probe_ino, probe_size, "     \
+             "probe_fp, probe_type, probe_tags, "     \
+             "probe_path) "                           \
+ "VALUES (?, ?, ?, ?, ?, ?, ?);"
+
 /******************************************************************************/
 /*                                                                            */
 /*                                  Update                                    */
 /*                                                                            */
 /******************************************************************************/
 
-#define UPDATE_FILE          \
- "UPDATE file "              \
- "SET file_mtime      = ?, " \
- "    checked__       = 1, " \
- "    interrupted__   = 1, " \
- "    outofpath__     = ?, " \
- "    _type_id        = ?  " \
- "WHERE file_path = ?;"
-
-#define UPDATE_FILE_CHECKED_CLEAR \
- "UPDATE file "                   \
- "SET checked__ = 0;"
+#define UPDATE_FILE           \
+ "UPDATE file "               \
+ "SET file_mtime      = ?1, " \
+ "    checked__       = ?5, " \
+ "    interrupted__   = 1, "  \
+ "    outofpath__     = ?2, " \
+ "    _type_id        = ?3  " \
+ "WHERE file_path = ?4;"
+
+/* Only the files in the directory, the sub-directories are ignored. */
+#define UPDATE_FILE_CHECKED_DIR                                 \
+ "UPDATE file "                                                 \
+ "SET checked__ = ?2 "                                          \
+ "WHERE file_path > ?1 || '/' AND file_path < ?1 || '0' "       \
+   "AND instr (substr (file_path, length (?1) + 2), '/') = 0;"
+
+/* 16 ids by statement, the unused ids are set to 0. */
+#define UPDATE_FILE_CHECKED_IDS                                 \
+ "UPDATE file "                                                 \
+ "SET checked__ = ?17 "                                         \
+ "WHERE file_id IN (?1, ?2,  ?3,  ?4,  ?5,  ?6,  ?7,  ?8, "     \
+                   "?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16);"
 
 #define UPDATE_FILE_INTERRUP_CLEAR \
  "UPDATE file "                    \
@@ -489,6 +742,21 @@
  "SET interrupted__ = 1 "        \
  "WHERE interrupted__ = -1;"
 
+#define UPDATE_DIR_MTIME  \
+ "UPDATE dir "            \
+ "SET dir_mtime = ? "     \
+ "WHERE dir_path = ?;"
+
+#define UPDATE_DIR_PARENT \
+ "UPDATE dir "            \
+ "SET dir_parent = ? "    \
+ "WHERE dir_path = ?;"
+
+#define UPDATE_PROBE_PATH                          \
+ "UPDATE probe "                                   \
+ "SET probe_path = ? "                             \
+ "WHERE probe_dev = ? AND probe_ino = ?;"
+
 #define UPDATE_ASSOC_FILE_METADATA \
  "UPDATE assoc_file_metadata "     \
  "SET _grp_id  = ?, "              \
@@ -536,29 +804,86 @@
 #define DELETE_DLCONTEXT  \
  "DELETE FROM dlcontext;"
 
+#define DELETE_DIR  \
+ "DELETE FROM dir " \
+ "WHERE dir_path = ?;"
+
+#define DELETE_DIR_TREE                                         \
+ "DELETE FROM dir "                                             \
+ "WHERE dir_path = ?1 "                                         \
+    "OR (dir_path > ?1 || '/' AND dir_path < ?1 || '0');"
+
+#define DELETE_DIR_ALL \
+ "DELETE FROM dir;"
+
 /* Cleanup */
 
-#define CLEANUP_META                \
- "DELETE FROM meta "                \
- "WHERE meta_id NOT IN ( "          \
-   "SELECT meta_id "                \
-   "FROM assoc_file_metadata "      \
+/* Only the ids saved by the triggers are checked, by chunks. */
+#define CLEANUP_META                                            \
+ "DELETE FROM meta "                                            \
+ "WHERE meta_id IN ( "                                          \
+   "SELECT meta_id FROM cleanup_meta ORDER BY meta_id LIMIT ? " \
+ ") AND NOT EXISTS ( "                                          \
+   "SELECT 1 FROM assoc_file_metadata "                         \
+   "WHERE assoc_file_metadata.meta_id = meta.meta_id "          \
+ ");"
+
+#define CLEANUP_META_DONE                                       \
+ "DELETE FROM cleanup_meta "                                    \
+ "WHERE meta_id IN ( "                                          \
+   "SELECT meta_id FROM cleanup_meta ORDER BY meta_id LIMIT ? " \
  ");"
 
-#define CLEANUP_DATA                \
- "DELETE FROM data "                \
- "WHERE data_id NOT IN ( "          \
-   "SELECT data_id "                \
-   "FROM assoc_file_metadata "      \
+#define CLEANUP_DATA                                            \
+ "DELETE FROM data "                                            \
+ "WHERE data_id IN ( "                                          \
+   "SELECT data_id FROM cleanup_data ORDER BY data_id LIMIT ? " \
+ ") AND NOT EXISTS ( "                                          \
+   "SELECT 1 FROM assoc_file_metadata "                         \
+   "WHERE assoc_file_metadata.data_id = data.data_id "          \
  ");"
 
-#define CLEANUP_GRABBER             \
- "DELETE FROM grabber "             \
- "WHERE grabber_id NOT IN ( "       \
-   "SELECT grabber_id "             \
-   "FROM assoc_file_grabber "       \
+#define CLEANUP_DATA_DONE                                       \
+ "DELETE FROM cleanup_data "                                    \
+ "WHERE data_id IN ( "                                          \
+   "SELECT data_id FROM cleanup_data ORDER BY data_id LIMIT ? " \
  ");"
 
+#define CLEANUP_GRABBER                                         \
+ "DELETE FROM grabber "                                         \
+ "WHERE grabber_id IN ( "                                       \
+   "SELECT grabber_id FROM cleanup_grabber "                    \
+   "ORDER BY grabber_id LIMIT ? "                               \
+ ") AND NOT EXISTS ( "                                          \
+   "SELECT 1 FROM assoc_file_grabber "                          \
+   "WHERE assoc_file_grabber.grabber_id = grabber.grabber_id "  \
+ ");"
+
+#define CLEANUP_GRABBER_DONE                                    \
+ "DELETE FROM cleanup_grabber "                                 \
+ "WHERE grabber_id IN ( "                                       \
+   "SELECT grabber_id FROM cleanup_grabber "                    \
+   "ORDER BY grabber_id LIMIT ? "                               \
+ ");"
+
+/*
+ * Databases created without the triggers. The orphans are removed once and
+ * all ids are checked by the incremental cleanup.
+ */
+#define CLEANUP_SEED_META                                       \
+ "INSERT OR IGNORE INTO cleanup_meta SELECT meta_id FROM meta;"
+
+#define CLEANUP_SEED_DATA                                       \
+ "INSERT OR IGNORE INTO cleanup_data SELECT data_id FROM data;"
+
+#define CLEANUP_SEED_GRABBER                                    \
+ "INSERT OR IGNORE INTO cleanup_grabber "                       \
+ "SELECT grabber_id FROM grabber;"
+
+/* Databases with values inserted before the full-text index. */
+#define FTS_REBUILD_DATA \
+ "INSERT INTO data_fts (data_fts) VALUES ('rebuild');"
+
 #define CLEANUP_ASSOC_FILE_METADATA \
  "DELETE FROM assoc_file_metadata " \
  "WHERE file_id NOT IN ( "          \
@@ -30,6 +30,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <libavformat/avformat.h>
+
 #include "valhalla.h"
 #include "valhalla_internals.h"
 #include "event_handler.h"
@@ -38,6 +40,7 @@
 #include "metadata.h"
 #include "fifo_queue.h"
 #include "osdep.h"
+#include "lavf_utils.h"
 #include "utils.h"
 
 
@@ -192,12 +195,42 @@ vh_file_data_free (file_data_t *data)
     file_dl_free (data->list_downloader);
   if (data->grabber_list)
     vh_list_free (data->grabber_list);
+  if (data->probe)
+  {
+    if (data->probe->tags)
+      free (data->probe->tags);
+    free (data->probe);
+  }
+  if (data->lavf_ctx)
+  {
+    AVFormatContext *ctx = vh_file_data_lavf_get (data);
+    vh_lavf_utils_close_input_file (&ctx);
+  }
 
   sem_destroy (&data->sem_grabber);
 
   free (data);
 }
 
+/*
+ * The context kept by the parser is given only one time. The counter of the
+ * contexts is decreased, the caller must close it.
+ */
+struct AVFormatContext *
+vh_file_data_lavf_get (file_data_t *data)
+{
+  struct AVFormatContext *ctx;
+
+  if (!data)
+    return NULL;
+
+  ctx = __atomic_exchange_n (&data->lavf_ctx, NULL, __ATOMIC_ACQ_REL);
+  if (ctx && data->lavf_nb)
+    __atomic_sub_fetch (data->lavf_nb, 1, __ATOMIC_RELAXED);
+
+  return ctx;
+}
+
 file_data_t *
 vh_file_data_new (const char *file, struct stat *st, int outofpath,
                   od_type_t od, fifo_queue_prio_t prio, processing_step_t step)
@@ -231,12 +264,12 @@ vh_file_data_step_increase (file_data_t *data, action_list_t *action)
   switch (data->step)
   {
   case STEP_PARSING:
-    data->step++;
+    VH_FILE_DATA_SET (data, step, data->step + 1);
     break;
 
 #ifdef USE_GRABBER
   case STEP_GRABBING:
-    data->step++;
+    VH_FILE_DATA_SET (data, step, data->step + 1);
     switch (*action)
     {
     case ACTION_DB_INSERT_P:
@@ -253,7 +286,7 @@ vh_file_data_step_increase (file_data_t *data, action_list_t *action)
     break;
 
   case STEP_DOWNLOADING:
-    data->step++;
+    VH_FILE_DATA_SET (data, step, data->step + 1);
     break;
 #endif /* USE_GRABBER */
 
@@ -66,9 +66,28 @@ typedef struct file_data_s {
   /* downloading attribute */
   file_dl_t  *list_downloader;
 
+  /* results of the parser for the probe cache (written by the dbmanager) */
+  struct database_probe_s *probe;
+
+  /* libavformat context of the parser, for the grabber ffmpeg */
+  struct AVFormatContext *lavf_ctx;
+  unsigned int           *lavf_nb;
+
   int         clean_f;
+
+  /* in-flight table */
+  unsigned int        inflight_hash;
+  struct file_data_s *inflight_next;
 } file_data_t;
 
+/*
+ * The on-demand changes 'od' and 'priority' (and reads 'step') while the
+ * file is handled by another thread.
+ */
+#define VH_FILE_DATA_GET(d, f) __atomic_load_n (&(d)->f, __ATOMIC_RELAXED)
+#define VH_FILE_DATA_SET(d, f, v)                                       \
+  __atomic_store_n (&(d)->f, v, __ATOMIC_RELAXED)
+
 
 void vh_strtolower (char *str);
 char *vh_strrcasestr (const char *buf, const char *str);
@@ -77,6 +96,7 @@ int vh_file_copy (const char *src, const char *dst);
 void vh_file_dl_add (file_dl_t **dl,
                      const char *url, const char *name, valhalla_dl_t dst);
 void vh_file_data_free (file_data_t *data);
+struct AVFormatContext *vh_file_data_lavf_get (file_data_t *data);
 file_data_t *vh_file_data_new (const char *file, struct stat *st,
                                int outofpath, od_type_t od,
                                fifo_queue_prio_t prio, processing_step_t step);
@@ -39,7 +39,9 @@
 #include "utils.h"
 #include "osdep.h"
 #include "stats.h"
+#include "inflight.h"
 #include "metadata.h"
+#include "lavf_utils.h"
 #include "logs.h"
 
 #ifdef USE_GRABBER
@@ -104,10 +106,17 @@ queue_cleanup (fifo_queue_t *queue)
 
     case ACTION_OD_ENGAGE:
     case ACTION_EH_EVENTGL:
+    case ACTION_DB_DELFILE:
+    case ACTION_DB_DIRCHECKED:
       if (data)
         free (data);
       break;
 
+    case ACTION_DB_NEWDIR:
+      if (data)
+        vh_dbmanager_dir_free (data);
+      break;
+
     case ACTION_EH_EVENTOD:
       if (data)
         vh_event_handler_od_free (data);
@@ -133,6 +142,7 @@ valhalla_mrproper (valhalla_t *handle)
     vh_dbmanager_fifo_get (handle->dbmanager),
     vh_dispatcher_fifo_get (handle->dispatcher),
     vh_parser_fifo_get (handle->parser),
+    vh_parser_fifo_od_get (handle->parser),
 #ifdef USE_GRABBER
     vh_grabber_fifo_get (handle->grabber),
     vh_downloader_fifo_get (handle->downloader),
@@ -274,6 +284,47 @@ valhalla_config_set_orig (valhalla_t *handle, valhalla_cfg_t conf, ...)
 
   switch (conf)
   {
+  case VALHALLA_CFG_DB_CACHE_SIZE:
+    vh_dbmanager_db_pragma (handle->dbmanager, DATABASE_PRAGMA_CACHE_SIZE, i);
+    break;
+
+  case VALHALLA_CFG_DB_JOURNAL_WAL:
+    vh_dbmanager_db_pragma (handle->dbmanager, DATABASE_PRAGMA_JOURNAL_WAL, i);
+    break;
+
+  case VALHALLA_CFG_DB_MMAP_SIZE:
+    if (i >= 0)
+      vh_dbmanager_db_pragma (handle->dbmanager,
+                              DATABASE_PRAGMA_MMAP_SIZE, i);
+    break;
+
+  case VALHALLA_CFG_DB_PAGE_SIZE:
+    if (i >= 512 && i <= 65536 && !(i & (i - 1)))
+      vh_dbmanager_db_pragma (handle->dbmanager,
+                              DATABASE_PRAGMA_PAGE_SIZE, i);
+    break;
+
+  case VALHALLA_CFG_DB_READERS:
+    if (i >= 0)
+      vh_dbmanager_db_readers_set (handle->dbmanager, (unsigned int) i);
+    break;
+
+  case VALHALLA_CFG_DB_SYNCHRONOUS:
+    if (i >= 0 && i <= 3)
+      vh_dbmanager_db_pragma (handle->dbmanager,
+                              DATABASE_PRAGMA_SYNCHRONOUS, i);
+    break;
+
+  case VALHALLA_CFG_DB_TEMP_STORE:
+    if (i >= 0 && i <= 2)
+      vh_dbmanager_db_pragma (handle->dbmanager,
+                              DATABASE_PRAGMA_TEMP_STORE, i);
+    break;
+
+  case VALHALLA_CFG_DISPATCHER_DIRECT:
+    vh_dispatcher_direct_set (handle->dispatcher, i);
+    break;
+
 #ifdef USE_GRABBER
   case VALHALLA_CFG_DOWNLOADER_DEST:
     vh_downloader_destination_set (handle->downloader, (valhalla_dl_t) i, p1);
@@ -290,11 +341,33 @@ valhalla_config_set_orig (valhalla_t *handle, valhalla_cfg_t conf, ...)
     break;
 #endif /* USE_GRABBER */
 
+  case VALHALLA_CFG_PARSER_ADAPTIVE:
+    if (i >= 0)
+      vh_parser_adaptive_set (handle->parser, (unsigned int) i);
+    break;
+
+#ifdef USE_GRABBER
+  case VALHALLA_CFG_PARSER_CONTEXTS:
+    if (i >= 0)
+      vh_parser_context_set (handle->parser, (unsigned int) i);
+    break;
+#endif /* USE_GRABBER */
+
   case VALHALLA_CFG_PARSER_KEYWORD:
     if (p1)
       vh_parser_bl_keyword_add (handle->parser, p1);
     break;
 
+  case VALHALLA_CFG_SCANNER_DIRCACHE:
+    vh_scanner_dircache_set (handle->scanner, i);
+    break;
+
+#ifdef USE_INOTIFY
+  case VALHALLA_CFG_SCANNER_INOTIFY:
+    vh_scanner_inotify_set (handle->scanner, i);
+    break;
+#endif /* USE_INOTIFY */
+
   case VALHALLA_CFG_SCANNER_PATH:
     if (p1)
       vh_scanner_path_add (handle->scanner, p1, i);
@@ -305,6 +378,11 @@ valhalla_config_set_orig (valhalla_t *handle, valhalla_cfg_t conf, ...)
       vh_scanner_suffix_add (handle->scanner, p1);
     break;
 
+  case VALHALLA_CFG_SCANNER_WALKERS:
+    if (i >= 0)
+      vh_scanner_walker_set (handle->scanner, (unsigned int) i);
+    break;
+
   default:
     vh_log (VALHALLA_MSG_WARNING,
             "%s: unsupported option %#x", __FUNCTION__, conf);
@@ -418,7 +496,11 @@ valhalla_uninit (valhalla_t *handle)
     av_lockmgr_register (NULL);
 #endif /* USE_LAVC */
 
+  if (!preinit)
+    vh_lavf_utils_uninit ();
+
   vh_stats_free (handle->stats);
+  vh_inflight_free (handle->inflight);
 
   vh_log (VALHALLA_MSG_VERBOSE, "%s: end", __FUNCTION__);
 
@@ -630,6 +712,10 @@ valhalla_init (const char *db, valhalla_init_param_t *param)
   if (!handle->stats)
     goto err;
 
+  handle->inflight = vh_inflight_new ();
+  if (!handle->inflight)
+    goto err;
+
   if (pp->od_cb || pp->gl_cb || pp->md_cb)
   {
     event_handler_cb_t cb;
@@ -684,8 +770,12 @@ valhalla_init (const char *db, valhalla_init_param_t *param)
 #endif /* USE_LAVC */
     av_log_set_level (AV_LOG_FATAL);
     av_register_all ();
+    if (vh_lavf_utils_init ())
+      goto err;
   }
 
+  vh_lavf_utils_stats (handle->stats);
+
   pthread_mutex_lock (&g_preinit_mutex);
   g_preinit++;
   pthread_mutex_unlock (&g_preinit_mutex);
@@ -754,7 +844,23 @@ valhalla_db_metalist_get (valhalla_t *handle, valhalla_db_item_t *search,
     return NULL;
 
   return vh_dbmanager_db_metalist_get (handle->dbmanager,
-                                       search, filetype, restriction);
+                                       search, filetype, restriction, NULL, 0);
+}
+
+valhalla_db_stmt_t *
+valhalla_db_metalist_get_page (valhalla_t *handle, valhalla_db_item_t *search,
+                               valhalla_file_type_t filetype,
+                               valhalla_db_restrict_t *restriction,
+                               const valhalla_db_metares_t *after,
+                               unsigned int limit)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle || !search)
+    return NULL;
+
+  return vh_dbmanager_db_metalist_get (handle->dbmanager, search,
+                                       filetype, restriction, after, limit);
 }
 
 const valhalla_db_metares_t *
@@ -777,8 +883,23 @@ valhalla_db_filelist_get (valhalla_t *handle, valhalla_file_type_t filetype,
   if (!handle)
     return NULL;
 
-  return
-    vh_dbmanager_db_filelist_get (handle->dbmanager, filetype, restriction);
+  return vh_dbmanager_db_filelist_get (handle->dbmanager,
+                                       filetype, restriction, 0, 0);
+}
+
+valhalla_db_stmt_t *
+valhalla_db_filelist_get_page (valhalla_t *handle,
+                               valhalla_file_type_t filetype,
+                               valhalla_db_restrict_t *restriction,
+                               int64_t after, unsigned int limit)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle)
+    return NULL;
+
+  return vh_dbmanager_db_filelist_get (handle->dbmanager,
+                                       filetype, restriction, after, limit);
 }
 
 const valhalla_db_fileres_t *
@@ -815,6 +936,56 @@ valhalla_db_file_read (valhalla_t *handle, valhalla_db_stmt_t *vhstmt)
   return vh_dbmanager_db_file_read (handle->dbmanager, vhstmt);
 }
 
+int64_t
+valhalla_db_count (valhalla_t *handle, valhalla_file_type_t filetype,
+                   valhalla_db_restrict_t *restriction)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle)
+    return -1;
+
+  return vh_dbmanager_db_count (handle->dbmanager, filetype, restriction);
+}
+
+valhalla_db_stmt_t *
+valhalla_db_count_get (valhalla_t *handle, valhalla_db_item_t *search,
+                       valhalla_file_type_t filetype,
+                       valhalla_db_restrict_t *restriction)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle)
+    return NULL;
+
+  return vh_dbmanager_db_count_get (handle->dbmanager,
+                                    search, filetype, restriction);
+}
+
+const valhalla_db_countres_t *
+valhalla_db_count_read (valhalla_t *handle, valhalla_db_stmt_t *vhstmt)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle || !vhstmt)
+    return NULL;
+
+  return vh_dbmanager_db_count_read (handle->dbmanager, vhstmt);
+}
+
+valhalla_db_stmt_t *
+valhalla_db_search (valhalla_t *handle, const char *text, const char *meta,
+                    valhalla_file_type_t filetype, unsigned int limit)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle || !text)
+    return NULL;
+
+  return vh_dbmanager_db_search (handle->dbmanager,
+                                 text, meta, filetype, limit);
+}
+
 /******************************************************************************/
 /*                                                                            */
 /*                  For Public Insertions/Updates/Deletions                   */
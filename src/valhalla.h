@@ -373,6 +373,7 @@ typedef struct valhalla_file_s {
  *
  * Next \p num for the current combinations :
  * <pre>
+ * VH_INT_T                             : 13
  * VH_VOIDP_T                           : 2
  * VH_VOIDP_T | VH_INT_T                : 3
  * VH_VOIDP_T | VH_INT_T | VH_VOIDP_2_T : 1
@@ -381,6 +382,87 @@ typedef struct valhalla_file_s {
  * \see VH_CFG_INIT().
  */
 typedef enum valhalla_cfg {
+  /**
+   * Set the size of the SQLite page cache. A positive value is a number of
+   * pages and a negative value is a size in KiB (see PRAGMA cache_size).
+   *
+   * \param[in] arg1 ::VH_INT_T     Size of the cache.
+   */
+  VH_CFG_INIT (DB_CACHE_SIZE, VH_INT_T, 4),
+
+  /**
+   * Use the write-ahead log of SQLite instead of the rollback journal. The
+   * commits are faster and the database can be read while the database
+   * manager is writing. The mode is saved in the database file. By default
+   * the rollback journal is used.
+   *
+   * \param[in] arg1 ::VH_INT_T     1 for WAL, 0 for the rollback journal.
+   */
+  VH_CFG_INIT (DB_JOURNAL_WAL, VH_INT_T, 5),
+
+  /**
+   * Maximum size of the database file mapped in memory. By default (0), the
+   * memory-mapped I/O are not used.
+   *
+   * \param[in] arg1 ::VH_INT_T     Size in MiB.
+   */
+  VH_CFG_INIT (DB_MMAP_SIZE, VH_INT_T, 6),
+
+  /**
+   * Change the page size of the database (power of two between 512 and
+   * 65536). The database is rebuilt (VACUUM) only when the current size is
+   * different.
+   *
+   * \warning The page size can not be changed when the database is in WAL
+   *          mode (this mode is kept in the file between the sessions),
+   *          then this parameter must be set before
+   *          ::VALHALLA_CFG_DB_JOURNAL_WAL.
+   * \param[in] arg1 ::VH_INT_T     Size in bytes.
+   */
+  VH_CFG_INIT (DB_PAGE_SIZE, VH_INT_T, 7),
+
+  /**
+   * Maximum number of read-only connections used by the public selections
+   * (valhalla_db_*). A connection is leased by a statement until its last
+   * row, then several selections can be read concurrently and they never
+   * wait on the transactions of the database manager. The connections are
+   * used only with the WAL journal (see ::VALHALLA_CFG_DB_JOURNAL_WAL),
+   * else the selections use the connection of the database manager. By
+   * default 4 connections can be opened (16 at most), 0 to disable.
+   *
+   * \param[in] arg1 ::VH_INT_T     Number of connections.
+   */
+  VH_CFG_INIT (DB_READERS, VH_INT_T, 10),
+
+  /**
+   * Level of synchronization with the disk (see PRAGMA synchronous): 0 for
+   * OFF, 1 for NORMAL, 2 for FULL and 3 for EXTRA. With the WAL journal,
+   * NORMAL is safe and no longer syncs with each commit. By default FULL is
+   * used.
+   *
+   * \param[in] arg1 ::VH_INT_T     Level.
+   */
+  VH_CFG_INIT (DB_SYNCHRONOUS, VH_INT_T, 8),
+
+  /**
+   * Where the temporary tables and indices are stored: 0 for the default of
+   * SQLite, 1 for a file and 2 for the memory.
+   *
+   * \param[in] arg1 ::VH_INT_T     Storage.
+   */
+  VH_CFG_INIT (DB_TEMP_STORE, VH_INT_T, 9),
+
+  /**
+   * Route the files directly from a step to the next one. The threads of
+   * the parser, the grabber and the downloader send the files to the next
+   * queue (and to the database manager) without waking up the dispatcher
+   * thread. The dispatcher is only used for the other messages like the end
+   * of a loop. By default the direct routing is disabled.
+   *
+   * \param[in] arg1 ::VH_INT_T     1 to enable, 0 to disable.
+   */
+  VH_CFG_INIT (DISPATCHER_DIRECT, VH_INT_T, 3),
+
   /**
    * Set a destination for the downloader. The default destination is used when
    * a specific destination is NULL.
@@ -424,6 +506,35 @@ typedef enum valhalla_cfg {
    */
   VH_CFG_INIT (GRABBER_STATE, VH_VOIDP_T | VH_INT_T, 0),
 
+  /**
+   * Maximum number of parser threads (max 16) for the adaptive pool. The
+   * pool starts with valhalla_init_param_t::parser_nb threads. A thread is
+   * added while files are waiting and the CPUs are not saturated, as long
+   * as it increases the number of files parsed by second (for example with
+   * a network share). A thread is removed when no file is waiting. The
+   * changes are counted in the statistics group "parser". By default (0)
+   * the number of threads is fixed.
+   *
+   * This option must be set before valhalla_run().
+   *
+   * \param[in] arg1 ::VH_INT_T     Maximum number of threads.
+   */
+  VH_CFG_INIT (PARSER_ADAPTIVE, VH_INT_T, 11),
+
+  /**
+   * Maximum number of libavformat contexts kept by the parser for the
+   * ffmpeg grabber. An audio or video file is then opened and probed only
+   * one time. Each kept context holds an opened file and the buffers of
+   * libavformat (the head read for the probes is released) until the
+   * grabber is reached. By default (0) the grabber opens the file again.
+   *
+   * This option must be set before valhalla_run().
+   *
+   * \warning There is no effect if the grabber support is not compiled.
+   * \param[in] arg1 ::VH_INT_T     Maximum number of contexts.
+   */
+  VH_CFG_INIT (PARSER_CONTEXTS, VH_INT_T, 12),
+
   /**
    * This parameter is useful only if the decrapifier is enabled with
    * valhalla_init().
@@ -465,6 +576,37 @@ typedef enum valhalla_cfg {
    */
   VH_CFG_INIT (PARSER_KEYWORD, VH_VOIDP_T, 0),
 
+  /**
+   * Save the modification time of the directories in the database. With the
+   * next scannings, a directory whose mtime is unchanged is not listed again:
+   * its files are only checked in the database and its known sub-directories
+   * are walked. By default this cache is disabled.
+   *
+   * The cache is dropped when the paths or the suffixes are changed.
+   *
+   * \warning The mtime of a directory is not changed when a file is only
+   *          modified in place (without rename). Such changes are ignored
+   *          by the scanner as long as the directory is unchanged.
+   * \param[in] arg1 ::VH_INT_T     1 to enable, 0 to disable.
+   */
+  VH_CFG_INIT (SCANNER_DIRCACHE, VH_INT_T, 2),
+
+  /**
+   * Use inotify in order to follow the changes in the paths instead of
+   * rescanning all files with each loop. The watches are registered with the
+   * first scanning. Then between the loops, only the files created, modified,
+   * moved or deleted are sent to the database manager. The \p timeout of
+   * valhalla_run() becomes the interval between two full scannings
+   * (reconciliations), and 0 means that only the events are handled until
+   * valhalla_scanner_wakeup() is called. By default inotify is disabled.
+   *
+   * If inotify can not be initialized, the full scannings are used as usual.
+   *
+   * \warning There is no effect if the inotify support is not compiled.
+   * \param[in] arg1 ::VH_INT_T     1 to enable, 0 to disable.
+   */
+  VH_CFG_INIT (SCANNER_INOTIFY, VH_INT_T, 0),
+
   /**
    * Add a path to the scanner. If the same path is added several times,
    * only one is saved in the scanner.
@@ -489,6 +631,17 @@ typedef enum valhalla_cfg {
    */
   VH_CFG_INIT (SCANNER_SUFFIX, VH_VOIDP_T, 1),
 
+  /**
+   * Number of threads (max 16) to walk the directories of a path. The walkers
+   * share the directories to read (work-stealing), then many directories are
+   * listed at the same time. It is useful with the network shares where the
+   * latency is high. By default (0), the directories are walked by the
+   * scanner thread.
+   *
+   * \param[in] arg1 ::VH_INT_T     Number of walkers.
+   */
+  VH_CFG_INIT (SCANNER_WALKERS, VH_INT_T, 1),
+
 } valhalla_cfg_t;
 
 /** \brief Parameters for valhalla_init(). */
@@ -857,6 +1010,14 @@ typedef struct valhalla_db_fileres_s {
   valhalla_file_type_t type;
 } valhalla_db_fileres_t;
 
+/** \brief Results for valhalla_db_count_get(). */
+typedef struct valhalla_db_countres_s {
+  int64_t     meta_id,    data_id;    /**< Only grouped by metadata. */
+  const char *meta_name, *data_value; /**< Only grouped by metadata. */
+  valhalla_file_type_t type;          /**< Only grouped by file type. */
+  int64_t     count;                  /**< Number of files.           */
+} valhalla_db_countres_t;
+
 /** \brief Restriction. */
 typedef struct valhalla_db_restrict_s {
   struct valhalla_db_restrict_s *next;
@@ -988,6 +1149,35 @@ valhalla_db_metalist_get (valhalla_t *handle,
 const valhalla_db_metares_t *
 valhalla_db_metalist_read (valhalla_t *handle, valhalla_db_stmt_t *vhstmt);
 
+/**
+ * \brief Init a statement to retrieve a page of a list of metadata.
+ *
+ * This function is like valhalla_db_metalist_get() but the rows are
+ * returned by pages. The rows are ordered by data value and meta ID, and
+ * the next page begins after the last row of the previous page. Only the
+ * fields \p data_value and \p meta_id of \p after are used, then a copy
+ * of these fields must be kept by the caller because the result is no
+ * longer valid when the statement is freed.
+ *
+ * The pages are found with the index of the values and without offset;
+ * the first page is as fast as the last one.
+ *
+ * \param[in] handle      Handle on the scanner.
+ * \param[in] search      Condition for the search.
+ * \param[in] filetype    File type.
+ * \param[in] restriction Restrictions on the list.
+ * \param[in] after       Last row of the previous page, NULL for the first.
+ * \param[in] limit       Maximum number of rows, 0 for no limit.
+ * \return the statement, NULL on error.
+ */
+valhalla_db_stmt_t *
+valhalla_db_metalist_get_page (valhalla_t *handle,
+                               valhalla_db_item_t *search,
+                               valhalla_file_type_t filetype,
+                               valhalla_db_restrict_t *restriction,
+                               const valhalla_db_metares_t *after,
+                               unsigned int limit);
+
 /**
  * \brief Init a statement to retrieve a list of files.
  *
@@ -1027,6 +1217,30 @@ valhalla_db_filelist_get (valhalla_t *handle,
 const valhalla_db_fileres_t *
 valhalla_db_filelist_read (valhalla_t *handle, valhalla_db_stmt_t *vhstmt);
 
+/**
+ * \brief Init a statement to retrieve a page of a list of files.
+ *
+ * This function is like valhalla_db_filelist_get() but the rows are
+ * returned by pages. The rows are ordered by file ID and the next page
+ * begins after the ID of the last file of the previous page.
+ *
+ * The pages are found with the primary key and without offset; the first
+ * page is as fast as the last one.
+ *
+ * \param[in] handle      Handle on the scanner.
+ * \param[in] filetype    File type.
+ * \param[in] restriction Restrictions on the list.
+ * \param[in] after       ID of the last file of the previous page, 0 for
+ *                        the first page.
+ * \param[in] limit       Maximum number of rows, 0 for no limit.
+ * \return the statement, NULL on error.
+ */
+valhalla_db_stmt_t *
+valhalla_db_filelist_get_page (valhalla_t *handle,
+                               valhalla_file_type_t filetype,
+                               valhalla_db_restrict_t *restriction,
+                               int64_t after, unsigned int limit);
+
 /**
  * \brief Init a statement to retrieve the metadata of file.
  *
@@ -1068,6 +1282,84 @@ valhalla_db_file_get (valhalla_t *handle, int64_t id, const char *path,
 const valhalla_db_metares_t *
 valhalla_db_file_read (valhalla_t *handle, valhalla_db_stmt_t *vhstmt);
 
+/**
+ * \brief Retrieve the number of files.
+ *
+ * The files are counted with the same conditions as
+ * valhalla_db_filelist_get(), but without reading the rows.
+ *
+ * \param[in] handle      Handle on the scanner.
+ * \param[in] filetype    File type.
+ * \param[in] restriction Restrictions on the files.
+ * \return the number of files, -1 on error.
+ */
+int64_t valhalla_db_count (valhalla_t *handle,
+                           valhalla_file_type_t filetype,
+                           valhalla_db_restrict_t *restriction);
+
+/**
+ * \brief Init a statement to retrieve the number of files by group.
+ *
+ * If \p search is NULL, the files are counted by file type (with the
+ * conditions of valhalla_db_filelist_get()), else they are counted by
+ * metadata (with the conditions of valhalla_db_metalist_get()).
+ *
+ * Example (to count the files by genre):
+ *  \code
+ *  lang   = VALHALLA_LANG_ALL;
+ *  pmin   = VALHALLA_METADATA_PL_LOWEST;
+ *  search = VALHALLA_DB_SEARCH_TEXT ("genre", CLASSIFICATION, lang, pmin);
+ *  \endcode
+ *
+ * \param[in] handle      Handle on the scanner.
+ * \param[in] search      Condition for the search, NULL for the file types.
+ * \param[in] filetype    File type.
+ * \param[in] restriction Restrictions on the files.
+ * \return the statement, NULL on error.
+ */
+valhalla_db_stmt_t *
+valhalla_db_count_get (valhalla_t *handle,
+                       valhalla_db_item_t *search,
+                       valhalla_file_type_t filetype,
+                       valhalla_db_restrict_t *restriction);
+
+/**
+ * \brief Read the next row of a 'count' statement.
+ *
+ * The argument \p vhstmt must be initialized with valhalla_db_count_get().
+ * It is freed when the returned value is NULL. The pointer returned by the
+ * function is valid as long as no new call is done for the \p vhstmt.
+ *
+ * \param[in] handle      Handle on the scanner.
+ * \param[in] vhstmt      Statement.
+ * \return the result, NULL if no more row or on error.
+ */
+const valhalla_db_countres_t *
+valhalla_db_count_read (valhalla_t *handle, valhalla_db_stmt_t *vhstmt);
+
+/**
+ * \brief Init a statement to search files with a text.
+ *
+ * The words of \p text are searched as prefixes in the values of the
+ * metadata (case and diacritics are ignored), and all words must be found
+ * in a value. The files are ranked by relevance. It is suitable for a
+ * type-ahead search.
+ *
+ * The rows are read with valhalla_db_filelist_read().
+ *
+ * This function returns NULL if SQLite is built without FTS5.
+ *
+ * \param[in] handle      Handle on the scanner.
+ * \param[in] text        Text typed by the user.
+ * \param[in] meta        Meta name where to search, NULL for all.
+ * \param[in] filetype    File type.
+ * \param[in] limit       Maximum number of files, 0 for no limit.
+ * \return the statement, NULL on error.
+ */
+valhalla_db_stmt_t *
+valhalla_db_search (valhalla_t *handle, const char *text, const char *meta,
+                    valhalla_file_type_t filetype, unsigned int limit);
+
 /**
  * @}
  * \name Database insertions/updates/deletions.
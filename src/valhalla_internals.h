@@ -25,13 +25,15 @@
 typedef enum action_list {
   ACTION_KILL_THREAD  = -1, /* auto-kill when all pending commands are ended */
   ACTION_NO_OPERATION =  0, /* wake-up for nothing */
-  ACTION_PAUSE_THREAD,      /* send thread in waiting list */
   ACTION_DB_INSERT_P,       /* dispatcher: parser  metadata ok, insert in DB */
   ACTION_DB_INSERT_G,       /* dispatcher: grabber metadata ok, insert in DB */
   ACTION_DB_UPDATE_P,       /* dispatcher: parser  metadata ok, update in DB */
   ACTION_DB_UPDATE_G,       /* dispatcher: grabber metadata ok, update in DB */
   ACTION_DB_END,            /* dispatcher: end metadata */
   ACTION_DB_NEWFILE,        /* scanner: new file to handle */
+  ACTION_DB_DELFILE,        /* scanner: file removed (inotify) */
+  ACTION_DB_NEWDIR,         /* scanner: directory listed (cache) */
+  ACTION_DB_DIRCHECKED,     /* scanner: directory unchanged (cache) */
   ACTION_DB_NEXT_LOOP,      /* scanner: stop db manage queue for next loop */
   ACTION_DB_EXT_INSERT,     /* external metadata to insert */
   ACTION_DB_EXT_UPDATE,     /* external metadata to update */
@@ -67,6 +69,9 @@ struct valhalla_s {
   struct event_handler_s *event_handler;
 
   struct vh_stats_s *stats;
+  struct inflight_s *inflight; /* files handled by the threads */
+
+  unsigned int lavf_ctx_nb; /* contexts kept for the grabber ffmpeg */
 
 #ifdef USE_GRABBER
   struct url_ctl_s *url_ctl;
@@ -94,56 +99,4 @@ struct valhalla_s {
 #endif /* !vh_unused */
 
 
-/****************************************************************************/
-/* Thread 'pause' helpers                                                   */
-/****************************************************************************/
-
-#define VH_THREAD_PAUSE_ATTRS                                       \
-  int   paused;                                                     \
-  sem_t sem_pause;                                                  \
-  sem_t sem_pausing;
-
-#define VH_THREAD_PAUSE_INIT(handle)                                \
-  handle->paused = 0;                                               \
-  sem_init (&handle->sem_pause, 0, 0);                              \
-  sem_init (&handle->sem_pausing, 0, 0);
-
-#define VH_THREAD_PAUSE_UNINIT(handle)                              \
-  sem_destroy (&handle->sem_pause);                                 \
-  sem_destroy (&handle->sem_pausing);
-
-#define VH_THREAD_PAUSE_FORCESTOP(handle, nb)                       \
-  {                                                                 \
-    unsigned int i;                                                 \
-    for (i = 0; i < nb; i++)                                        \
-    {                                                               \
-      sem_post (&handle->sem_pause);                                \
-      sem_post (&handle->sem_pausing);                              \
-    }                                                               \
-  }
-
-#define VH_THREAD_PAUSE_FCT(handle, nb)                             \
-  {                                                                 \
-    unsigned int i;                                                 \
-    if (handle->paused)                                             \
-    {                                                               \
-      handle->paused = 0;                                           \
-      for (i = 0; i < nb; i++)                                      \
-        sem_post (&handle->sem_pause);                              \
-    }                                                               \
-    else                                                            \
-    {                                                               \
-      for (i = 0; i < nb; i++)                                      \
-        vh_fifo_queue_push (handle->fifo, FIFO_QUEUE_PRIORITY_HIGH, \
-                            ACTION_PAUSE_THREAD, NULL);             \
-      for (i = 0; i < nb; i++)                                      \
-        sem_wait (&handle->sem_pausing);                            \
-      handle->paused = 1;                                           \
-    }                                                               \
-  }
-
-#define VH_THREAD_PAUSE_ACTION(handle)                              \
-  sem_post (&handle->sem_pausing);                                  \
-  sem_wait (&handle->sem_pause);
-
 #endif /* VALHALLA_INTERNALS_H */
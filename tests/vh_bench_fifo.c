@@ -0,0 +1,185 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2010 Mathieu Schroeter <mathieu@schroetersa.ch>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Microbenchmark for the fifo queues. The same source is linked with the
+ * list-based queue (vh_bench_fifo_list) and with the lock-free rings
+ * (vh_bench_fifo_ring).
+ *
+ * Usage: vh_bench_fifo_xxx [producers] [consumers] [messages by producer]
+ *                          [batch]
+ *
+ * With a batch size > 1, the producers use vh_fifo_queue_push_many() and the
+ * consumers vh_fifo_queue_batch_pop().
+ *
+ * The ring binary is built with lanes of FIFO_QUEUE_RING_SIZE slots (see
+ * Makefile). When more messages are sent, the rings can use their overflow
+ * list and the result is reported with "(may overflow)".
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fifo_queue.h"
+
+#define BENCH_ID_DATA 1
+#define BENCH_ID_STOP 2
+
+typedef struct bench_s {
+  fifo_queue_t *queue;
+  unsigned long nb;
+  unsigned long sum;
+  unsigned int batch;
+} bench_t;
+
+
+static void *
+bench_producer (void *arg)
+{
+  bench_t *bench = arg;
+  unsigned long i;
+  unsigned int n = 0;
+  fifo_queue_msg_t msg[FIFO_QUEUE_BATCH_MAX];
+
+  for (i = 1; i <= bench->nb; i++)
+  {
+    if (bench->batch < 2)
+    {
+      vh_fifo_queue_push (bench->queue,
+                          i % 8 ? FIFO_QUEUE_PRIORITY_NORMAL
+                                : FIFO_QUEUE_PRIORITY_HIGH,
+                          BENCH_ID_DATA, (void *) i);
+      continue;
+    }
+
+    msg[n].id   = BENCH_ID_DATA;
+    msg[n].data = (void *) i;
+    if (++n == bench->batch || i == bench->nb)
+    {
+      vh_fifo_queue_push_many (bench->queue,
+                               FIFO_QUEUE_PRIORITY_NORMAL, msg, n);
+      n = 0;
+    }
+  }
+  return NULL;
+}
+
+static void *
+bench_consumer (void *arg)
+{
+  bench_t *bench = arg;
+  int id = 0;
+  void *data;
+  fifo_queue_batch_t batch = { .nb = 0 };
+
+  do
+  {
+    if (bench->batch > 1
+        ? vh_fifo_queue_batch_pop (bench->queue, &batch, &id, &data)
+        : vh_fifo_queue_pop (bench->queue, &id, &data))
+      continue;
+
+    if (id == BENCH_ID_DATA)
+      bench->sum += (unsigned long) data;
+  }
+  while (id != BENCH_ID_STOP);
+
+  /* The next entries are for the other consumers. */
+  vh_fifo_queue_batch_flush (bench->queue, &batch);
+  return NULL;
+}
+
+int
+main (int argc, char **argv)
+{
+  int i;
+  int producers = argc > 1 ? atoi (argv[1]) : 4;
+  int consumers = argc > 2 ? atoi (argv[2]) : 4;
+  unsigned long nb = argc > 3 ? strtoul (argv[3], NULL, 10) : 200000;
+  unsigned int batch = argc > 4 ? (unsigned int) atoi (argv[4]) : 1;
+  unsigned long sum = 0, total;
+  pthread_t *thread;
+  bench_t *bench;
+  fifo_queue_t *queue;
+  struct timespec start, end;
+  double elapsed;
+  const char *overflow = "";
+
+  if (producers < 1 || consumers < 1 || !nb)
+    return -1;
+
+  if (batch > FIFO_QUEUE_BATCH_MAX)
+    batch = FIFO_QUEUE_BATCH_MAX;
+
+  queue  = vh_fifo_queue_new ();
+  thread = calloc (producers + consumers, sizeof (*thread));
+  bench  = calloc (producers + consumers, sizeof (*bench));
+  if (!queue || !thread || !bench)
+    return -1;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  for (i = 0; i < producers + consumers; i++)
+  {
+    bench[i].queue = queue;
+    bench[i].nb    = nb;
+    bench[i].batch = batch;
+    pthread_create (&thread[i], NULL,
+                    i < producers ? bench_producer : bench_consumer, &bench[i]);
+  }
+
+  for (i = 0; i < producers; i++)
+    pthread_join (thread[i], NULL);
+
+  /* The stop messages are behind all data. */
+  for (i = 0; i < consumers; i++)
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, BENCH_ID_STOP, NULL);
+
+  for (i = producers; i < producers + consumers; i++)
+  {
+    pthread_join (thread[i], NULL);
+    sum += bench[i].sum;
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+
+  elapsed = (end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+  total = nb * producers;
+#ifdef FIFO_QUEUE_RING_SIZE
+  if (total > FIFO_QUEUE_RING_SIZE)
+    overflow = " (may overflow)";
+#endif /* FIFO_QUEUE_RING_SIZE */
+
+  printf ("%i producers, %i consumers, %lu messages, batch %u: "
+          "%.3f s, %.0f msg/s%s%s\n",
+          producers, consumers, total, batch, elapsed, total / elapsed,
+          overflow,
+          sum == producers * (nb * (nb + 1) / 2) ? "" : " (CORRUPTED)");
+
+  vh_fifo_queue_free (queue);
+  free (thread);
+  free (bench);
+
+  return sum != producers * (nb * (nb + 1) / 2);
+}